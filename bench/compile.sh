@@ -0,0 +1,95 @@
+#!/bin/sh
+# Compile throughput benchmark. Generates each synthetic input at a base
+# size and at four times that size, compiles it with $PONTACC (default
+# ./pontacc) on one thread, and reports time per phase, throughput and peak
+# memory.
+#
+#   bench/compile.sh            compare against bench/compile_baseline.txt
+#   bench/compile.sh --update   record the current numbers as the baseline
+#
+# A run fails when an input takes more than $BENCH_TOLERANCE (default 1.5)
+# times its baseline, or when growing an input four times makes it more
+# than five times slower, which points at quadratic behavior (n log n stays
+# under that). Baselines are kept in units of a calibration loop timed at
+# the start of every run, so that they carry over to faster or slower
+# machines; they still depend on how pontacc was built, so make bench and
+# make bench-baseline both run an -O2 build in bench/.build.
+
+cd `dirname $0`/..
+build=bench/.build
+baseline=bench/compile_baseline.txt
+tolerance=${BENCH_TOLERANCE:-1.5}
+pontacc=${PONTACC:-./pontacc}
+mkdir -p $build
+
+# kind and base size
+inputs="funcs:5000 expr:4000 nested:250 locals:8000 strings:2000 loops:2000"
+
+now_ms() {
+    echo $((`date +%s%N` / 1000000))
+}
+
+# the nanoseconds of a phase in a --stats-json file, in milliseconds
+phase_ms() {
+    sed -n "s/.*\"name\": \"$2\", \"nanos\": \([0-9]*\).*/\1/p" $1 | awk '{ s += $1 } END { printf "%d", s / 1000000 }'
+}
+
+counter() {
+    sed -n "s/.*\"$2\": \([0-9]*\).*/\1/p" $1
+}
+
+# the best of three runs of a fixed loop, in milliseconds
+calibrate() {
+    best=0
+    for i in 1 2 3; do
+        start=`now_ms`
+        awk 'BEGIN { for (i = 0; i < 2000000; i++) s += i % 7 }'
+        t=$((`now_ms` - start))
+        [ $best -eq 0 ] || [ $t -lt $best ] && best=$t
+    done
+    echo $((best > 0 ? best : 1))
+}
+
+status=0
+unit=`calibrate`
+echo "calibration: $unit ms"
+[ "$1" = "--update" ] && : > $baseline.new
+printf "%-14s %9s %9s %8s %8s %8s %8s %8s %9s %10s\n" \
+    input "size(KiB)" tokens "wall(ms)" "lex+out" parse codegen "MB/s" "rss(KiB)" baseline
+for input in $inputs; do
+    kind=${input%:*}
+    base=${input#*:}
+    small=0
+    for n in $base $((base * 4)); do
+        name=$kind-$n
+        bench/gen.sh $kind $n > $build/$name.c
+        start=`now_ms`
+        $pontacc --threads=1 --stats-json=$build/$name.json -o /dev/null $build/$name.c
+        if [ $? -ne 0 ]; then
+            echo "$name: compilation failed"
+            status=1
+            continue
+        fi
+        wall=$((`now_ms` - start))
+        json=$build/$name.json
+        bytes=`wc -c < $build/$name.c`
+        expected=`awk -v name=$name -v u=$unit '$1 == name { printf "%d", $2 * u }' $baseline 2> /dev/null`
+        printf "%-14s %9d %9d %8d %8d %8d %8d %8.1f %9d %10s\n" $name $((bytes / 1024)) \
+            `counter $json tokens` $wall `phase_ms $json outline` \
+            `phase_ms $json "parse function"` `phase_ms $json codegen` \
+            `awk -v b=$bytes -v t=$wall 'BEGIN { print t ? b / 1000 / t : 0 }'` \
+            `counter $json peak_rss_kib` ${expected:--}
+        [ "$1" = "--update" ] && awk -v name=$name -v t=$wall -v u=$unit 'BEGIN { printf "%s %.4f\n", name, t / u }' >> $baseline.new
+        if [ -n "$expected" ] && [ $wall -gt `awk -v e=$expected -v t=$tolerance 'BEGIN { printf "%d", e * t + 5 }'` ]; then
+            echo "$name: slower than the baseline ($wall ms > $tolerance x $expected ms)"
+            status=1
+        fi
+        if [ $small -gt 0 ] && [ $wall -gt $((small * 5 + 10)) ]; then
+            echo "$kind: 4x the input took `awk -v a=$wall -v b=$small 'BEGIN { printf "%.1f", a / b }'`x the time"
+            status=1
+        fi
+        small=$wall
+    done
+done
+[ "$1" = "--update" ] && mv $baseline.new $baseline && echo "wrote $baseline"
+exit $status
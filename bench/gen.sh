@@ -0,0 +1,86 @@
+#!/bin/sh
+# Writes a synthetic C program of the given kind and size to stdout.
+#
+#   bench/gen.sh funcs N     N small functions
+#   bench/gen.sh expr N      one expression of N terms
+#   bench/gen.sh nested N    blocks nested N deep
+#   bench/gen.sh locals N    one function with N locals
+#   bench/gen.sh strings N   N string literals
+#   bench/gen.sh loops N     N loops in one function
+#
+# Every program stays inside the subset pontacc accepts and returns 0.
+
+kind=$1
+n=$2
+if [ -z "$kind" ] || [ -z "$n" ]; then
+    echo "usage: $0 funcs|expr|nested|locals|strings|loops N" >&2
+    exit 1
+fi
+
+case $kind in
+funcs)
+    awk -v n=$n 'BEGIN {
+        print "int g;"
+        for (i = 0; i < n; i++) {
+            printf "int f%d(int a, int b) { int x; x = a + b * %d; if (x > %d) return x - b; g = g + x; return x; }\n", i, i % 7, i
+        }
+        print "int main() { return 0; }"
+    }'
+    ;;
+expr)
+    awk -v n=$n 'BEGIN {
+        printf "int main() { int x; x = 1; return 0 * (x"
+        for (i = 0; i < n; i++) {
+            printf " %s %d", (i % 3 == 0 ? "+" : i % 3 == 1 ? "-" : "*"), i % 10 + 1
+        }
+        print "); }"
+    }'
+    ;;
+nested)
+    awk -v n=$n 'BEGIN {
+        print "int main() { int x; x = 0;"
+        for (i = 0; i < n; i++) {
+            printf "if (x < %d) { x = x + 1;\n", i + 1
+        }
+        for (i = 0; i < n; i++) {
+            printf "}"
+        }
+        print "\nreturn x - " n "; }"
+    }'
+    ;;
+locals)
+    awk -v n=$n 'BEGIN {
+        print "int main() {"
+        for (i = 0; i < n; i++) {
+            printf "int v%d; v%d = %d;\n", i, i, i % 100
+        }
+        printf "return v0"
+        for (i = 1; i < n; i += n / 16 + 1) {
+            printf " - v%d + v%d", i, i
+        }
+        print "; }"
+    }'
+    ;;
+strings)
+    awk -v n=$n 'BEGIN {
+        print "int main() { char *s; int sum; sum = 0;"
+        for (i = 0; i < n; i++) {
+            printf "s = \"string literal number %d of the table\"; sum = sum + s[0];\n", i
+        }
+        print "return sum - 115 * " n "; }"
+    }'
+    ;;
+loops)
+    awk -v n=$n 'BEGIN {
+        print "int main() { int i; int sum; sum = 0;"
+        for (k = 0; k < n; k++) {
+            printf "for (i = 0; i < %d; i = i + 1) sum = sum + i;\n", k % 5 + 1
+        }
+        print "return 0 * sum; }"
+    }'
+    ;;
+*)
+    echo "$0: unknown kind $kind" >&2
+    exit 1
+    ;;
+esac
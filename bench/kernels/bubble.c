@@ -0,0 +1,34 @@
+#include "kernel.h"
+
+int data[3000];
+
+int bubble_sort(int *v, int n) {
+  int i; int j; int t; int swaps;
+  swaps = 0;
+  for (i = 0; i < n; i = i + 1)
+    for (j = 0; j < n - 1 - i; j = j + 1)
+      if (v[j] > v[j + 1]) {
+        t = v[j];
+        v[j] = v[j + 1];
+        v[j + 1] = t;
+        swaps = swaps + 1;
+      }
+  return swaps;
+}
+
+int main() {
+  int i; int seed; int sorted;
+  seed = 1;
+  for (i = 0; i < 3000; i = i + 1) {
+    seed = seed * 75 + 74;
+    seed = seed - seed / 65537 * 65537;
+    data[i] = seed;
+  }
+  bubble_sort(data, 3000);
+  sorted = 1;
+  for (i = 1; i < 3000; i = i + 1)
+    if (data[i - 1] > data[i])
+      sorted = 0;
+  CHECK(1, sorted);
+  return 0;
+}
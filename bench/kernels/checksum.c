@@ -0,0 +1,27 @@
+#include "kernel.h"
+
+char buffer[65536];
+
+int checksum(char *p, int n) {
+  int a; int b; int i;
+  a = 1;
+  b = 0;
+  for (i = 0; i < n; i = i + 1) {
+    a = a + p[i];
+    a = a - a / 65521 * 65521;
+    b = b + a;
+    b = b - b / 65521 * 65521;
+  }
+  return b - a;
+}
+
+int main() {
+  int i; int sum;
+  for (i = 0; i < 65536; i = i + 1)
+    buffer[i] = i - i / 93 * 93 + 32;
+  sum = 0;
+  for (i = 0; i < 100; i = i + 1)
+    sum = sum + checksum(buffer, 65536);
+  CHECK(1428500, sum);
+  return 0;
+}
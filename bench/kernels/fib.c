@@ -0,0 +1,12 @@
+#include "kernel.h"
+
+int fib(int n) {
+  if (n < 2)
+    return n;
+  return fib(n - 1) + fib(n - 2);
+}
+
+int main() {
+  CHECK(2178309, fib(32));
+  return 0;
+}
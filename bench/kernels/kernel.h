@@ -0,0 +1,6 @@
+// pontacc compiles the kernels with -DPONTACC, since it does not accept
+// declarations without a body.
+#ifndef PONTACC
+void assert(int expected, int actual, char *code);
+#endif
+#define CHECK(x, y) assert(x, y, #y)
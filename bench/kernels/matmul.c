@@ -0,0 +1,28 @@
+#include "kernel.h"
+
+int a[40000];
+int b[40000];
+int c[40000];
+
+int matmul(int n) {
+  int i; int j; int k; int sum;
+  for (i = 0; i < n; i = i + 1)
+    for (j = 0; j < n; j = j + 1) {
+      sum = 0;
+      for (k = 0; k < n; k = k + 1)
+        sum = sum + a[i * n + k] * b[k * n + j];
+      c[i * n + j] = sum;
+    }
+  return c[n * n - 1];
+}
+
+int main() {
+  int n; int i;
+  n = 200;
+  for (i = 0; i < n * n; i = i + 1) {
+    a[i] = i - i / 7 * 7;
+    b[i] = i - i / 5 * 5;
+  }
+  CHECK(2400, matmul(n));
+  return 0;
+}
@@ -0,0 +1,26 @@
+#include "kernel.h"
+
+char composite[2000000];
+
+int sieve(int n) {
+  int i; int j; int count;
+  for (i = 0; i < n; i = i + 1)
+    composite[i] = 0;
+  count = 0;
+  for (i = 2; i < n; i = i + 1) {
+    if (composite[i] == 0) {
+      count = count + 1;
+      for (j = i * 2; j < n; j = j + i)
+        composite[j] = 1;
+    }
+  }
+  return count;
+}
+
+int main() {
+  int round; int count;
+  for (round = 0; round < 5; round = round + 1)
+    count = sieve(2000000);
+  CHECK(148933, count);
+  return 0;
+}
@@ -0,0 +1,31 @@
+#include "kernel.h"
+
+char text[100000];
+
+int count_char(char *s, int c) {
+  int n;
+  n = 0;
+  while (*s) {
+    if (*s == c)
+      n = n + 1;
+    s = s + 1;
+  }
+  return n;
+}
+
+int main() {
+  char *pattern; int i; int j; int total;
+  pattern = "the quick brown fox jumps over the lazy dog ";
+  j = 0;
+  for (i = 0; i < 99999; i = i + 1) {
+    if (pattern[j] == 0)
+      j = 0;
+    text[i] = pattern[j];
+    j = j + 1;
+  }
+  total = 0;
+  for (i = 0; i < 200; i = i + 1)
+    total = total + count_char(text, 111);
+  CHECK(1818200, total);
+  return 0;
+}
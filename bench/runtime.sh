@@ -0,0 +1,79 @@
+#!/bin/sh
+# Runtime benchmark of generated code. Every kernel in bench/kernels is
+# built with ./pontacc and with gcc -O0 and -O2, linked against test/common,
+# checked for the expected result and timed. Times are the best of
+# $BENCH_RUNS (default 3) runs. Instruction counts come from perf stat when
+# it is installed and allowed to read the counters.
+#
+#   bench/runtime.sh [kernel...]   e.g. bench/runtime.sh fib sieve
+#
+# Extra options for pontacc can be given in $PONTACC_FLAGS.
+
+cd `dirname $0`/..
+build=bench/.build
+runs=${BENCH_RUNS:-3}
+mkdir -p $build
+
+kernels="$*"
+[ -z "$kernels" ] && kernels=`ls bench/kernels/*.c | sed 's|.*/||; s|\.c$||'`
+
+has_perf=0
+perf stat -x, -e instructions:u true > /dev/null 2>&1 && has_perf=1
+
+now_us() {
+    echo $((`date +%s%N` / 1000))
+}
+
+# prints the best wall time in milliseconds, or "fail"
+best_ms() {
+    best=
+    i=0
+    while [ $i -lt $runs ]; do
+        start=`now_us`
+        $1 > /dev/null || { echo fail; return; }
+        t=$((`now_us` - start))
+        [ -z "$best" ] || [ $t -lt $best ] && best=$t
+        i=$((i + 1))
+    done
+    awk -v t=$best 'BEGIN { printf "%.1f", t / 1000 }'
+}
+
+instructions() {
+    if [ $has_perf -eq 0 ]; then
+        echo -
+        return
+    fi
+    perf stat -x, -e instructions:u $1 2>&1 > /dev/null | awk -F, '/instructions/ { printf "%.0fM", $1 / 1e6 }'
+}
+
+ratio() {
+    awk -v a=$1 -v b=$2 'BEGIN { if (a + 0 > 0 && b + 0 > 0) printf "%.2f", a / b; else printf "-" }'
+}
+
+status=0
+printf "%-10s %11s %11s %11s %9s %9s %10s %10s %10s\n" kernel "pontacc(ms)" "gcc-O0(ms)" "gcc-O2(ms)" "vs -O0" "vs -O2" "insn" "insn-O0" "insn-O2"
+for kernel in $kernels; do
+    src=bench/kernels/$kernel.c
+    exe=$build/$kernel
+    ./pontacc $PONTACC_FLAGS -DPONTACC -o $exe.s $src &&
+    cc -o $exe.pontacc $exe.s -xc test/common 2> /dev/null &&
+    cc -O0 -w -o $exe.O0 $src -xc test/common &&
+    cc -O2 -w -o $exe.O2 $src -xc test/common
+    if [ $? -ne 0 ]; then
+        echo "$kernel: build failed"
+        status=1
+        continue
+    fi
+    ours=`best_ms $exe.pontacc`
+    o0=`best_ms $exe.O0`
+    o2=`best_ms $exe.O2`
+    if [ "$ours" = fail ] || [ "$o0" = fail ] || [ "$o2" = fail ]; then
+        echo "$kernel: wrong result"
+        status=1
+        continue
+    fi
+    printf "%-10s %11s %11s %11s %9s %9s %10s %10s %10s\n" $kernel $ours $o0 $o2 \
+        `ratio $ours $o0` `ratio $ours $o2` \
+        `instructions $exe.pontacc` `instructions $exe.O0` `instructions $exe.O2`
+done
+exit $status
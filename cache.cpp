@@ -0,0 +1,69 @@
+#include "cache.h"
+#include <unistd.h>
+
+void Hasher::add_bytes(string_view bytes){
+    for (unsigned char c : bytes){
+        m_fnv = (m_fnv ^ c) * 1099511628211ull;
+        m_mix = rotl((m_mix ^ c) * 0xff51afd7ed558ccdull, 29);
+    }
+}
+
+Hasher& Hasher::add(string_view text){
+    uint64_t size = text.size();
+    add_bytes({reinterpret_cast<const char*>(&size), sizeof(size)});
+    add_bytes(text);
+    return *this;
+}
+
+string Hasher::hex() const{
+    char buffer[33];
+    snprintf(buffer, sizeof(buffer), "%016llx%016llx",
+        static_cast<unsigned long long>(m_fnv), static_cast<unsigned long long>(m_mix));
+    return buffer;
+}
+
+// The build passes a checksum of the sources as PONTACC_VERSION; other
+// builds fall back to their build time.
+#ifndef PONTACC_VERSION
+#define PONTACC_VERSION __DATE__ " " __TIME__
+#endif
+
+const string& compiler_version(){
+    static const string version = Hasher().add(PONTACC_VERSION).hex();
+    return version;
+}
+
+// Entries are spread over 256 subdirectories by the first byte of the key.
+filesystem::path CompileCache::entry(const string& key) const{
+    return m_dir / key.substr(0, 2) / key.substr(2);
+}
+
+optional<string> CompileCache::get(const string& key) const{
+    ifstream file(entry(key), ios::binary);
+    if (!file){
+        return nullopt;
+    }
+    stringstream text;
+    text << file.rdbuf();
+    return move(text).str();
+}
+
+void CompileCache::put(const string& key, string_view value) const{
+    auto path = entry(key);
+    error_code ec;
+    filesystem::create_directories(path.parent_path(), ec);
+    auto temporary = path;
+    temporary += "." + to_string(getpid()) + "." + to_string(hash<thread::id>()(this_thread::get_id())) + ".tmp";
+    {
+        ofstream file(temporary, ios::binary);
+        if (!file.write(value.data(), value.size())){
+            file.close();
+            filesystem::remove(temporary, ec);
+            return;
+        }
+    }
+    filesystem::rename(temporary, path, ec);
+    if (ec){
+        filesystem::remove(temporary, ec);
+    }
+}
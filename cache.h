@@ -0,0 +1,36 @@
+#pragma once
+#include "common.h"
+
+// On-disk store of compiler outputs keyed by a hash of everything they
+// depend on. Entries are written to a temporary file and renamed into
+// place, so concurrent compilers sharing a directory never read a partial
+// entry. Failing to read or write the directory only costs a miss.
+
+// 128 bits of two independent 64-bit hashes over a sequence of strings.
+class Hasher {
+    uint64_t m_fnv = 14695981039346656037ull;
+    uint64_t m_mix = 0x9e3779b97f4a7c15ull;
+
+    void add_bytes(string_view bytes);
+public:
+    // Each string is hashed with its length, so ("ab", "c") and ("a", "bc")
+    // differ.
+    Hasher& add(string_view text);
+    string hex() const;
+};
+
+// Hash of the version the compiler was built with, a checksum of its
+// sources, so that a rebuilt compiler does not reuse the outputs of an
+// older one.
+const string& compiler_version();
+
+class CompileCache {
+    filesystem::path m_dir;
+
+    filesystem::path entry(const string& key) const;
+public:
+    explicit CompileCache(filesystem::path dir): m_dir(move(dir)){}
+
+    optional<string> get(const string& key) const;
+    void put(const string& key, string_view value) const;
+};
@@ -3,19 +3,38 @@
 #include <span>
 using namespace std;
 
-// Reports an error location and exit.
-inline void verror_at(string_view current_input, int pos, string_view fmt, bool next=false) {
+// An error in the compiled source. Lines and columns count from 1.
+struct Diagnostic {
+    size_t line = 0;
+    size_t column = 0;
+    string message;
+    string source_line;
+    string file = {};   // the header the error is in, empty for the input
+
+    // The source line, a caret under the column and the message.
+    string to_string() const {
+        return source_line + "\n" + string(column - 1, ' ') + "^ " + message + "\n";
+    }
+};
+
+class CompileError : public runtime_error {
+    Diagnostic m_diagnostic;
+public:
+    explicit CompileError(Diagnostic diagnostic):
+        runtime_error(diagnostic.message), m_diagnostic(move(diagnostic)){}
+    const Diagnostic& diagnostic() const { return m_diagnostic; }
+};
+
+// Throws a CompileError at column pos of the line current_input starts with.
+[[noreturn]] inline void verror_at(string_view current_input, size_t line, size_t pos, string_view fmt, bool next=false) {
     auto eol = current_input.find("\n");
     if (eol != std::string_view::npos){
         current_input = current_input.substr(0, eol);
     }
-    cerr << current_input << endl;
-    for (int i = 0; i < pos + (next ? 1: 0); ++i){
-        cerr << " "; // print pos spaces.
+    while (fmt.ends_with('\n')){
+        fmt.remove_suffix(1);
     }
-    cerr <<  "^ ";
-    cerr << fmt << endl;
-    throw;
+    throw CompileError({line + 1, pos + (next ? 1 : 0) + 1, string(fmt), string(current_input)});
 }
 
 // Round up n
@@ -33,12 +52,5 @@ inline ToType variant_cast(FromType&& v)
 
 template<class... Ts> struct overload : Ts... { using Ts::operator()...; };
 
-inline ostream& ostr(unique_ptr<ostream> os = nullptr){
-    static unique_ptr<ostream> os_;
-    if (os)
-        os_ = move(os);
-    return *os_;
-}
-
 template<class T>
 using optref = optional<reference_wrapper<T>>;
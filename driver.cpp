@@ -0,0 +1,614 @@
+#include "driver.h"
+#include "jit.h"
+#include "preprocessor.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Whole input of one translation unit. Regular files are mapped read-only;
+// pipes and other streams are read into a single growable buffer.
+class Input {
+    const char* m_map = nullptr;
+    size_t m_size = 0;
+    vector<char> m_buffer;
+
+    void read_stream(int fd){
+        m_buffer.resize(1 << 16);
+        while (true){
+            if (m_size == m_buffer.size()){
+                m_buffer.resize(m_buffer.size() * 2);
+            }
+            auto n = ::read(fd, m_buffer.data() + m_size, m_buffer.size() - m_size);
+            if (n < 0 && errno == EINTR){
+                continue;
+            }
+            if (n < 0){
+                throw runtime_error("failed to read input: "s + strerror(errno));
+            }
+            if (n == 0){
+                break;
+            }
+            m_size += n;
+        }
+    }
+public:
+    // The input "-" is data when given, and stdin otherwise.
+    Input(const string& file_name, optional<string_view> data){
+        if (file_name == "-" && data){
+            m_buffer.assign(data->begin(), data->end());
+            m_size = m_buffer.size();
+            return;
+        }
+        if (file_name == "-"){
+            read_stream(STDIN_FILENO);
+            return;
+        }
+        int fd = ::open(file_name.c_str(), O_RDONLY);
+        if (fd < 0){
+            throw invalid_argument("input file cannot be opened");
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+            m_size = st.st_size;
+            auto map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED){
+                madvise(map, m_size, MADV_SEQUENTIAL);
+                m_map = static_cast<const char*>(map);
+            }
+            else {
+                m_size = 0;
+                read_stream(fd);
+            }
+        }
+        else {
+            read_stream(fd);
+        }
+        ::close(fd);
+    }
+    Input(const Input&) = delete;
+    ~Input(){
+        if (m_map){
+            munmap(const_cast<char*>(m_map), m_size);
+        }
+    }
+    string_view text() const { return {m_map ? m_map : m_buffer.data(), m_size}; }
+};
+
+// Thrown to stop the driver with the usage text and an exit status.
+struct Usage {
+    int status;
+};
+
+[[noreturn]] static void show_usage(int status){
+    throw Usage{status};
+}
+
+static void print_usage(ostream& err, bool full){
+    err << "./pontacc [ -o output file name ] [ -O0 | -O1 | -O2 ] [ --passes=a,b,... ] [ --time-passes ]" << endl;
+    err << "          [ --threads=N ] [ --pipeline ] [ --emit-ir ] [ --cache=directory [ --cache-functions ] ]" << endl;
+    err << "          [ -ftime-report ] [ --stats ] [ --stats-json=file ] [ --trace=file ] <input file name>" << endl;
+    err << "          [ -I directory ] [ -D name[=value] ] [ -E | -c ]" << endl;
+    err << "./pontacc [ options ] [ -j N ] <input file name>... [ @response file ]..." << endl;
+    err << "./pontacc --run | --interpret [ options ] [ --load=library ]... <input file name> [ argument ]..." << endl;
+    err << "./pontacc --server[=socket] | --client[=socket] [ options ] <input file name>..." << endl;
+    if (full){
+        err << endl << "With several inputs each x.c is compiled to x.s, -j N files at a time." << endl;
+        err << "-c writes an ELF object in place of assembly, to x.o unless -o is given." << endl;
+        err << "A response file holds further arguments separated by white space." << endl;
+        err << "--run compiles into memory and calls main with the arguments after the input;" << endl;
+        err << "functions not defined there are taken from libc and the --load libraries." << endl;
+        err << "--interpret runs the same way without generating machine code." << endl;
+        err << "A server keeps compiling for clients, which take the same options." << endl;
+        err << "--cache reuses the output of an input compiled before with the same options;" << endl;
+        err << "with --cache-functions, the unchanged functions of a changed input as well." << endl;
+        err << endl << "passes:" << endl;
+        for (auto& pass : all_passes()){
+            err << "  " << left << setw(14) << pass.name << pass.description << endl;
+        }
+    }
+}
+
+string SessionCache::key(const CompileOptions& o){
+    return to_string(o.level) + ";" + o.passes.value_or("-") + ";" + to_string(o.threads) + ";"
+        + to_string(o.pipeline) + to_string(o.emit_ir) + to_string(o.object) + to_string(o.stats) + to_string(o.trace) + ";"
+        + o.cache_dir + ";" + to_string(o.cache_functions);
+}
+
+unique_ptr<Session> SessionCache::take(const CompileOptions& options){
+    {
+        lock_guard lock(m_mutex);
+        auto wanted = key(options);
+        auto it = find_if(m_idle.begin(), m_idle.end(), [&](auto& idle){ return idle.first == wanted; });
+        if (it != m_idle.end()){
+            auto session = move(it->second);
+            m_idle.erase(it);
+            return session;
+        }
+    }
+    return make_unique<Session>(options);
+}
+
+void SessionCache::give_back(const CompileOptions& options, unique_ptr<Session> session){
+    unique_ptr<Session> evicted;    // destroyed once the lock is released
+    lock_guard lock(m_mutex);
+    m_idle.emplace_front(key(options), move(session));
+    if (m_idle.size() > m_capacity){
+        evicted = move(m_idle.back().second);
+        m_idle.pop_back();
+    }
+}
+
+// Splits the contents of a response file into arguments. Quotes group
+// white space into an argument and a backslash escapes the next character.
+static vector<string> split_arguments(string_view text){
+    vector<string> args;
+    string arg;
+    bool in_arg = false;
+    char quote = 0;
+    for (size_t i = 0; i < text.size(); ++i){
+        auto c = text[i];
+        if (c == '\\' && i + 1 < text.size()){
+            arg += text[++i];
+            in_arg = true;
+        }
+        else if (quote){
+            if (c == quote){
+                quote = 0;
+            }
+            else {
+                arg += c;
+            }
+        }
+        else if (c == '"' || c == '\''){
+            quote = c;
+            in_arg = true;
+        }
+        else if (isspace(static_cast<unsigned char>(c))){
+            if (in_arg){
+                args.push_back(move(arg));
+                arg.clear();
+                in_arg = false;
+            }
+        }
+        else {
+            arg += c;
+            in_arg = true;
+        }
+    }
+    if (in_arg){
+        args.push_back(move(arg));
+    }
+    return args;
+}
+
+// A path given by the client of a server is relative to the client's
+// working directory.
+static string resolve(const DriverContext& context, string_view path){
+    if (context.cwd.empty() || path == "-" || path.starts_with("/")){
+        return string(path);
+    }
+    return (context.cwd / path).string();
+}
+
+// Replaces every @file argument by the arguments in the file, which may
+// refer to further response files.
+static void expand_arguments(const DriverContext& context, string_view arg, vector<string>& args, int depth = 0){
+    if (!arg.starts_with("@") || arg.size() == 1){
+        args.emplace_back(arg);
+        return;
+    }
+    if (depth > 16){
+        throw invalid_argument("response files nest too deeply");
+    }
+    ifstream file{resolve(context, arg.substr(1))};
+    if (!file){
+        throw invalid_argument("response file cannot be opened");
+    }
+    stringstream text;
+    text << file.rdbuf();
+    for (auto& inner : split_arguments(text.view())){
+        expand_arguments(context, inner, args, depth + 1);
+    }
+}
+
+// Where a batch compile writes the assembly or object of an input: its
+// extension replaced by .s or .o.
+static string output_name(string_view input, bool object){
+    string_view extension = object ? ".o" : ".s";
+    auto slash = input.rfind('/');
+    auto dot = input.rfind('.');
+    if (dot == string_view::npos || (slash != string_view::npos && dot < slash) || input.substr(dot) == extension){
+        dot = input.size();
+    }
+    return string(input.substr(0, dot)) + string(extension);
+}
+
+struct Reports {
+    bool time_passes = false;
+    bool time_report = false;
+    bool print_stats = false;
+    optional<string> stats_json;
+    optional<string> trace;
+
+    bool any() const {
+        return time_passes || time_report || print_stats || stats_json || trace;
+    }
+    void write(Session& session, ostream& err) const {
+        if (time_passes){
+            session.passes().report(err);
+        }
+        if (time_report){
+            session.stats().report_time(err);
+        }
+        if (print_stats){
+            session.stats().report_counters(err);
+        }
+        if (stats_json){
+            ofstream json{*stats_json};
+            session.stats().write_json(json);
+        }
+        if (trace){
+            ofstream json{*trace};
+            session.stats().write_trace(json);
+        }
+    }
+};
+
+// How inputs are read before they are compiled.
+struct InputOptions {
+    PreprocessOptions preprocess;
+    bool preprocess_only = false;   // write the preprocessed input instead
+};
+
+// Reads an input and hands its text to compile, preprocessed when there is
+// anything to preprocess. An error in the source is returned as a diagnostic pointing
+// into the file it came from.
+static optional<Diagnostic> compile_input(const DriverContext& context, const InputOptions& input_options,
+        const string& in_file_name, const function<void(string_view)>& compile){
+    auto input = [&]{
+        Phase phase("read");
+        return make_unique<Input>(in_file_name, context.stdin_data);
+    }();
+    optional<Preprocessed> preprocessed;
+    try {
+        auto text = input->text();
+        // input without directives or macros is read as it is
+        if (needs_preprocessing(text, input_options.preprocess)){
+            Phase phase("preprocess");
+            preprocessed = preprocess(text, in_file_name, input_options.preprocess);
+            text = preprocessed->text;
+        }
+        compile(text);
+    }
+    catch (const CompileError& e){
+        auto diagnostic = e.diagnostic();
+        if (preprocessed){
+            preprocessed->locate(diagnostic);
+        }
+        return diagnostic;
+    }
+    return nullopt;
+}
+
+// Compiles one input into out_file_name, or to stdout without one. On an
+// error in the source the output is removed again.
+static optional<Diagnostic> compile_file(const DriverContext& context, Session& session, const InputOptions& input_options,
+        const string& in_file_name, const optional<string>& out_file_name){
+    StatsScope scope(session.stats());
+    unique_ptr<ofstream> file;
+    auto diagnostic = compile_input(context, input_options, in_file_name, [&](string_view text){
+        if (out_file_name){
+            file = make_unique<ofstream>(*out_file_name);
+            if (!*file){
+                throw invalid_argument("output file cannot be opened");
+            }
+        }
+        streambuf* target = file ? file->rdbuf() : context.out.rdbuf();
+        // the output is counted through a buffer in between
+        CountingBuf counting(target);
+        ostream out(session.stats().enabled() ? &counting : target);
+        if (input_options.preprocess_only){
+            out << text;
+        }
+        else {
+            session.compile(text, out);
+        }
+        Phase phase("write");
+        out.flush();
+    });
+    if (diagnostic && file){
+        file.reset();
+        // not a device such as /dev/null
+        if (filesystem::is_regular_file(*out_file_name)){
+            remove(out_file_name->c_str());
+        }
+    }
+    return diagnostic;
+}
+
+// Prints the diagnostic of the single input compiled.
+static void print_diagnostic(const DriverContext& context, const Diagnostic& diagnostic){
+    if (!diagnostic.file.empty()){
+        context.err << diagnostic.file << ":" << diagnostic.line << ":" << diagnostic.column << ":" << endl;
+    }
+    context.err << diagnostic.to_string();
+}
+
+// Compiles the input into memory, or only to IR for the interpreter, and
+// runs it with the arguments after it.
+static int run_program(const CompileOptions& options, const InputOptions& input_options, const DriverContext& context,
+        const string& in_file_name, bool interpret_ir, const vector<string>& libraries, const vector<string>& program_args,
+        const Reports& reports){
+    Session session(options);
+    optional<ObjectImage> image;
+    optional<IrProgram> program;
+    auto diagnostic = [&]{
+        StatsScope scope(session.stats());
+        return compile_input(context, input_options, in_file_name, [&](string_view text){
+            if (interpret_ir){
+                program = session.compile_ir(text);
+            }
+            else {
+                image = session.compile_object(text);
+            }
+        });
+    }();
+    if (diagnostic){
+        print_diagnostic(context, *diagnostic);
+        return 1;
+    }
+    reports.write(session, context.err);
+    vector<string> args{in_file_name};
+    args.insert(args.end(), program_args.begin(), program_args.end());
+    if (program){
+        return interpret(*program, libraries, args);
+    }
+    return run_image(*image, libraries, args);
+}
+
+// Compiles every input to its own output with one session per worker, and
+// reports the files that failed and a summary on stderr.
+static int compile_batch(const DriverContext& context, const vector<string>& inputs, const CompileOptions& options,
+        const InputOptions& input_options, size_t jobs, const Reports& reports){
+    ThreadPool pool(min(jobs, inputs.size()));
+    vector<unique_ptr<Session>> sessions;
+    for (size_t i = 0; i < pool.size(); ++i){
+        sessions.push_back(context.sessions ? context.sessions->take(options) : make_unique<Session>(options));
+    }
+    atomic<size_t> failed = 0;
+    atomic<uint64_t> bytes = 0;
+    mutex error_mutex;
+    auto start = chrono::steady_clock::now();
+    pool.run_on_workers(inputs.size(), [&](size_t i, size_t worker){
+        auto& input = inputs[i];
+        string error;
+        try {
+            if (auto d = compile_file(context, *sessions[worker], input_options, input, output_name(input, options.object))){
+                error = (d->file.empty() ? input : d->file) + ":" + to_string(d->line) + ":" + to_string(d->column) + ": "
+                    + d->message + "\n" + d->to_string();
+            }
+        }
+        catch (const exception& e){
+            error = input + ": " + e.what() + "\n";
+        }
+        if (!error.empty()){
+            ++failed;
+            lock_guard lock(error_mutex);
+            context.err << error;
+            return;
+        }
+        error_code ec;
+        bytes += filesystem::file_size(input, ec);
+    });
+    auto millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    context.err << "pontacc: " << inputs.size() << " files, " << failed << " failed, "
+         << fixed << setprecision(1) << bytes / 1e6 << " MB in " << millis << " ms ("
+         << bytes / 1e3 / max(millis, 1e-3) << " MB/s) on " << pool.size() << " threads" << endl;
+    for (size_t i = 1; i < sessions.size(); ++i){
+        sessions[0]->stats().merge(sessions[i]->stats());
+        sessions[0]->passes().merge(sessions[i]->passes());
+    }
+    reports.write(*sessions[0], context.err);
+    for (auto& session : sessions){
+        if (context.sessions){
+            context.sessions->give_back(options, move(session));
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+static int run(const vector<string>& command_line, const DriverContext& context){
+    vector<string> args;
+    for (auto& arg : command_line){
+        expand_arguments(context, arg, args);
+    }
+    vector<string> in_file_names;
+    optional<string> out_file_name;
+    CompileOptions options;
+    optional<size_t> threads;
+    size_t jobs = max(1u, thread::hardware_concurrency());
+    Reports reports;
+    InputOptions input_options;
+    bool run = false;
+    bool interpret_ir = false;
+    vector<string> libraries;
+    vector<string> program_args;
+    for (size_t i = 0; i < args.size(); ++i){
+        auto curr = string_view(args[i]);
+        if (curr == "--help"){
+            show_usage(0);
+        }
+        else if (curr == "-o"){
+            if(i == args.size() -1){
+                show_usage(1);
+            }
+            out_file_name = resolve(context, args[++i]);
+        }
+        else if (curr.starts_with("-o")){
+            out_file_name = resolve(context, curr.substr(2));
+        }
+        else if (curr == "-j"){
+            if(i == args.size() -1){
+                show_usage(1);
+            }
+            jobs = stoul(args[++i]);
+        }
+        else if (curr.starts_with("-j")){
+            jobs = stoul(string(curr.substr(2)));
+        }
+        else if (curr == "--pipeline"){
+            options.pipeline = true;
+        }
+        else if (curr.starts_with("--cache=")){
+            options.cache_dir = resolve(context, curr.substr(8));
+        }
+        else if (curr == "--cache-functions"){
+            options.cache_functions = true;
+        }
+        else if (curr.starts_with("-I") || curr.starts_with("-D")){
+            if(curr.size() == 2 && i == args.size() -1){
+                show_usage(1);
+            }
+            auto value = curr.size() == 2 ? string_view(args[++i]) : curr.substr(2);
+            if (curr[1] == 'I'){
+                input_options.preprocess.include_dirs.push_back(resolve(context, value));
+                continue;
+            }
+            auto equals = value.find('=');
+            if (equals == string_view::npos){
+                input_options.preprocess.defines.emplace_back(value, "1");
+            }
+            else {
+                input_options.preprocess.defines.emplace_back(value.substr(0, equals), value.substr(equals + 1));
+            }
+        }
+        else if (curr == "-E"){
+            input_options.preprocess_only = true;
+        }
+        else if (curr == "--run"){
+            run = true;
+        }
+        else if (curr == "--interpret"){
+            run = interpret_ir = true;
+        }
+        else if (curr.starts_with("--load=")){
+            libraries.push_back(resolve(context, curr.substr(7)));
+        }
+        else if (curr == "-c"){
+            options.object = true;
+        }
+        else if (curr == "--emit-ir"){
+            options.emit_ir = true;
+        }
+        else if (curr == "-O"){
+            options.level = 1;
+        }
+        else if (curr == "-O0" || curr == "-O1" || curr == "-O2"){
+            options.level = curr[2] - '0';
+        }
+        else if (curr.starts_with("--passes=")){
+            options.passes = curr.substr(9);
+        }
+        else if (curr == "--time-passes"){
+            reports.time_passes = true;
+        }
+        else if (curr == "-ftime-report"){
+            reports.time_report = true;
+        }
+        else if (curr == "--stats"){
+            reports.print_stats = true;
+        }
+        else if (curr.starts_with("--stats-json=")){
+            reports.stats_json = resolve(context, curr.substr(13));
+        }
+        else if (curr.starts_with("--trace=")){
+            reports.trace = resolve(context, curr.substr(8));
+        }
+        else if (curr.starts_with("--threads=")){
+            threads = stoul(string(curr.substr(10)));
+            if (threads == 0u){
+                show_usage(1);
+            }
+        }
+        else if (curr.size() > 1 && curr.starts_with("-")){
+            throw invalid_argument("unknown option");
+        }
+        else {
+            in_file_names.push_back(resolve(context, args[i]));
+            // the arguments after the program are its own
+            if (run){
+                program_args.assign(args.begin() + i + 1, args.end());
+                break;
+            }
+        }
+    }
+    if (in_file_names.empty()){
+        context.err << "input file name must be specified" << endl;
+        show_usage(1);
+    }
+    if (jobs == 0 || (options.cache_functions && options.cache_dir.empty())){
+        show_usage(1);
+    }
+    if (options.object && options.emit_ir){
+        context.err << "-c and --emit-ir cannot be used together" << endl;
+        show_usage(1);
+    }
+    options.stats = reports.time_report || reports.print_stats || reports.stats_json;
+    options.trace = reports.trace.has_value();
+    if (context.sessions){
+        threads = min(threads.value_or(SIZE_MAX), context.sessions->threads());
+        jobs = min(jobs, context.sessions->threads());
+    }
+    // sessions that collect statistics are not shared between invocations
+    auto shared = context.sessions && !reports.any() ? context.sessions : nullptr;
+    if (run){
+        if (out_file_name || options.object || options.emit_ir || input_options.preprocess_only || context.sessions){
+            context.err << "--run and --interpret cannot be used with -o, -c, -E, --emit-ir or a server" << endl;
+            show_usage(1);
+        }
+        options.object = true;
+        options.threads = threads.value_or(max(1u, thread::hardware_concurrency()));
+        return run_program(options, input_options, context, in_file_names[0], interpret_ir, libraries, program_args, reports);
+    }
+    DriverContext session_context = context;
+    session_context.sessions = shared;
+    if (in_file_names.size() > 1){
+        if (out_file_name || input_options.preprocess_only){
+            context.err << "-o and -E cannot be used with several input files" << endl;
+            show_usage(1);
+        }
+        // files are the unit of parallelism unless asked otherwise
+        options.threads = threads.value_or(1);
+        return compile_batch(session_context, in_file_names, options, input_options, jobs, reports);
+    }
+    // an object goes next to its input, and to stdout when read from stdin
+    if (options.object && !out_file_name && !input_options.preprocess_only && in_file_names[0] != "-"){
+        out_file_name = output_name(in_file_names[0], true);
+    }
+    options.threads = threads.value_or(max(1u, thread::hardware_concurrency()));
+    auto session = shared ? shared->take(options) : make_unique<Session>(options);
+    if (auto diagnostic = compile_file(context, *session, input_options, in_file_names[0], out_file_name)){
+        print_diagnostic(context, *diagnostic);
+        return 1;
+    }
+    reports.write(*session, context.err);
+    if (shared){
+        shared->give_back(options, move(session));
+    }
+    return 0;
+}
+
+int run_driver(const vector<string>& args, const DriverContext& context){
+    try {
+        return run(args, context);
+    }
+    catch (const Usage& usage){
+        print_usage(context.err, usage.status == 0);
+        return usage.status;
+    }
+    catch (const exception& e){
+        context.err << "pontacc: " << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "common.h"
+#include "pontacc.h"
+
+// Idle sessions kept between invocations of the driver, found by the
+// options they were made with. At most capacity are kept, the least
+// recently used going first, and the driver gives each invocation at most
+// threads threads, so that invocations running side by side stay bounded.
+class SessionCache {
+    size_t m_threads;
+    size_t m_capacity;
+    mutex m_mutex;
+    list<pair<string, unique_ptr<Session>>> m_idle;    // most recently used first
+
+    static string key(const CompileOptions& options);
+public:
+    SessionCache(size_t threads, size_t capacity): m_threads(threads), m_capacity(capacity) {}
+
+    size_t threads() const { return m_threads; }
+    // An idle session made with the same options, or a new one.
+    unique_ptr<Session> take(const CompileOptions& options);
+    void give_back(const CompileOptions& options, unique_ptr<Session> session);
+};
+
+// Where one invocation of the command line reads and writes.
+struct DriverContext {
+    ostream& out;                           // assembly when there is no -o
+    ostream& err;                           // diagnostics and reports
+    filesystem::path cwd = {};              // relative paths are resolved against it, if set
+    optional<string_view> stdin_data = {};  // the input "-" when it is not read from stdin
+    SessionCache* sessions = nullptr;       // sessions to reuse, if any
+};
+
+// Runs the command line without the program name and returns the exit
+// status.
+int run_driver(const vector<string>& args, const DriverContext& context);
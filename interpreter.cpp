@@ -0,0 +1,221 @@
+#include "interpreter.h"
+#include "jit.h"
+#include <dlfcn.h>
+
+namespace {
+
+// An IR instruction with everything it refers to resolved.
+struct XInst {
+    Op op;
+    IrType type;
+    bool foreign = false;   // of Call: imm is the address of a native function
+    Reg dst = 0;
+    Reg a = 0;
+    Reg b = 0;
+    int64_t imm = 0;        // of GlobalAddr an address, of Call the callee
+    uint32_t t = 0;         // jump targets as instruction indices
+    uint32_t f = 0;
+};
+
+struct XFunc {
+    string name;
+    vector<XInst> code;
+    vector<Reg> args;
+    Reg reg_count = 1;
+    int stack_size = 0;
+};
+
+constexpr size_t max_args = 6;
+constexpr size_t stack_bytes = 8 << 20;
+constexpr size_t stack_regs = 1 << 20;
+
+class Interpreter {
+    vector<XFunc> m_funcs;
+    vector<char> m_data;        // globals and string literals
+    // left uninitialized, so that only the pages used are touched
+    unique_ptr<char[]> m_stack{new char[stack_bytes]};
+    char* m_sp = m_stack.get() + stack_bytes;   // grows down, like the native stack
+    unique_ptr<int64_t[]> m_regs{new int64_t[stack_regs]};  // the registers of the active calls
+    size_t m_reg_top = 0;
+
+    static int64_t lookup(const string& name){
+        dlerror();
+        auto address = dlsym(RTLD_DEFAULT, name.c_str());
+        if (!address){
+            throw runtime_error("undefined symbol: " + name);
+        }
+        return reinterpret_cast<int64_t>(address);
+    }
+
+    XFunc translate(const IrFunc& func, const unordered_map<string, uint32_t>& functions, const unordered_map<string, int64_t>& data){
+        XFunc result{func.name, {}, func.args, func.reg_count, func.stack_size};
+        vector<uint32_t> starts;
+        for (auto& block : func.blocks){
+            starts.push_back(result.code.size());
+            result.code.resize(result.code.size() + block.insts.size());
+        }
+        size_t index = 0;
+        for (size_t i = 0; i < func.blocks.size(); ++i){
+            for (auto& inst : func.blocks[i].insts){
+                XInst x{inst.op, inst.type, false, inst.dst, inst.a, inst.b, inst.imm};
+                if (inst.op == Op::Jmp || inst.op == Op::Br){
+                    x.t = starts[inst.t];
+                    x.f = starts[inst.f];
+                }
+                else if (inst.op == Op::GlobalAddr){
+                    auto& name = func.symbols[inst.imm];
+                    auto it = data.find(name);
+                    x.imm = it != data.end() ? it->second : lookup(name);
+                }
+                else if (inst.op == Op::Call){
+                    if (inst.b > max_args){
+                        throw runtime_error(func.name + ": too many arguments in a call");
+                    }
+                    auto& name = func.symbols[inst.imm];
+                    if (auto it = functions.find(name); it != functions.end()){
+                        x.imm = it->second;
+                    }
+                    else {
+                        x.foreign = true;
+                        x.imm = lookup(name);
+                    }
+                }
+                result.code[index++] = x;
+            }
+        }
+        return result;
+    }
+
+    int64_t call(uint32_t index, const int64_t* args){
+        auto& func = m_funcs[index];
+        auto frame_size = static_cast<size_t>(round_up(func.stack_size, 16));
+        if (static_cast<size_t>(m_sp - m_stack.get()) < frame_size || m_reg_top + func.reg_count > stack_regs){
+            throw runtime_error("stack overflow in " + func.name);
+        }
+        auto base = m_sp;
+        m_sp -= frame_size;
+        auto regs = m_regs.get() + m_reg_top;
+        m_reg_top += func.reg_count;
+        auto result = run(func, base, regs, args);
+        m_reg_top -= func.reg_count;
+        m_sp = base;
+        return result;
+    }
+
+    static int64_t load(IrType type, const char* address){
+        int64_t value = 0;
+        memcpy(&value, address, size_of(type));
+        return extend(type, value);
+    }
+
+    // The low bytes, as the machine is little-endian.
+    static void store(IrType type, char* address, int64_t value){
+        memcpy(address, &value, size_of(type));
+    }
+
+    int64_t run(const XFunc& func, char* base, int64_t* r, const int64_t* args){
+        auto code = func.code.data();
+        size_t pc = 0;
+        while (true){
+            auto& in = code[pc++];
+            switch (in.op){
+            case Op::Imm: r[in.dst] = in.imm; break;
+            case Op::LocalAddr: r[in.dst] = reinterpret_cast<int64_t>(base - in.imm); break;
+            case Op::GlobalAddr: r[in.dst] = in.imm; break;
+            case Op::Param: r[in.dst] = args[in.imm]; break;
+            case Op::Load: r[in.dst] = load(in.type, reinterpret_cast<const char*>(r[in.a])); break;
+            case Op::Store: store(in.type, reinterpret_cast<char*>(r[in.a]), r[in.b]); break;
+            // wrapping like the machine does
+            case Op::Add: r[in.dst] = static_cast<int64_t>(static_cast<uint64_t>(r[in.a]) + r[in.b]); break;
+            case Op::Sub: r[in.dst] = static_cast<int64_t>(static_cast<uint64_t>(r[in.a]) - r[in.b]); break;
+            case Op::Mul: r[in.dst] = static_cast<int64_t>(static_cast<uint64_t>(r[in.a]) * r[in.b]); break;
+            case Op::Div:
+                if (r[in.b] == 0){
+                    throw runtime_error("division by zero in " + func.name);
+                }
+                r[in.dst] = r[in.b] == -1 ? static_cast<int64_t>(0 - static_cast<uint64_t>(r[in.a])) : r[in.a] / r[in.b];
+                break;
+            case Op::Eq: r[in.dst] = r[in.a] == r[in.b]; break;
+            case Op::Ne: r[in.dst] = r[in.a] != r[in.b]; break;
+            case Op::Lt: r[in.dst] = r[in.a] < r[in.b]; break;
+            case Op::Le: r[in.dst] = r[in.a] <= r[in.b]; break;
+            case Op::Extend: r[in.dst] = extend(in.type, r[in.a]); break;
+            case Op::Call: {
+                int64_t values[max_args] = {};
+                for (Reg i = 0; i < in.b; ++i){
+                    values[i] = r[func.args[in.a + i]];
+                }
+                if (in.foreign){
+                    // variadic, so that functions such as printf are called correctly
+                    auto native = reinterpret_cast<int64_t (*)(...)>(in.imm);
+                    r[in.dst] = native(values[0], values[1], values[2], values[3], values[4], values[5]);
+                }
+                else {
+                    r[in.dst] = call(in.imm, values);
+                }
+                break;
+            }
+            case Op::Jmp: pc = in.t; break;
+            case Op::Br: pc = r[in.a] ? in.t : in.f; break;
+            case Op::Ret: return in.a ? r[in.a] : 0;
+            }
+        }
+    }
+
+public:
+    explicit Interpreter(const IrProgram& program){
+        // the data is laid out first so that its addresses are known
+        vector<pair<const string*, size_t>> offsets;
+        size_t size = 0;
+        for (auto& [name, bytes] : program.globals){
+            offsets.emplace_back(&name, size);
+            size = round_up(size + bytes, 8);
+        }
+        for (auto& [name, bytes] : program.strings){
+            offsets.emplace_back(&name, size);
+            size = round_up(size + bytes.size(), 8);
+        }
+        m_data.resize(size);
+        for (size_t i = 0; i < program.strings.size(); ++i){
+            auto& bytes = program.strings[i].second;
+            memcpy(m_data.data() + offsets[program.globals.size() + i].second, bytes.data(), bytes.size());
+        }
+        unordered_map<string, int64_t> data;
+        for (auto& [name, offset] : offsets){
+            data.emplace(*name, reinterpret_cast<int64_t>(m_data.data() + offset));
+        }
+        unordered_map<string, uint32_t> functions;
+        for (size_t i = 0; i < program.funcs.size(); ++i){
+            functions.emplace(program.funcs[i].name, i);
+        }
+        for (auto& func : program.funcs){
+            m_funcs.push_back(translate(func, functions, data));
+        }
+    }
+
+    int64_t call_main(int argc, char** argv){
+        auto it = find_if(m_funcs.begin(), m_funcs.end(), [](auto& f){ return f.name == "main"; });
+        if (it == m_funcs.end()){
+            throw runtime_error("undefined symbol: main");
+        }
+        int64_t args[max_args] = {argc, reinterpret_cast<int64_t>(argv)};
+        return call(it - m_funcs.begin(), args);
+    }
+};
+
+}
+
+int interpret(const IrProgram& program, const vector<string>& libraries, const vector<string>& args){
+    load_libraries(libraries);
+    Interpreter interpreter(program);
+    vector<char*> argv;
+    for (auto& arg : args){
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    cout.flush();
+    cerr.flush();
+    auto status = interpreter.call_main(static_cast<int>(args.size()), argv.data());
+    fflush(stdout);
+    return static_cast<int>(status);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "common.h"
+#include "ir.h"
+
+// Runs a program without generating machine code, for programs that run
+// for less time than compiling them would take. Each function is lowered
+// to IR, run through the passes, and translated once into a flat array of
+// instructions whose registers, jump targets and callees are resolved, so
+// that executing an instruction is one switch and no lookups. Locals live
+// in frames on an interpreter stack laid out like the native one, and
+// globals and string literals in memory of their own, so pointers are
+// real addresses that foreign functions such as printf can use.
+
+// Everything the interpreter needs of a translation unit.
+struct IrProgram {
+    vector<IrFunc> funcs;
+    vector<pair<string, int>> globals;      // name and size
+    vector<pair<string, string>> strings;   // name and bytes, with the NUL
+};
+
+// Calls main with args as its argv and returns what it returns. Functions
+// not defined in the program are looked up in the process and in the
+// libraries, and called natively. Throws runtime_error on an undefined
+// symbol, a division by zero or a stack overflow.
+int interpret(const IrProgram& program, const vector<string>& libraries, const vector<string>& args);
@@ -0,0 +1,210 @@
+#include "ir.h"
+
+string_view to_string(Op op){
+    switch (op){
+    case Op::Imm: return "imm";
+    case Op::LocalAddr: return "local";
+    case Op::GlobalAddr: return "global";
+    case Op::Param: return "param";
+    case Op::Load: return "load";
+    case Op::Store: return "store";
+    case Op::Add: return "add";
+    case Op::Sub: return "sub";
+    case Op::Mul: return "mul";
+    case Op::Div: return "div";
+    case Op::Eq: return "eq";
+    case Op::Ne: return "ne";
+    case Op::Lt: return "lt";
+    case Op::Le: return "le";
+    case Op::Extend: return "extend";
+    case Op::Call: return "call";
+    case Op::Jmp: return "jmp";
+    case Op::Br: return "br";
+    case Op::Ret: return "ret";
+    }
+    return "?";
+}
+
+uint32_t IrFunc::symbol(const string& name){
+    auto [it, added] = symbol_ids.try_emplace(name, symbols.size());
+    if (added){
+        symbols.push_back(name);
+    }
+    return it->second;
+}
+
+static string_view type_name(IrType type){
+    switch (type){
+    case IrType::I8: return "i8";
+    case IrType::I16: return "i16";
+    case IrType::I32: return "i32";
+    case IrType::I64: return "i64";
+    }
+    return "?";
+}
+
+void dump(const IrFunc& func, ostream& out){
+    out << "func " << func.name << " (stack " << func.stack_size << ", regs " << func.reg_count - 1 << ")\n";
+    for (BlockId id = 0; id < func.blocks.size(); ++id){
+        out << "b" << id << ":\n";
+        for (auto& inst : func.blocks[id].insts){
+            out << "  ";
+            if (inst.dst){
+                out << "%" << inst.dst << " = ";
+            }
+            out << to_string(inst.op);
+            switch (inst.op){
+            case Op::Imm:
+            case Op::LocalAddr:
+            case Op::Param:
+                out << " " << inst.imm;
+                break;
+            case Op::GlobalAddr:
+                out << " @" << func.symbols[inst.imm];
+                break;
+            case Op::Load:
+            case Op::Extend:
+                out << "." << type_name(inst.type) << " %" << inst.a;
+                break;
+            case Op::Store:
+                out << "." << type_name(inst.type) << " %" << inst.a << ", %" << inst.b;
+                break;
+            case Op::Div:
+                if (inst.type != IrType::I64){
+                    out << "." << type_name(inst.type);
+                }
+                out << " %" << inst.a << ", %" << inst.b;
+                break;
+            case Op::Call:
+                out << " @" << func.symbols[inst.imm] << "(";
+                for (Reg i = 0; i < inst.b; ++i){
+                    out << (i ? ", %" : "%") << func.args[inst.a + i];
+                }
+                out << ")";
+                break;
+            case Op::Jmp:
+                out << " b" << inst.t;
+                break;
+            case Op::Br:
+                out << " %" << inst.a << ", b" << inst.t << ", b" << inst.f;
+                break;
+            case Op::Ret:
+                if (inst.a){
+                    out << " %" << inst.a;
+                }
+                break;
+            default:
+                out << " %" << inst.a << ", %" << inst.b;
+                break;
+            }
+            out << '\n';
+        }
+    }
+}
+
+bool verify(const IrFunc& func, string* error){
+    auto fail = [&](const string& message){
+        if (error){
+            *error = func.name + ": " + message;
+        }
+        return false;
+    };
+    if (func.blocks.empty()){
+        return fail("function has no blocks");
+    }
+    // every register is defined once
+    vector<bool> defined(func.reg_count);
+    for (auto& block : func.blocks){
+        for (auto& inst : block.insts){
+            if (!inst.dst){
+                continue;
+            }
+            if (inst.dst >= func.reg_count){
+                return fail("%" + std::to_string(inst.dst) + " is out of range");
+            }
+            if (defined[inst.dst]){
+                return fail("%" + std::to_string(inst.dst) + " is defined twice");
+            }
+            defined[inst.dst] = true;
+        }
+    }
+    // within a block a register is used only after its definition
+    vector<BlockId> defined_in(func.reg_count, ~0u);
+    vector<size_t> defined_at(func.reg_count);
+    for (BlockId id = 0; id < func.blocks.size(); ++id){
+        auto& insts = func.blocks[id].insts;
+        for (size_t i = 0; i < insts.size(); ++i){
+            if (insts[i].dst){
+                defined_in[insts[i].dst] = id;
+                defined_at[insts[i].dst] = i;
+            }
+        }
+    }
+    auto block_name = [](BlockId id){ return "b" + std::to_string(id); };
+    for (BlockId id = 0; id < func.blocks.size(); ++id){
+        auto& insts = func.blocks[id].insts;
+        if (insts.empty() || !is_terminator(insts.back().op)){
+            return fail(block_name(id) + " does not end with a terminator");
+        }
+        for (size_t i = 0; i < insts.size(); ++i){
+            auto& inst = insts[i];
+            if (is_terminator(inst.op) && i + 1 != insts.size()){
+                return fail(block_name(id) + " has a terminator in the middle");
+            }
+            auto check_use = [&](Reg reg) -> bool {
+                if (reg >= func.reg_count || !defined[reg]){
+                    return fail(block_name(id) + " uses undefined %" + std::to_string(reg));
+                }
+                if (defined_in[reg] == id && defined_at[reg] >= i){
+                    return fail(block_name(id) + " uses %" + std::to_string(reg) + " before its definition");
+                }
+                return true;
+            };
+            bool ok = true;
+            switch (inst.op){
+            case Op::Imm:
+            case Op::LocalAddr:
+            case Op::Param:
+            case Op::Jmp:
+                break;
+            case Op::GlobalAddr:
+                if (inst.imm < 0 || inst.imm >= ssize(func.symbols)){
+                    return fail(block_name(id) + " refers to an unknown symbol");
+                }
+                break;
+            case Op::Load:
+            case Op::Extend:
+            case Op::Br:
+                ok = check_use(inst.a);
+                break;
+            case Op::Ret:
+                ok = !inst.a || check_use(inst.a);
+                break;
+            case Op::Call:
+                if (inst.imm < 0 || inst.imm >= ssize(func.symbols) || inst.a + inst.b > func.args.size()){
+                    return fail(block_name(id) + " has a malformed call");
+                }
+                for (Reg k = 0; ok && k < inst.b; ++k){
+                    ok = check_use(func.args[inst.a + k]);
+                }
+                break;
+            default:
+                ok = check_use(inst.a) && check_use(inst.b);
+                break;
+            }
+            if (!ok){
+                return false;
+            }
+            if (inst.op == Op::Jmp || inst.op == Op::Br){
+                if (inst.t >= func.blocks.size() || (inst.op == Op::Br && inst.f >= func.blocks.size())){
+                    return fail(block_name(id) + " branches to a missing block");
+                }
+            }
+            bool has_dst = inst.op != Op::Store && !is_terminator(inst.op);
+            if (has_dst != (inst.dst != 0)){
+                return fail(block_name(id) + ": " + string(to_string(inst.op)) + (has_dst ? " needs" : " must not have") + " a destination");
+            }
+        }
+    }
+    return true;
+}
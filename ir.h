@@ -0,0 +1,133 @@
+#pragma once
+#include "common.h"
+
+// Three-address intermediate representation of one function.
+//
+// Values live in virtual registers, each of which is assigned by exactly
+// one instruction, so temporaries are in SSA form. Local variables stay in
+// stack slots and are reached through LocalAddr, Load and Store, which is
+// why no phi instructions are needed. A function is a list of basic
+// blocks, each ending in exactly one terminator (Jmp, Br or Ret); block 0
+// is the entry.
+
+// Virtual register. 0 means "no register".
+using Reg = uint32_t;
+using BlockId = uint32_t;
+
+// Width of a memory access or an extension. Registers always hold 64-bit
+// values; narrower loads sign extend and narrower stores truncate.
+enum class IrType : uint8_t { I8, I16, I32, I64 };
+
+inline int size_of(IrType type){
+    return 1 << static_cast<int>(type);
+}
+
+// The low bytes of value of the width of type, sign extended.
+inline int64_t extend(IrType type, int64_t value){
+    switch (type){
+    case IrType::I8: return static_cast<int8_t>(value);
+    case IrType::I16: return static_cast<int16_t>(value);
+    case IrType::I32: return static_cast<int32_t>(value);
+    case IrType::I64: break;
+    }
+    return value;
+}
+
+enum class Op : uint8_t {
+    Imm,        // dst = imm
+    LocalAddr,  // dst = address of the stack slot imm bytes below the frame base
+    GlobalAddr, // dst = address of symbols[imm]
+    Param,      // dst = argument number imm of the function
+    Load,       // dst = *(type*)a
+    Store,      // *(type*)a = b
+    Add,        // dst = a + b
+    Sub,        // dst = a - b
+    Mul,        // dst = a * b
+    Div,        // dst = a / b, with type I32 of operands that fit in 32 bits
+    Eq,         // dst = a == b
+    Ne,         // dst = a != b
+    Lt,         // dst = a < b
+    Le,         // dst = a <= b
+    Extend,     // dst = (type)a, the low bytes of a sign extended
+    Call,       // dst = symbols[imm](args[a], ..., args[a + b - 1])
+    Jmp,        // goto t
+    Br,         // if (a) goto t; else goto f
+    Ret,        // return a
+};
+
+string_view to_string(Op op);
+
+inline bool is_terminator(Op op){
+    return op == Op::Jmp || op == Op::Br || op == Op::Ret;
+}
+
+inline bool is_binary(Op op){
+    return Op::Add <= op && op <= Op::Le;
+}
+
+struct Inst {
+    Op op;
+    IrType type = IrType::I64;
+    Reg dst = 0;
+    Reg a = 0;
+    Reg b = 0;
+    int64_t imm = 0;
+    BlockId t = 0;
+    BlockId f = 0;
+};
+
+struct Block {
+    vector<Inst> insts;
+};
+
+struct IrFunc {
+    string name;
+    vector<Block> blocks;
+    vector<Reg> args;        // call arguments, referred to by Call
+    vector<string> symbols;  // global names, referred to by GlobalAddr and Call
+    unordered_map<string, uint32_t> symbol_ids; // the index of each name in symbols
+    Reg reg_count = 1;       // registers are numbered from 1
+    int stack_size = 0;      // bytes of local variables below the frame base
+
+    Reg new_reg() { return reg_count++; }
+    uint32_t symbol(const string& name);
+};
+
+// Calls f with a reference to every register read by inst.
+template <class Func, class In, class F>
+void for_each_use(Func& func, In& inst, F&& f){
+    switch (inst.op){
+    case Op::Imm:
+    case Op::LocalAddr:
+    case Op::GlobalAddr:
+    case Op::Param:
+    case Op::Jmp:
+        break;
+    case Op::Load:
+    case Op::Extend:
+    case Op::Br:
+        f(inst.a);
+        break;
+    case Op::Ret:
+        if (inst.a){
+            f(inst.a);
+        }
+        break;
+    case Op::Call:
+        for (Reg i = 0; i < inst.b; ++i){
+            f(func.args[inst.a + i]);
+        }
+        break;
+    default:
+        f(inst.a);
+        f(inst.b);
+        break;
+    }
+}
+
+// Writes a human readable listing of the function.
+void dump(const IrFunc& func, ostream& out);
+
+// Checks the structural invariants above and reports the first violation
+// as "<function>: <message>". Returns true when the function is valid.
+bool verify(const IrFunc& func, string* error = nullptr);
@@ -0,0 +1,146 @@
+#include "jit.h"
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+// A mapping of the code, the jump stubs and the data; the code and stubs
+// are made executable and no longer writable once relocated.
+class JitMemory {
+    static constexpr size_t stub_size = 16;
+
+    char* m_base = nullptr;
+    size_t m_size = 0;
+    size_t m_code_size = 0;     // text and stubs, rounded up to pages
+    size_t m_rodata_offset = 0;
+    size_t m_bss_offset = 0;
+    size_t m_stubs_offset = 0;
+    unordered_map<string, uint64_t> m_symbols;
+    unordered_map<string, uint64_t> m_stubs;
+
+    static size_t page_round(size_t n){
+        static const size_t page = sysconf(_SC_PAGESIZE);
+        return (n + page - 1) / page * page;
+    }
+
+    uint64_t section_base(ObjectImage::Section section) const {
+        auto base = reinterpret_cast<uint64_t>(m_base);
+        switch (section){
+        case ObjectImage::Text: return base;
+        case ObjectImage::Rodata: return base + m_rodata_offset;
+        case ObjectImage::Bss: return base + m_bss_offset;
+        case ObjectImage::Undefined: break;
+        }
+        return 0;
+    }
+
+    static uint64_t lookup(const string& name){
+        dlerror();
+        auto address = dlsym(RTLD_DEFAULT, name.c_str());
+        if (!address){
+            throw runtime_error("undefined symbol: " + name);
+        }
+        return reinterpret_cast<uint64_t>(address);
+    }
+
+    // jmp *0(%rip) followed by the address
+    uint64_t stub(const string& name){
+        if (auto it = m_stubs.find(name); it != m_stubs.end()){
+            return it->second;
+        }
+        auto address = lookup(name);
+        auto at = m_base + m_stubs_offset + m_stubs.size() * stub_size;
+        const uint8_t jump[] = {0xff, 0x25, 0, 0, 0, 0};
+        memcpy(at, jump, sizeof(jump));
+        memcpy(at + sizeof(jump), &address, sizeof(address));
+        return m_stubs[name] = reinterpret_cast<uint64_t>(at);
+    }
+
+public:
+    explicit JitMemory(const ObjectImage& image){
+        // every relocation to an undefined symbol may need a stub
+        m_stubs_offset = round_up(image.text.size(), stub_size);
+        m_code_size = page_round(m_stubs_offset + image.relocs.size() * stub_size);
+        m_rodata_offset = m_code_size;
+        m_bss_offset = round_up(m_rodata_offset + image.rodata.size(), ObjectImage::bss_align);
+        m_size = page_round(m_bss_offset + image.bss);
+        auto map = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED){
+            throw runtime_error("cannot map memory for the program: "s + strerror(errno));
+        }
+        m_base = static_cast<char*>(map);
+        memcpy(m_base, image.text.data(), image.text.size());
+        memcpy(m_base + m_rodata_offset, image.rodata.data(), image.rodata.size());
+        for (auto* symbols : {&image.locals, &image.globals}){
+            for (auto& symbol : *symbols){
+                m_symbols.emplace(symbol.name, section_base(symbol.section) + symbol.value);
+            }
+        }
+    }
+    JitMemory(const JitMemory&) = delete;
+    ~JitMemory(){
+        munmap(m_base, m_size);
+    }
+
+    void relocate(const ObjectImage& image){
+        for (auto& reloc : image.relocs){
+            uint64_t target;
+            if (auto it = m_symbols.find(reloc.symbol); it != m_symbols.end()){
+                target = it->second;
+            }
+            else if (reloc.call){
+                target = stub(reloc.symbol);
+            }
+            else {
+                target = lookup(reloc.symbol);
+            }
+            auto field = m_base + reloc.offset;
+            auto value = static_cast<int64_t>(target + reloc.addend - reinterpret_cast<uint64_t>(field));
+            if (value != static_cast<int32_t>(value)){
+                throw runtime_error("symbol out of reach of the code: " + reloc.symbol);
+            }
+            auto value32 = static_cast<int32_t>(value);
+            memcpy(field, &value32, sizeof(value32));
+        }
+        if (mprotect(m_base, m_code_size, PROT_READ | PROT_EXEC) != 0){
+            throw runtime_error("cannot make the program executable: "s + strerror(errno));
+        }
+    }
+
+    void* function(const string& name) const {
+        auto it = m_symbols.find(name);
+        if (it == m_symbols.end()){
+            throw runtime_error("undefined symbol: " + name);
+        }
+        return reinterpret_cast<void*>(it->second);
+    }
+};
+
+}
+
+void load_libraries(const vector<string>& libraries){
+    for (auto& library : libraries){
+        if (!dlopen(library.c_str(), RTLD_NOW | RTLD_GLOBAL)){
+            throw runtime_error("cannot load " + library + ": " + dlerror());
+        }
+    }
+}
+
+int run_image(const ObjectImage& image, const vector<string>& libraries, const vector<string>& args){
+    load_libraries(libraries);
+    JitMemory memory(image);
+    memory.relocate(image);
+    vector<char*> argv;
+    for (auto& arg : args){
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    auto main = reinterpret_cast<int (*)(int, char**)>(memory.function("main"));
+    // the program writes through stdio after and alongside the compiler
+    cout.flush();
+    cerr.flush();
+    auto status = main(static_cast<int>(args.size()), argv.data());
+    fflush(stdout);
+    return status;
+}
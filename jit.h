@@ -0,0 +1,18 @@
+#pragma once
+#include "common.h"
+#include "object.h"
+
+// Runs a compiled program in the compiling process. The code is copied
+// into executable memory with the string literals and globals after it,
+// in reach of its pc-relative references. Other symbols are looked up in
+// the process, libc included, and in the libraries loaded first; calls
+// reach them through a jump stub next to the code.
+
+// Makes the symbols of the libraries visible to the lookups of the
+// process. Throws runtime_error when a library cannot be loaded.
+void load_libraries(const vector<string>& libraries);
+
+// Loads libraries, then the image, and returns what main returns, called
+// with args as its argv. Throws runtime_error when a library cannot be
+// loaded or a symbol is not found.
+int run_image(const ObjectImage& image, const vector<string>& libraries, const vector<string>& args);
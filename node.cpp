@@ -1,58 +1,187 @@
 #include "node.h"
+#include "stats.h"
 
-Type NodeAddress::get_type() const {
-    return to_ptr(var->get_type());
+BinOp binop_of(Punct punct){
+    switch (punct){
+    case Punct::Plus: return BinOp::Add;
+    case Punct::Minus: return BinOp::Sub;
+    case Punct::Star: return BinOp::Mul;
+    case Punct::Slash: return BinOp::Div;
+    case Punct::Eq: return BinOp::Eq;
+    case Punct::Ne: return BinOp::Ne;
+    case Punct::Lt: return BinOp::Lt;
+    case Punct::Le: return BinOp::Le;
+    case Punct::Gt: return BinOp::Gt;
+    case Punct::Ge: return BinOp::Ge;
+    default: return BinOp::None;
+    }
+}
+
+Ast::Ast(const TokenStream& tokens): m_source(tokens.source()), m_names(tokens.names()){
+    m_nodes.push_back(Node{0, NodeKind::Null});
+    m_vars.push_back(Var{});
+    m_types.emplace_back(TypeInt{});
+    m_types.emplace_back(TypeInt{});
+    m_types.emplace_back(TypeChar{});
+    m_types.emplace_back(TypeInt{2});
+    m_types.emplace_back(TypeInt{8});
+}
+
+void Ast::shrink_to_fit(){
+    m_nodes.shrink_to_fit();
+    m_lists.shrink_to_fit();
+    m_vars.shrink_to_fit();
+}
+
+void Ast::count_stats() const{
+    stats().add(Counter::Nodes, m_nodes.size() - 1);
+    stats().add(Counter::VarImports, m_imports);
+    stats().add(Counter::Types, m_types.size() - builtin_types);
+}
+
+NodeId Ast::add(Node node){
+    m_nodes.push_back(node);
+    return m_nodes.size() - 1;
+}
+
+uint32_t Ast::add_list(const vector<NodeId>& ids){
+    auto start = m_lists.size();
+    m_lists.insert(m_lists.end(), ids.begin(), ids.end());
+    return start;
+}
+
+TypeId Ast::add_type(Type type){
+    if (auto p = from_box<TypeInt>(type)){
+        return p->m_size == 2 ? short_type : p->m_size == 8 ? long_type : int_type;
+    }
+    if (is_type_of<TypeChar>(type)){
+        return char_type;
+    }
+    m_types.push_back(move(type));
+    return m_types.size() - 1;
+}
+
+VarId Ast::import_var(const Ast& from, VarId var){
+    ++m_imports;
+    auto& v = from.var(var);
+    return add_var(v.loc, v.name, add_type(from.type(v.type)), v.is_global);
+}
+
+TypeId Ast::pointer_to(TypeId base){
+    auto [it, inserted] = m_ptr_types.try_emplace(base, 0);
+    if (inserted){
+        it->second = add_type(to_ptr(m_types[base]));
+    }
+    return it->second;
 }
 
-Type NodeDeref::get_type() const{
-    auto type = var->get_type();
-    assert_at(is_pointer_like(type), token, "non pointer type cannot be dereferenced");
-    return deref(move(type));
+TypeId Ast::base_of(TypeId type, SourceLoc loc){
+    assert_at(is_pointer_like(m_types[type]), loc, "non pointer type cannot be dereferenced");
+    auto [it, inserted] = m_base_types.try_emplace(type, 0);
+    if (inserted){
+        it->second = add_type(::deref(m_types[type]));
+    }
+    return it->second;
+}
+
+VarId Ast::add_var(SourceLoc loc, string name, TypeId type, bool is_global){
+    m_vars.push_back(Var{move(name), loc, type, -1, is_global});
+    return m_vars.size() - 1;
+}
+
+NodeId Ast::null(SourceLoc loc){
+    return add({loc, NodeKind::Null, BinOp::None});
+}
+
+NodeId Ast::num(SourceLoc loc, int64_t val){
+    auto type = val == static_cast<int>(val) ? int_type : long_type;
+    auto bits = static_cast<uint64_t>(val);
+    return add({loc, NodeKind::Num, BinOp::None, type, static_cast<uint32_t>(bits), static_cast<uint32_t>(bits >> 32)});
+}
+
+NodeId Ast::var_ref(SourceLoc loc, VarId var){
+    return add({loc, NodeKind::Var, BinOp::None, m_vars[var].type, var});
+}
+
+NodeId Ast::stmt_expr(SourceLoc loc, NodeId block){
+    auto& node = m_nodes[block];
+    assert_at(node.b > 0, loc, "expression statement should not be empty");
+    auto last = m_lists[node.a + node.b - 1];
+    auto type = m_nodes[last].type;
+    assert_at(type != 0, loc, "the last expression in expression statement should be typed");
+    return add({loc, NodeKind::StmtExpr, BinOp::None, type, block});
+}
+
+NodeId Ast::call(SourceLoc loc, uint32_t name_id, const vector<NodeId>& args, TypeId type){
+    return add({loc, NodeKind::Call, BinOp::None, type, name_id, add_list(args), static_cast<uint32_t>(args.size())});
+}
+
+NodeId Ast::address(SourceLoc loc, NodeId operand){
+    return add({loc, NodeKind::Address, BinOp::None, pointer_to(m_nodes[operand].type), operand});
 }
 
-Type NodePunct::get_type() const{
-    auto&& l = lhs->get_type();
-    auto&& r = rhs->get_type();
+NodeId Ast::deref(SourceLoc loc, NodeId operand){
+    return add({loc, NodeKind::Deref, BinOp::None, base_of(m_nodes[operand].type, loc), operand});
+}
+
+NodeId Ast::binary(SourceLoc loc, BinOp op, NodeId lhs, NodeId rhs){
+    auto lt = m_nodes[lhs].type;
+    auto rt = m_nodes[rhs].type;
+    const auto& l = m_types[lt];
+    const auto& r = m_types[rt];
     auto l_is_ptr = is_pointer_like(l);
     auto r_is_ptr = is_pointer_like(r);
     auto l_is_int = is_number(l);
     auto r_is_int = is_number(r);
 
+    TypeId type = 0;
     if(l_is_ptr && r_is_ptr){
-        assert_at(l == r, token, "diffrent types passed to operator");
-        return TypeInt{};
+        assert_at(l == r, loc, "diffrent types passed to operator");
+        type = long_type;
     }
     else if (l_is_ptr && r_is_int){
-        return l;
+        type = lt;
     }
     else if (l_is_int && r_is_ptr){
-        return r;
+        type = rt;
     }
     else if (l_is_int && r_is_int){
-        return l;
+        // the usual arithmetic conversions: char and short are promoted to int
+        type = is_long(l) || is_long(r) ? long_type : int_type;
+    }
+    assert_at(type != 0, loc, "unsupported operator");
+    // comparisons are int whatever their operands
+    if (op >= BinOp::Eq){
+        type = int_type;
     }
-    assert_at(false, token, "unsupported operator");
-    abort();
+    return add({loc, NodeKind::Binary, op, type, lhs, rhs});
 }
 
+NodeId Ast::assign(SourceLoc loc, NodeId lhs, NodeId rhs){
+    // check that both sides of the assignment are compatible
+    const auto& tl = m_types[m_nodes[lhs].type];
+    const auto& tr = m_types[m_nodes[rhs].type];
+    auto compatible = tl == tr || (is_number(tl) && is_number(tr)) || (is_pointer_like(tl) && is_pointer_like(tr));
+    assert_at(compatible, loc, "diffrent types for left and right hand side of assignment");
+    return add({loc, NodeKind::Assign, BinOp::None, m_nodes[lhs].type, lhs, rhs});
+}
 
-Type NodeAssign::get_type() const{
-    // check type of both side of assignement or complement of the type of left hand side
-    auto tl = lhs->get_type();
-    auto tr = rhs->get_type();
-    assert_at(tl==tr, token, "diffrent types for left and right hand side of assignment");
-    return tl;
+NodeId Ast::ret(SourceLoc loc, NodeId expr){
+    return add({loc, NodeKind::Ret, BinOp::None, m_nodes[expr].type, expr});
 }
 
-Type NodeRet::get_type() const{
-    return pNode->get_type();
+NodeId Ast::block(SourceLoc loc, const vector<NodeId>& statements){
+    return add({loc, NodeKind::Block, BinOp::None, 0, add_list(statements), static_cast<uint32_t>(statements.size())});
 }
 
-Type NodeVar::get_type() const{
-    return m_type;
+NodeId Ast::if_(SourceLoc loc, NodeId cond, NodeId then, NodeId else_){
+    return add({loc, NodeKind::If, BinOp::None, 0, cond, then, else_});
 }
 
-Type NodeFunc::get_type() const{
-    return TypeInt{};
+NodeId Ast::for_(SourceLoc loc, NodeId init, NodeId cond, NodeId inc, NodeId body){
+    return add({loc, NodeKind::For, BinOp::None, 0, init, cond, inc, body});
 }
 
+NodeId Ast::init(SourceLoc loc, VarId var, NodeId expr){
+    return add({loc, NodeKind::Init, BinOp::None, m_vars[var].type, var, expr});
+}
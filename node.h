@@ -3,253 +3,151 @@
 #include "common.h"
 #include "type.h"
 #include "tokenizer.h"
-
-using PNodeVar = shared_ptr<struct NodeVar>;
-
-struct INode{
-    virtual optional<Token> get_token() const {return nullopt; };
-    virtual void generate() = 0;
-    virtual void generate_address() const { 
-        auto token = get_token();
-        verror_at(token, "Left hand side of assignment should be identifier"); 
-    }
-    virtual optional<int> get_offset() const { return nullopt; }
-    virtual optional<bool> is_global() const { return nullopt; }
-    virtual string ass_stack_reg() const { throw; }
-    virtual ~INode() = default;
-    virtual void assign_stack_offset() const {}
-};
-
-using PINode = shared_ptr<INode>;
-
-struct ITyped: virtual INode {
-    virtual Type get_type() const = 0;
-    virtual ~ITyped() = default;
-};
-
-using PITyped = shared_ptr<ITyped>;
-
-void generate_main(const PINode& node);
-
-struct NodeNull: virtual INode{
-    Token token;
-    NodeNull(Token token) : token(token) {}
-    optional<Token> get_token() const override { return token; }
-    void generate() override {};
-};
-
-struct NodeNum: ITyped{
-    Token token;
-    int num;
-
-    NodeNum(int num): num(num){}
-    NodeNum(const Token& token): token(token), num(token.val){}
-
-    Type get_type() const override {return TypeInt{}; }
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-};
-
-struct NodeVar: ITyped{
-    Token token;
+#include "ir.h"
+#include "passes.h"
+
+// Handles into the per-translation-unit arena. 0 is reserved for "absent".
+using NodeId = uint32_t;
+using VarId = uint32_t;
+using TypeId = uint32_t;
+
+// Operand layout of Node for each kind.
+enum class NodeKind : uint8_t {
+    Null,       // empty statement
+    Num,        // a: low 32 bits of the value, b: high 32 bits
+    Var,        // a: VarId
+    StmtExpr,   // a: Block (GNU statement expression)
+    Call,       // a: interned name, b: first argument in lists, c: argument count
+    Address,    // a: operand
+    Deref,      // a: operand
+    Binary,     // op, a: lhs, b: rhs
+    Assign,     // a: lhs, b: rhs
+    Ret,        // a: expr
+    Block,      // a: first statement in lists, b: statement count
+    If,         // a: condition, b: then, c: else (optional)
+    For,        // a: init, b: condition, c: increment, d: body
+    Init,       // a: VarId, b: initial value (optional)
+};
+
+enum class BinOp : uint8_t { None, Add, Sub, Mul, Div, Eq, Ne, Lt, Le, Gt, Ge };
+
+BinOp binop_of(Punct punct);
+
+struct Node {
+    SourceLoc loc;      // source offset of the token the node was parsed from
+    NodeKind kind;
+    BinOp op = BinOp::None;
+    TypeId type = 0;    // 0 for statements
+    uint32_t a = 0, b = 0, c = 0, d = 0;
+};
+
+struct Var {
     string name;
+    SourceLoc loc;
+    TypeId type;
     int offset = -1;
-    Type m_type;
-    bool m_is_global;
-    PNodeVar m_base = nullptr;
-    NodeVar(Token token, Type type, string name, bool is_global = false, PNodeVar base = nullptr)
-        : token(move(token)), name(name), m_type(move(type)), m_is_global(is_global), m_base(base){}
-    NodeVar(const Token& token, Type type, bool is_global = false, PNodeVar base = nullptr)
-        : NodeVar(token, move(type), token.ident, is_global, base) {}
-    optional<int> get_offset() const override { return offset; }
-    optional<bool> is_global() const override { return m_is_global; }
-    string ass_stack_reg() const override;
-    Type get_type() const override;
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-    void generate_address() const override;
-    // void assign_stack_offset(int offset) const override {
-    // }
-};
-
-// GNU extension
-struct NodeExpressVar: ITyped{
-    Token m_token;
-    string name;
-    int offset;
-    unique_ptr<struct NodeCompoundStatement> m_statement;
-    reference_wrapper<ITyped> m_typed;
-    ITyped& get_last_expr();
-    NodeExpressVar(Token token, decltype(m_statement) statement)
-        : m_token(move(token)), m_statement(move(statement)), m_typed(get_last_expr()){}
-    Type get_type() const override { return m_typed.get().get_type();};
-    optional<Token> get_token() const override { return m_token; }
-    void generate() override;
-};
-
-struct NodeFunc: ITyped{
-    Token token;
-    string name;
-    vector<PITyped> m_nodes;
-    
-    NodeFunc(const Token& token, vector<PITyped> m_nodes)
-        : token(token), name(token.ident), m_nodes(move(m_nodes)){}
-    Type get_type() const override;
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-};
-
-struct NodeAddress: ITyped{
-    Token token;
-    PITyped var;
-    NodeAddress(Token token, PITyped var): token(token), var(move(var)){}
-
-    Type get_type() const override;
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-};
-
-struct NodeDeref: ITyped{
-    Token token;
-    PITyped var;
-
-    NodeDeref(Token token, PITyped var)
-        : token(token), var(move(var)){}
-    string ass_stack_reg() const override { return var->ass_stack_reg(); };
-    optional<int> get_offset() const override { return var->get_offset(); }
-    optional<bool> is_global() const override { return var->is_global(); }
-    Type get_type() const override;
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-    void generate_address() const override;
-};
-
-struct NodePunct: ITyped{
-    Token token;
-    PITyped lhs, rhs;
-
-    NodePunct(const Token& token, PITyped lhs, PITyped rhs)
-        : token(token), lhs(move(lhs)), rhs(move(rhs)){}
-
-    Type get_type() const override;
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-    void ass_adjust_address_mul();
-    void ass_adjust_address_div();
-};
-
-struct NodeAssign: ITyped{
-    Token token;
-    PITyped lhs, rhs;
-
-    NodeAssign(Token token, PITyped lhs, PITyped rhs)
-        : token(token), lhs(move(lhs)), rhs(move(rhs)){}
-    Type get_type() const override;
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-};
-
-struct NodeRet: ITyped{
-    Token token;
-    PITyped pNode;
-    string m_func_name;
-
-    NodeRet(Token token, PITyped pNode, string func_name): token(token), pNode(move(pNode)), m_func_name(func_name){}
-    Type get_type() const override;
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-};
-
-struct NodeCompoundStatement: INode{
-    Token token;
-    vector<PINode> pNodes;
-
-    NodeCompoundStatement(Token token, vector<PINode> pNodes)
-        : token(token), pNodes(move(pNodes)){}
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-};
-
-
-struct NodeIf: INode{
-    Token token;
-    PINode expr;
-    PINode statement_if;
-    PINode statement_else;
-    int count;
-private:
-    static inline int curr_count = 1;
+    bool is_global;
+};
+
+// Arena holding every node, variable and type of a translation unit.
+// Nodes refer to each other through 32-bit handles and the whole tree is
+// released at once with the arena.
+class Ast {
+    const Source& m_source;
+    const Interner& m_names;
+    vector<Node> m_nodes;
+    vector<NodeId> m_lists;
+    vector<Var> m_vars;
+    deque<Type> m_types;
+    map<TypeId, TypeId> m_ptr_types;
+    map<TypeId, TypeId> m_base_types;
+    uint32_t m_imports = 0;
+
+    NodeId add(Node node);
+    uint32_t add_list(const vector<NodeId>& ids);
 public:
-    NodeIf(Token token, PINode expr, PINode statement_if, PINode statement_else)
-        : token(token), expr(move(expr)), statement_if(move(statement_if)), statement_else(move(statement_else)), count(curr_count++)
-    {}
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-};
-
-struct NodeFor: INode{
-    Token token;
-    PINode expr_init;
-    PINode expr_condition;
-    PINode expr_increment;
-    PINode statement;
-    int count;
-private:
-    static inline int curr_count = 1;
-public:
-    NodeFor(Token token, PINode expr_init, PINode expr_condition, PINode expr_increment, PINode statement)
-        : token(token), expr_init(move(expr_init)), expr_condition(move(expr_condition)), expr_increment(move(expr_increment)), 
-          statement(move(statement)), count(curr_count++)
-    {}
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-};
-
-struct NodeInitializer: ITyped {
-    Token token;
-    PITyped var;
-    PINode expr;
-    Type type;
-
-    NodeInitializer(Token token, PITyped var, PINode expr, Type type)
-        : token(token), var(move(var)), expr(move(expr)), type(type){}
-
-    string ass_stack_reg() const override { return var->ass_stack_reg(); };
-    Type get_type() const override { return type; }
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-};
-
-struct NodeDeclaration: INode {
-    Token token;
-    vector<PINode> pNodes;
-
-    NodeDeclaration(Token token, vector<PINode> pNodes): token(token), pNodes(move(pNodes)){}
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
-};
+    static constexpr TypeId int_type = 1;
+    static constexpr TypeId char_type = 2;
+    static constexpr TypeId short_type = 3;
+    static constexpr TypeId long_type = 4;
+    static constexpr TypeId builtin_types = 5;    // including the unused type 0
+
+    explicit Ast(const TokenStream& tokens);
+
+    const Node& operator[](NodeId id) const { return m_nodes[id]; }
+    const Type& type(TypeId id) const { return m_types[id]; }
+    const Type& type_of(NodeId id) const { return m_types[m_nodes[id].type]; }
+    span<const NodeId> list(uint32_t start, uint32_t count) const { return {m_lists.data() + start, count}; }
+    Var& var(VarId id) { return m_vars[id]; }
+    const Var& var(VarId id) const { return m_vars[id]; }
+    const string& name(uint32_t id) const { return m_names.name(id); }
+    size_t node_count() const { return m_nodes.size(); }
+    size_t var_count() const { return m_vars.size(); }
+    size_t type_count() const { return m_types.size(); }
+    size_t import_count() const { return m_imports; }
+    // Adds the sizes of the arena to the statistics.
+    void count_stats() const;
+    // Releases spare capacity once nothing more will be added.
+    void shrink_to_fit();
+
+    [[noreturn]] void error_at(NodeId id, string_view fmt) const { m_source.error_at(m_nodes[id].loc, fmt); }
+    void assert_at(bool check, SourceLoc loc, string_view fmt) const {
+        if (!check){
+            m_source.error_at(loc, fmt);
+        }
+    }
 
-struct NodeFuncDef: INode{
-    Token token;
+    TypeId add_type(Type type);
+    VarId import_var(const Ast& from, VarId var);
+    TypeId pointer_to(TypeId base);
+    TypeId base_of(TypeId type, SourceLoc loc);
+    VarId add_var(SourceLoc loc, string name, TypeId type, bool is_global);
+
+    NodeId null(SourceLoc loc);
+    // An int, or a long when val does not fit in an int.
+    NodeId num(SourceLoc loc, int64_t val);
+    NodeId var_ref(SourceLoc loc, VarId var);
+    NodeId stmt_expr(SourceLoc loc, NodeId block);
+    // type is of the result, int when the function is not declared before.
+    NodeId call(SourceLoc loc, uint32_t name_id, const vector<NodeId>& args, TypeId type = int_type);
+    NodeId address(SourceLoc loc, NodeId operand);
+    NodeId deref(SourceLoc loc, NodeId operand);
+    NodeId binary(SourceLoc loc, BinOp op, NodeId lhs, NodeId rhs);
+    NodeId assign(SourceLoc loc, NodeId lhs, NodeId rhs);
+    NodeId ret(SourceLoc loc, NodeId expr);
+    NodeId block(SourceLoc loc, const vector<NodeId>& statements);
+    NodeId if_(SourceLoc loc, NodeId cond, NodeId then, NodeId else_);
+    NodeId for_(SourceLoc loc, NodeId init, NodeId cond, NodeId inc, NodeId body);
+    NodeId init(SourceLoc loc, VarId var, NodeId expr);
+};
+
+// Each function owns the arena of its body and its string literals, so
+// that bodies can be built and released independently. Globals it refers
+// to are imported into that arena.
+struct NodeFuncDef{
+    unique_ptr<Ast> ast;
+    SourceLoc loc;
     string m_name;
-    PINode m_statement;
-    Type m_type;
-    vector<PNodeVar> m_param;
+    TypeId m_type;
+    vector<VarId> m_param;
+    NodeId m_statement;
     int m_stack_size = 0;
-    
-    NodeFuncDef(const Token& token, string name, PINode statement, Type m_type, decltype(m_param) param, int stack_size)
-        : token(token), m_name(move(name)), m_statement(move(statement)), m_type(m_type), 
-        m_param(move(param)), m_stack_size(stack_size){}
-    optional<Token> get_token() const override { return token; }
-    void generate() override;
+    vector<pair<VarId, string>> m_string_literals;
 };
 
-struct NodeProgram: INode {
-    vector<PINode> pNodes;
-    map<string, shared_ptr<const string>> m_string_literals;
+struct NodeProgram {
+    Ast ast;
+    vector<VarId> m_globals;
+
+    explicit NodeProgram(const TokenStream& tokens): ast(tokens){}
+};
 
-    NodeProgram(vector<PINode> pNodes, decltype(m_string_literals) m_string_literals)
-        : pNodes(move(pNodes)), m_string_literals(move(m_string_literals)){}
-    void generate() override;
+struct CodegenOptions {
+    const PassPipeline* passes = nullptr;  // run on the IR of every function
+    bool dump_ir = false;                  // list the IR instead of assembly
+    bool object = false;                   // write the records of object.h instead of assembly
 };
 
+IrFunc lower_func(const NodeFuncDef& func);
+void generate_func(const NodeFuncDef& func, ostream& out, const CodegenOptions& options = {});
+void generate_data(const NodeProgram& program, ostream& out, const CodegenOptions& options = {});
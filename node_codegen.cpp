@@ -1,351 +1,341 @@
 #include "node.h"
-
-extern unique_ptr<ostream> p_ostr;
-
-inline const vector<string> call_reg_names_8 = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
-inline const vector<string> call_reg_names_1 = {"%dil", "%sil", "%dl", "%cl", "%r8b", "%r9b"};
-
-void gen_header(string_view name){
-    ostr() << "  .global "<< name << endl;
-    ostr() << "  .text" << endl;
-}
-
-static void ass_pop(string_view reg){
-    ostr() << "  pop " << reg << endl;
-}
-
-static void ass_push(string_view reg){
-    ostr() << "  push " << reg << endl;
-}
-
-static void ass_push(int num){
-    ostr() << "  push $" << num << endl;
-}
-
-static void ass_mov_1_8(string from, string to){
-    ostr() << "  movsbq " << from << ", " << to << endl;
-}
-static void ass_mov(string from, string to){
-    ostr() << "  mov " << from << ", " << to << endl;
-}
-
-static void ass_mov_1_8(int from, string to){
-    ostr() << "  movsbq " << "$" << from << ", " << to << endl;
-}
-static void ass_mov(int from, string to){
-    ostr() << "  mov " << "$" << from << ", " << to << endl;
-}
-
-static void ass_label(string s){
-    ostr() << s << ":" << endl;
-}
-
-static void ass_prologue(int indent_count){
-    indent_count = round_up(indent_count, 2); // Some function requires 16-byte alignment for rsp register
-    ostr() << "  push %rbp" << endl;
-    ostr() << "  mov %rsp, %rbp" << endl;
-    ostr() << "  sub $" << indent_count*8 << ", %rsp" << endl;
-}
-
-static void ass_epilogue(const string& name){
-    ostr() << ".L.return." << name << ":" << endl;
-    ostr() << "  mov %rbp, %rsp" << endl;
-    ostr() << "  pop %rbp" << endl;
-}
-
-string NodeVar::ass_stack_reg() const{
-    auto& node = *this;
-    if (node.m_is_global){
-        return node.name + "(%rip)";
+#include "object.h"
+#include "x86.h"
+#include "stats.h"
+
+// Lowers the arena of one function to IR. Dispatch is a switch on the node
+// kind so traversal touches only the flat node array. Expressions return
+// the register holding their value; statements return the value of their
+// last expression, which a statement expression yields.
+class IrGen {
+    const NodeFuncDef& m_func;
+    const Ast& ast;
+    IrFunc m_ir;
+    BlockId m_block = 0;
+
+    Reg emit(Inst inst){
+        if (!is_terminator(inst.op) && inst.op != Op::Store){
+            inst.dst = m_ir.new_reg();
+        }
+        m_ir.blocks[m_block].insts.push_back(inst);
+        return inst.dst;
     }
-    auto offset = node.get_offset();
-    return to_string(-(*offset)) + "(%rbp)";
-}
-
-void NodeIf::generate(){
-    expr->generate();
-    auto count_str = to_string(count);
-    ostr() << "cmp $0" << ", %rax" << endl;
-    ostr() << "je " << ".L.else." << count_str << endl;
-    statement_if->generate();
-    ostr() << "jmp " << ".L.endif." << count_str << endl;
-    ass_label(".L.else." + count_str);
-    if (statement_else){
-        statement_else->generate();
+    BlockId new_block(){
+        m_ir.blocks.emplace_back();
+        return m_ir.blocks.size() - 1;
     }
-    ass_label(".L.endif." + count_str);
-}
-
-void NodeFor::generate(){
-    auto count_str = to_string(count);
-    expr_init->generate();
-    ass_label(".L.for." + count_str);
-    if (dynamic_cast<NodeNull*>(expr_condition.get())){
-        ass_mov(1, "%rax");
+    void start(BlockId block){
+        m_block = block;
     }
-    else {
-        expr_condition->generate();
+    void jump(BlockId target){
+        emit({Op::Jmp, IrType::I64, 0, 0, 0, 0, target});
     }
-    ostr() << "cmp $0" << ", %rax" << endl;
-    ostr() << "je " << ".L.endfor." + count_str << endl;
-    statement->generate();
-    expr_increment->generate();
-    ostr() << "jmp " << ".L.for." + count_str << endl;
-    ass_label(".L.endfor." + count_str);
-}
-
-void NodeNum::generate(){
-    ass_mov(num, "%rax");
-}
 
-void NodeCompoundStatement::generate(){
-    for (auto& pNode: pNodes){
-        pNode->generate();
+    static IrType ir_type(const Type& type){
+        switch (size_of(type)){
+        case 1: return IrType::I8;
+        case 2: return IrType::I16;
+        case 4: return IrType::I32;
+        default: return IrType::I64;
+        }
     }
-}
-
-void emit_data(const string& name, const Type& t){
-    ostr() << "  .data" << endl;
-    ostr() << "  .global " << name << endl;
-    ostr() << name << ":" << endl;
-    ostr() << "  .zero " << visit([](auto&& t){return t->size_of();}, t)<<endl;
-}
-
-void emit_text_data(const string& name, const string& text){
-    ostr() << "  .data" << endl;
-    ostr() << "  .global " << name << endl;
-    ostr() << name << ":" << endl;
-    ostr() << "  .string \"" << text << "\"" << endl;
-}
-
-void NodeVar::generate(){
-    if (is_type_of<TypeArray>(m_type)){
-        generate_address();
-        return;
+    Reg imm(int64_t value){
+        return emit({Op::Imm, IrType::I64, 0, 0, 0, value});
     }
-    if (size_of(m_type) == 1){
-        ass_mov_1_8(ass_stack_reg(), "%rax");
+    // The value converted to type, which is no wider than 64 bits.
+    Reg narrow(const Type& type, Reg value){
+        auto ir = ir_type(type);
+        if (ir == IrType::I64 || is_type_of<TypeArray>(type)){
+            return value;
+        }
+        return emit({Op::Extend, ir, 0, value});
     }
-    else {
-        ass_mov(ass_stack_reg(), "%rax");
+    Reg load(const Type& type, Reg address){
+        // an array is used through its address
+        if (is_type_of<TypeArray>(type)){
+            return address;
+        }
+        return emit({Op::Load, ir_type(type), 0, address});
+    }
+
+    Reg gen_address(NodeId id){
+        auto& node = ast[id];
+        switch (node.kind){
+        case NodeKind::Var: {
+            auto& var = ast.var(node.a);
+            if (var.is_global){
+                return emit({Op::GlobalAddr, IrType::I64, 0, 0, 0, m_ir.symbol(var.name)});
+            }
+            return emit({Op::LocalAddr, IrType::I64, 0, 0, 0, var.offset});
+        }
+        case NodeKind::Deref:
+            return gen(node.a);
+        default:
+            ast.error_at(id, "Left hand side of assignment should be identifier");
+        }
+        abort();
     }
-}
-
-void NodeVar::generate_address() const{
-    ostr() << "  lea " << ass_stack_reg() << ", %rax" << endl;
-}
-
-ITyped& NodeExpressVar::get_last_expr(){
-    auto& nodes = m_statement->pNodes;
-    assert(nodes.size());
-    assert_at(nodes.size(), m_token, "expression statement should not be empty");
-    auto& last = nodes.back();
-    auto var = dynamic_cast<ITyped*>(last.get());
-    assert_at(var != nullptr, m_token, "the last expression in expression statement should be typed");
-    return *var;
-}
 
-void NodeExpressVar::generate(){
-    m_statement->generate();
-}
-
-void NodeFunc::generate(){
-    assert_at(m_nodes.size() < 7, token, "argument size should be less than 7");
-    for(auto& node: m_nodes){
-        node->generate();
-        ass_push("%rax");
-    }
-    for (int i = ssize(m_nodes)-1; i >= 0 ; --i) {
-        if (size_of(m_nodes[i]->get_type()) == 1){
-            ass_pop(call_reg_names_8[i]);
+    // A left-leaning chain like a + b + c + ... is lowered with a loop over
+    // its left spine, so that long expressions do not recurse once per
+    // operand.
+    Reg gen_binary(NodeId id){
+        vector<NodeId> spine{id};
+        while (ast[ast[spine.back()].a].kind == NodeKind::Binary){
+            spine.push_back(ast[spine.back()].a);
         }
-        else {
-            ass_pop(call_reg_names_8[i]);
+        auto value = gen(ast[spine.back()].a);
+        for (auto it = spine.rbegin(); it != spine.rend(); ++it){
+            auto& node = ast[*it];
+            value = gen_binary(node, *it, value, gen(node.b));
+        }
+        return value;
+    }
+
+    Reg gen_binary(const Node& node, NodeId id, Reg lhs, Reg rhs){
+        auto& l = ast.type_of(node.a);
+        auto& r = ast.type_of(node.b);
+        // pointer arithmetic is scaled by the size of the element
+        if (node.op == BinOp::Add || node.op == BinOp::Sub){
+            if (is_pointer_like(r) && is_number(l)){
+                lhs = emit({Op::Mul, IrType::I64, 0, lhs, imm(size_of_base(r))});
+            }
+            else if (is_number(r) && is_pointer_like(l)){
+                rhs = emit({Op::Mul, IrType::I64, 0, rhs, imm(size_of_base(l))});
+            }
+        }
+        switch (node.op){
+        case BinOp::Add: return emit({Op::Add, IrType::I64, 0, lhs, rhs});
+        case BinOp::Sub: {
+            auto diff = emit({Op::Sub, IrType::I64, 0, lhs, rhs});
+            if (is_pointer_like(l) && is_pointer_like(r)){
+                return emit({Op::Div, IrType::I64, 0, diff, imm(size_of_base(l))});
+            }
+            return diff;
         }
+        case BinOp::Mul: return emit({Op::Mul, IrType::I64, 0, lhs, rhs});
+        case BinOp::Div: {
+            // the operands of an int division are ints, after the usual arithmetic conversions
+            auto type = ir_type(ast.type(node.type)) == IrType::I32 ? IrType::I32 : IrType::I64;
+            return emit({Op::Div, type, 0, lhs, rhs});
+        }
+        case BinOp::Eq: return emit({Op::Eq, IrType::I64, 0, lhs, rhs});
+        case BinOp::Ne: return emit({Op::Ne, IrType::I64, 0, lhs, rhs});
+        case BinOp::Lt: return emit({Op::Lt, IrType::I64, 0, lhs, rhs});
+        case BinOp::Le: return emit({Op::Le, IrType::I64, 0, lhs, rhs});
+        case BinOp::Gt: return emit({Op::Lt, IrType::I64, 0, rhs, lhs});
+        case BinOp::Ge: return emit({Op::Le, IrType::I64, 0, rhs, lhs});
+        default:
+            ast.error_at(id, "Unknown token in generate for NodePunct");
+        }
+        abort();
     }
-    ostr() << "  call " << name << endl;
-}
 
-void NodeAddress::generate(){
-    var->generate_address();
-}
-
-void NodeDeref::generate(){
-    generate_address();
-    auto type = get_type();
-    if (is_type_of<TypeArray>(type)){
-        return;
-    }
-    if (size_of(get_type()) == 1) {
-        ass_mov_1_8("(%rax)", "%rax");
+    Reg gen_assign(const Node& node){
+        auto& type = ast.type_of(node.a);
+        // the value of an assignment is the stored value, truncated to the type
+        auto value = narrow(type, gen(node.b));
+        auto address = gen_address(node.a);
+        emit({Op::Store, ir_type(type), 0, address, value});
+        return value;
     }
-    else {
-        ass_mov("(%rax)", "%rax");
-    }
-}
-
-void NodeDeref::generate_address() const{
-    var->generate();
-}
 
-
-void NodePunct::ass_adjust_address_mul(){
-    auto r = rhs->get_type();
-    auto l = lhs->get_type();
-    if (is_pointer_like(r) && from_box<TypeInt>(l)){
-        auto size = size_of_base(r);
-        ostr() << "  imul $"<< size << ", %rax" << endl;
-    }
-    else if (from_box<TypeInt>(r) && is_pointer_like(l)){
-        auto size = size_of_base(l);
-        ostr() << "  imul $"<< size << ", %rdi" << endl;
+    Reg gen_call(const Node& node){
+        ast.assert_at(node.c < 7, node.loc, "argument size should be less than 7");
+        vector<Reg> args;
+        for (auto arg : ast.list(node.b, node.c)){
+            args.push_back(gen(arg));
+        }
+        auto start = m_ir.args.size();
+        m_ir.args.insert(m_ir.args.end(), args.begin(), args.end());
+        auto result = emit({Op::Call, IrType::I64, 0, static_cast<Reg>(start), static_cast<Reg>(args.size()), m_ir.symbol(ast.name(node.a))});
+        // only the low bytes of a narrower result are defined, as for a callee compiled elsewhere
+        return narrow(ast.type(node.type), result);
+    }
+
+    void gen_if(const Node& node){
+        auto cond = gen(node.a);
+        auto then = new_block();
+        auto else_ = new_block();
+        auto end = node.c ? new_block() : else_;
+        emit({Op::Br, IrType::I64, 0, cond, 0, 0, then, else_});
+        start(then);
+        gen(node.b);
+        jump(end);
+        if (node.c){
+            start(else_);
+            gen(node.c);
+            jump(end);
+        }
+        start(end);
+    }
+
+    void gen_for(const Node& node){
+        gen(node.a);
+        auto cond = new_block();
+        auto body = new_block();
+        auto end = new_block();
+        jump(cond);
+        start(cond);
+        if (ast[node.b].kind == NodeKind::Null){
+            jump(body);
+        }
+        else {
+            emit({Op::Br, IrType::I64, 0, gen(node.b), 0, 0, body, end});
+        }
+        start(body);
+        gen(node.d);
+        gen(node.c);
+        jump(cond);
+        start(end);
+    }
+
+    Reg gen(NodeId id){
+        auto& node = ast[id];
+        switch (node.kind){
+        case NodeKind::Null:
+            return 0;
+        case NodeKind::Num:
+            return imm(static_cast<int64_t>(static_cast<uint64_t>(node.b) << 32 | node.a));
+        case NodeKind::Var:
+            return load(ast.type(node.type), gen_address(id));
+        case NodeKind::StmtExpr:
+            return gen(node.a);
+        case NodeKind::Call:
+            return gen_call(node);
+        case NodeKind::Address:
+            return gen_address(node.a);
+        case NodeKind::Deref:
+            return load(ast.type(node.type), gen(node.a));
+        case NodeKind::Binary:
+            return gen_binary(id);
+        case NodeKind::Assign:
+            return gen_assign(node);
+        case NodeKind::Ret:
+            emit({Op::Ret, IrType::I64, 0, gen(node.a)});
+            // anything after a return is unreachable but still lowered
+            start(new_block());
+            return 0;
+        case NodeKind::Block: {
+            Reg last = 0;
+            for (auto child: ast.list(node.a, node.b)){
+                last = gen(child);
+            }
+            return last;
+        }
+        case NodeKind::If:
+            gen_if(node);
+            return 0;
+        case NodeKind::For:
+            gen_for(node);
+            return 0;
+        case NodeKind::Init:
+            if (node.b){
+                auto& type = ast.type(node.type);
+                auto value = narrow(type, gen(node.b));
+                emit({Op::Store, ir_type(type), 0, gen_address_of_var(node.a), value});
+                return value;
+            }
+            return 0;
+        }
+        abort();
     }
-}
 
-void NodePunct::ass_adjust_address_div(){
-    if (is_ptr(rhs->get_type()) && is_ptr(lhs->get_type())){
-        ass_mov("$8", "%rdi");
-        ostr() << "  cqo" << endl;
-        ostr() << "  idiv %rdi" << endl;
+    Reg gen_address_of_var(VarId id){
+        return emit({Op::LocalAddr, IrType::I64, 0, 0, 0, ast.var(id).offset});
     }
-}
 
-void NodePunct::generate(){
-    lhs->generate();
-    ass_push("%rax");
-    rhs->generate();
-    ass_mov("%rax", "%rdi");
-    ass_pop("%rax");
+public:
+    IrGen(const NodeFuncDef& func): m_func(func), ast(*func.ast){}
 
-    auto& type = token.punct;
-    if(type == "+"){
-        ass_adjust_address_mul();
-        ostr() << "  add %rdi, %rax" << endl;
-    }
-    else if(type == "-"){
-        ass_adjust_address_mul();
-        ostr() << "  sub %rdi, %rax" << endl;
-        ass_adjust_address_div();
-    }
-    else if(type == "*"){
-        ostr() << "  imul %rdi, %rax" << endl;
-    }
-    else if(type == "/"){
-        ostr() << "  cqo" << endl;
-        ostr() << "  idiv %rdi" << endl;
-    }
-    else if(type == "=="){
-        ostr() << "  cmp %rdi, %rax" << endl;
-        ostr() << "  sete %al" << endl;
-        ostr() << "  movzb %al, %rax" << endl;
-    }
-    else if(type == "!="){
-        ostr() << "  cmp %rdi, %rax" << endl;
-        ostr() << "  setne %al" << endl;
-        ostr() << "  movzb %al, %rax" << endl;
-    }
-    else if(type == "<="){
-        ostr() << "  cmp %rdi, %rax" << endl;
-        ostr() << "  setle %al" << endl;
-        ostr() << "  movzb %al, %rax" << endl;
-    }
-    else if(type == "<"){
-        ostr() << "  cmp %rdi, %rax" << endl;
-        ostr() << "  setl %al" << endl;
-        ostr() << "  movzb %al, %rax" << endl;
-    }
-    else if(type == ">="){
-        ostr() << "  cmp %rax, %rdi" << endl;
-        ostr() << "  setle %al" << endl;
-        ostr() << "  movzb %al, %rax" << endl;
-    }
-    else if(type == ">"){
-        ostr() << "  cmp %rax, %rdi" << endl;
-        ostr() << "  setl %al" << endl;
-        ostr() << "  movzb %al, %rax" << endl;
-    }
-    else{
-        verror_at(token, "Unknown token in generate for NodePunct");
+    IrFunc lower(){
+        m_ir.name = m_func.m_name;
+        m_ir.stack_size = m_func.m_stack_size;
+        start(new_block());
+        // spill the parameters to their stack slots
+        for (int i = 0; i < ssize(m_func.m_param); ++i){
+            auto param = m_func.m_param[i];
+            auto& type = ast.type(ast.var(param).type);
+            auto value = narrow(type, emit({Op::Param, IrType::I64, 0, 0, 0, i}));
+            emit({Op::Store, ir_type(type), 0, gen_address_of_var(param), value});
+        }
+        gen(m_func.m_statement);
+        // falling off the end returns 0
+        emit({Op::Ret, IrType::I64, 0, imm(0)});
+        return move(m_ir);
     }
-}
+};
 
-void NodeAssign::generate(){
-    rhs->generate();
-    ass_push("%rax");
-    lhs->generate_address();
-    ass_pop("%rdi");
-    if (size_of(lhs->get_type()) == 1){
-        ass_mov("%dil", "(%rax)");
-        ass_mov_1_8("(%rax)", "%rax");
-    }
-    else {
-        ass_mov("%rdi", "(%rax)");
-        ass_mov("(%rax)", "%rax");
-    }
+IrFunc lower_func(const NodeFuncDef& func){
+    return IrGen(func).lower();
 }
 
-void NodeRet::generate(){
-    pNode->generate();
-    ostr() << "  jmp .L.return." << m_func_name << endl;
+static void emit_data(ostream& os, const string& name, const Type& t){
+    os << "  .data" << '\n';
+    os << "  .global " << name << '\n';
+    os << "  .align " << align_of_global(t) << '\n';
+    os << name << ":" << '\n';
+    os << "  .zero " << visit([](auto&& t){return t->size_of();}, t)<< '\n';
 }
 
-void NodeInitializer::generate(){
-    if (expr){
-        expr->generate();
-        if (size_of(var->get_type()) == 1){
-            ass_mov("%al", var->ass_stack_reg());
-        }
-        else {
-            ass_mov("%rax", var->ass_stack_reg());
-        }
-    }
+static void emit_text_data(ostream& os, const string& name, const string& text){
+    os << "  .data" << '\n';
+    os << "  .global " << name << '\n';
+    os << name << ":" << '\n';
+    os << "  .string \"" << text << "\"" << '\n';
 }
 
-void NodeDeclaration::generate(){
-    for (auto& pNode: pNodes){
-        pNode->generate();
+// Emits a function followed by its string literals, or with dump_ir the
+// listing of its IR after the passes.
+void generate_func(const NodeFuncDef& func, ostream& out, const CodegenOptions& options){
+    Phase phase("codegen");
+    phase.detail(func.m_name);
+    auto ir = lower_func(func);
+#ifndef NDEBUG
+    string error;
+    if (!verify(ir, &error)){
+        throw logic_error("invalid IR: " + error);
     }
-}
-
-void NodeFuncDef::generate(){
-    gen_header(m_name);
-    ostr() << m_name << ":\n";
-    ass_prologue(m_stack_size);
-    // load parameters from register
-    for(int i = 0; i < m_param.size(); ++i)
-    {
-        if (size_of(m_param[i]->get_type())==1){
-            ass_mov(call_reg_names_1[i], m_param[i]->ass_stack_reg());
+#endif
+    if (options.passes){
+        options.passes->run(ir);
+    }
+    if (options.dump_ir){
+        dump(ir, out);
+        return;
+    }
+    auto code = select_x86(ir);
+    if (stats().enabled()){
+        size_t count = 0;
+        for (auto& block : ir.blocks){
+            count += block.insts.size();
         }
-        else{
-            ass_mov(call_reg_names_8[i], m_param[i]->ass_stack_reg());
+        stats().add(Counter::IrInstructions, count);
+        stats().add(Counter::Instructions, count_if(code.code.begin(), code.code.end(), [](auto& in){ return in.op != MOp::Label; }));
+    }
+    if (options.object){
+        write_func_record(code, encode(code), out);
+        for (const auto& [var, text] : func.m_string_literals){
+            write_string_record(func.ast->var(var).name, text, out);
         }
+        return;
+    }
+    print(code, out);
+    for (const auto& [var, text] : func.m_string_literals){
+        emit_text_data(out, func.ast->var(var).name, text);
     }
-    m_statement->generate();
-    ass_epilogue(m_name);
-    ostr() << "  ret\n";
-    
 }
 
-void NodeProgram::generate(){
-    // emit data for text segment
-    for (const auto& [name, text] : m_string_literals){
-        emit_text_data(name, *text);
-    }
+void generate_data(const NodeProgram& program, ostream& out, const CodegenOptions& options){
     // emit global var
-    for (auto& pNode: pNodes){
-        if (auto pNode_ = dynamic_cast<NodeVar*>(pNode.get())){
-            emit_data(pNode_->name, pNode_->get_type());
+    for (auto global: program.m_globals){
+        auto& var = program.ast.var(global);
+        if (options.object){
+            auto& type = program.ast.type(var.type);
+            write_data_record(var.name, size_of(type), align_of_global(type), out);
         }
-    }
-    for (auto& pNode: pNodes){
-        if (dynamic_cast<NodeFuncDef*>(pNode.get())){
-            pNode->generate();
+        else {
+            emit_data(out, var.name, program.ast.type(var.type));
         }
     }
 }
-
-void generate_main(const PINode& node){
-    node->generate();
-}
-
@@ -0,0 +1,284 @@
+#include "object.h"
+#include <elf.h>
+
+static void write_hex(string_view bytes, ostream& out){
+    static const char digits[] = "0123456789abcdef";
+    for (unsigned char c : bytes){
+        out << digits[c >> 4] << digits[c & 15];
+    }
+}
+
+void write_func_record(const MFunc& func, const MCode& code, ostream& out){
+    out << "F " << func.name << ' ';
+    write_hex({reinterpret_cast<const char*>(code.bytes.data()), code.bytes.size()}, out);
+    out << '\n';
+    for (auto& reloc : code.relocs){
+        out << "R " << reloc.offset << ' ' << reloc.addend << ' ' << (reloc.call ? 'c' : 'p') << ' ' << func.symbols[reloc.sym] << '\n';
+    }
+}
+
+// Undoes the escapes of TokenStream::string_literal: octal and hex
+// escapes as well as the C ones the assembler knows.
+string unescape_string(string_view text){
+    string result;
+    for (size_t i = 0; i < text.size(); ++i){
+        if (text[i] != '\\' || i + 1 == text.size()){
+            result.push_back(text[i]);
+            continue;
+        }
+        auto c = text[++i];
+        if (c >= '0' && c <= '7'){
+            int value = 0;
+            for (int n = 0; n < 3 && i < text.size() && text[i] >= '0' && text[i] <= '7'; ++n, ++i){
+                value = value * 8 + (text[i] - '0');
+            }
+            --i;
+            result.push_back(static_cast<char>(value));
+        }
+        else if (c == 'x'){
+            int value = 0;
+            while (i + 1 < text.size() && isxdigit(static_cast<unsigned char>(text[i + 1]))){
+                auto d = text[++i];
+                value = value * 16 + (isdigit(static_cast<unsigned char>(d)) ? d - '0' : tolower(d) - 'a' + 10);
+            }
+            result.push_back(static_cast<char>(value));
+        }
+        else {
+            switch (c){
+            case 'b': result.push_back('\b'); break;
+            case 'f': result.push_back('\f'); break;
+            case 'n': result.push_back('\n'); break;
+            case 'r': result.push_back('\r'); break;
+            case 't': result.push_back('\t'); break;
+            default: result.push_back(c); break;
+            }
+        }
+    }
+    return result;
+}
+
+void write_string_record(const string& name, string_view text, ostream& out){
+    auto bytes = unescape_string(text);
+    bytes.push_back('\0');
+    out << "S " << name << ' ';
+    write_hex(bytes, out);
+    out << '\n';
+}
+
+void write_data_record(const string& name, int size, int align, ostream& out){
+    out << "D " << name << ' ' << size << ' ' << align << '\n';
+}
+
+namespace {
+
+class RecordReader {
+    ObjectImage m_image;
+
+    [[noreturn]] static void malformed(string_view line){
+        throw runtime_error("malformed object record: " + string(line.substr(0, 40)));
+    }
+
+    static string unhex(string_view hex, string_view line){
+        if (hex.size() % 2){
+            malformed(line);
+        }
+        string bytes(hex.size() / 2, '\0');
+        for (size_t i = 0; i < bytes.size(); ++i){
+            if (from_chars(hex.data() + 2 * i, hex.data() + 2 * i + 2, reinterpret_cast<uint8_t&>(bytes[i]), 16).ec != errc{}){
+                malformed(line);
+            }
+        }
+        return bytes;
+    }
+
+    // Splits off the next field of a record.
+    static string_view field(string_view& rest, string_view line){
+        auto end = rest.find(' ');
+        auto result = rest.substr(0, end);
+        if (result.empty()){
+            malformed(line);
+        }
+        rest = end == string_view::npos ? string_view{} : rest.substr(end + 1);
+        return result;
+    }
+
+    template<class T>
+    static T number(string_view text, string_view line){
+        T value{};
+        if (from_chars(text.data(), text.data() + text.size(), value).ec != errc{}){
+            malformed(line);
+        }
+        return value;
+    }
+
+    void record(string_view line){
+        if (line.size() < 2 || line[1] != ' '){
+            malformed(line);
+        }
+        auto rest = line.substr(2);
+        switch (line[0]){
+        case 'F': {
+            auto name = field(rest, line);
+            // functions are 16-byte aligned like gcc's, the padding is int3
+            m_image.text.resize(round_up(m_image.text.size(), 16), '\xcc');
+            auto code = unhex(rest, line);
+            m_image.globals.push_back({string(name), ObjectImage::Text, m_image.text.size(), code.size()});
+            m_image.text += code;
+            break;
+        }
+        case 'R': {
+            if (m_image.globals.empty() || m_image.globals.back().section != ObjectImage::Text){
+                malformed(line);
+            }
+            auto offset = number<uint64_t>(field(rest, line), line);
+            auto addend = number<int64_t>(field(rest, line), line);
+            auto kind = field(rest, line);
+            m_image.relocs.push_back({m_image.globals.back().value + offset, addend, kind == "c", string(field(rest, line))});
+            break;
+        }
+        case 'S': {
+            auto name = field(rest, line);
+            auto bytes = unhex(rest, line);
+            m_image.locals.push_back({string(name), ObjectImage::Rodata, m_image.rodata.size(), bytes.size()});
+            m_image.rodata += bytes;
+            break;
+        }
+        case 'D': {
+            auto name = field(rest, line);
+            auto size = number<uint64_t>(field(rest, line), line);
+            auto align = number<uint64_t>(field(rest, line), line);
+            if (align == 0 || (align & (align - 1)) != 0 || align > ObjectImage::bss_align){
+                malformed(line);
+            }
+            m_image.bss = round_up(m_image.bss, align);
+            m_image.globals.push_back({string(name), ObjectImage::Bss, m_image.bss, size});
+            m_image.bss += size;
+            break;
+        }
+        default:
+            malformed(line);
+        }
+    }
+
+public:
+    ObjectImage read(string_view records){
+        while (!records.empty()){
+            auto end = records.find('\n');
+            auto line = records.substr(0, end);
+            records = end == string_view::npos ? string_view{} : records.substr(end + 1);
+            if (!line.empty()){
+                record(line);
+            }
+        }
+        return move(m_image);
+    }
+};
+
+// Sections after those of the image.
+enum Section : uint16_t { Symtab = ObjectImage::Bss + 1, Strtab, RelaText, Shstrtab, NoteStack, SectionCount };
+
+}
+
+ObjectImage read_records(string_view records){
+    return RecordReader().read(records);
+}
+
+void write_elf(const ObjectImage& image, ostream& out){
+    // symbols: the null one, the locals, then the globals; a symbol
+    // referenced but not defined here is an undefined global
+    string strtab(1, '\0');
+    vector<Elf64_Sym> symtab(1);
+    unordered_map<string, uint32_t> index;
+    auto add_symbol = [&](const ObjectImage::Symbol& s, bool global){
+        index.emplace(s.name, symtab.size());
+        Elf64_Sym sym{};
+        sym.st_name = strtab.size();
+        strtab += s.name;
+        strtab.push_back('\0');
+        auto type = s.section == ObjectImage::Text ? STT_FUNC : s.section == ObjectImage::Undefined ? STT_NOTYPE : STT_OBJECT;
+        sym.st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, type);
+        sym.st_shndx = s.section;
+        sym.st_value = s.value;
+        sym.st_size = s.size;
+        symtab.push_back(sym);
+    };
+    for (auto& s : image.locals){
+        add_symbol(s, false);
+    }
+    auto first_global = symtab.size();
+    for (auto& s : image.globals){
+        add_symbol(s, true);
+    }
+    vector<Elf64_Rela> relas;
+    for (auto& r : image.relocs){
+        if (!index.contains(r.symbol)){
+            add_symbol({r.symbol, ObjectImage::Undefined}, true);
+        }
+        Elf64_Rela rela{};
+        rela.r_offset = r.offset;
+        rela.r_info = ELF64_R_INFO(index[r.symbol], r.call ? R_X86_64_PLT32 : R_X86_64_PC32);
+        rela.r_addend = r.addend;
+        relas.push_back(rela);
+    }
+
+    string shstrtab(1, '\0');
+    auto section_name = [&](string_view name){
+        auto offset = shstrtab.size();
+        shstrtab += name;
+        shstrtab.push_back('\0');
+        return static_cast<uint32_t>(offset);
+    };
+
+    // contents follow the ELF header, the section headers come last
+    string body;
+    vector<Elf64_Shdr> headers(SectionCount);
+    auto add_section = [&](uint16_t s, uint32_t name, uint32_t type, uint64_t flags, string_view contents, uint64_t align){
+        auto& h = headers[s];
+        h.sh_name = name;
+        h.sh_type = type;
+        h.sh_flags = flags;
+        body.resize(round_up(sizeof(Elf64_Ehdr) + body.size(), align) - sizeof(Elf64_Ehdr), '\0');
+        h.sh_offset = sizeof(Elf64_Ehdr) + body.size();
+        h.sh_size = contents.size();
+        h.sh_addralign = align;
+        body += contents;
+    };
+    auto bytes_of = [](const auto& v){
+        return string_view(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(v[0]));
+    };
+    add_section(ObjectImage::Text, section_name(".text"), SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, image.text, 16);
+    add_section(ObjectImage::Rodata, section_name(".rodata"), SHT_PROGBITS, SHF_ALLOC, image.rodata, 1);
+    add_section(ObjectImage::Bss, section_name(".bss"), SHT_NOBITS, SHF_ALLOC | SHF_WRITE, {}, ObjectImage::bss_align);
+    headers[ObjectImage::Bss].sh_size = image.bss;
+    add_section(Symtab, section_name(".symtab"), SHT_SYMTAB, 0, bytes_of(symtab), 8);
+    headers[Symtab].sh_link = Strtab;
+    headers[Symtab].sh_info = first_global;
+    headers[Symtab].sh_entsize = sizeof(Elf64_Sym);
+    add_section(Strtab, section_name(".strtab"), SHT_STRTAB, 0, strtab, 1);
+    add_section(RelaText, section_name(".rela.text"), SHT_RELA, SHF_INFO_LINK, bytes_of(relas), 8);
+    headers[RelaText].sh_link = Symtab;
+    headers[RelaText].sh_info = ObjectImage::Text;
+    headers[RelaText].sh_entsize = sizeof(Elf64_Rela);
+    // an empty .note.GNU-stack keeps the stack of the program non-executable
+    add_section(NoteStack, section_name(".note.GNU-stack"), SHT_PROGBITS, 0, {}, 1);
+    auto shstrtab_name = section_name(".shstrtab");
+    add_section(Shstrtab, shstrtab_name, SHT_STRTAB, 0, shstrtab, 1);
+    body.resize(round_up(sizeof(Elf64_Ehdr) + body.size(), 8) - sizeof(Elf64_Ehdr), '\0');
+
+    Elf64_Ehdr ehdr{};
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr.e_type = ET_REL;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_shoff = sizeof(Elf64_Ehdr) + body.size();
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = SectionCount;
+    ehdr.e_shstrndx = Shstrtab;
+    out.write(reinterpret_cast<const char*>(&ehdr), sizeof(ehdr));
+    out << body << bytes_of(headers);
+}
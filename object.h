@@ -0,0 +1,55 @@
+#pragma once
+#include "common.h"
+#include "x86.h"
+
+// Native objects without an assembler. In object mode the code generator
+// writes, in place of assembly, a record per function, string literal and
+// global, one per line:
+//
+//   F name hex-code               a function in .text
+//   R offset addend c|p symbol    a relocation of the function above,
+//                                 through the PLT (c) or pc-relative (p)
+//   S name hex-bytes              a string literal in .rodata
+//   D name size align             a zeroed global in .bss
+//
+// Records are text like assembly, so they are concatenated, buffered and
+// cached the same way. Once the translation unit is done the whole list
+// is read into an image, which is written as an ELF relocatable object or
+// loaded into memory and run.
+
+// The bytes of a string literal as escaped for the assembler.
+string unescape_string(string_view text);
+
+void write_func_record(const MFunc& func, const MCode& code, ostream& out);
+// text is the string as escaped for the assembler; a NUL is appended.
+void write_string_record(const string& name, string_view text, ostream& out);
+void write_data_record(const string& name, int size, int align, ostream& out);
+
+// The sections of an object, with the offsets of symbols and relocations
+// relative to their section.
+struct ObjectImage {
+    static constexpr uint64_t bss_align = 16;
+    enum Section : uint16_t { Undefined, Text, Rodata, Bss };
+    struct Symbol {
+        string name;
+        Section section;
+        uint64_t value = 0;
+        uint64_t size = 0;
+    };
+    struct Reloc {
+        uint64_t offset;    // in text
+        int64_t addend;
+        bool call;
+        string symbol;
+    };
+    string text;
+    string rodata;
+    uint64_t bss = 0;       // aligned to bss_align
+    vector<Symbol> locals;  // the string literals
+    vector<Symbol> globals; // functions and globals
+    vector<Reloc> relocs;
+};
+
+// Throws runtime_error on a malformed record.
+ObjectImage read_records(string_view records);
+void write_elf(const ObjectImage& image, ostream& out);
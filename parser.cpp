@@ -1,65 +1,78 @@
 #include "tokenizer.h"
 #include "parser.h"
+#include "stats.h"
 
-static string get_global_string_id(){
-    static int num = 0;
-    return ".L.."s + to_string(num++);
-}
-
-PosRet<PITyped> parse_left_joint_binary_operator(const vector<Token>& tokens, int start_pos, const set<string>& operators, Context& context, PaserType next_perser){
+PosRet<NodeId> parse_left_joint_binary_operator(TokenStream& tokens, size_t start_pos, initializer_list<Punct> operators, Context& context, PaserType next_perser){
     auto [pNode, pos] = next_perser(tokens, start_pos, context);
-    while (pos < tokens.size()){
-        auto token_val = tokens.at(pos).punct;
-        if (operators.contains(token_val)){
+    while (true){
+        auto token = tokens.at(pos);
+        if (token.kind == TokenKind::Punct && ranges::find(operators, token.punct()) != operators.end()){
             auto [pNode2, pos2] = next_perser(tokens, pos+1, context);
-            pNode = make_unique<NodePunct>(tokens.at(pos), move(pNode), move(pNode2));
+            pNode = context.ast().binary(token.loc, binop_of(token.punct()), pNode, pNode2);
             pos = pos2;
         }
         else {
             break;
         }
     }
-    return {move(pNode), pos};
+    return {pNode, pos};
 }
 
-PosRet<PITyped> parse_expr(const vector<Token>& tokens, int start_pos, Context& context);
+PosRet<NodeId> parse_expr(TokenStream& tokens, size_t start_pos, Context& context);
 
-// declspec = "int" | "char"
-PosRet<optional<Type>> try_parse_declspec(const vector<Token>& tokens, int pos) {
-    if(is_keyword(tokens, pos, "int")){
+// declspec = "char" | "short" "int"? | "int" | "long" "long"? "int"?
+PosRet<optional<Type>> try_parse_declspec(TokenStream& tokens, size_t pos) {
+    if(is_keyword(tokens, pos, Keyword::Int)){
         return {TypeInt{}, pos+1};
     }
-    else if (is_keyword(tokens, pos, "char")){
+    else if (is_keyword(tokens, pos, Keyword::Char)){
         return {TypeChar{}, pos+1};
     }
+    else if (is_keyword(tokens, pos, Keyword::Short)){
+        pos++;
+        if (is_keyword(tokens, pos, Keyword::Int)){
+            pos++;
+        }
+        return {TypeInt{2}, pos};
+    }
+    else if (is_keyword(tokens, pos, Keyword::Long)){
+        pos++;
+        if (is_keyword(tokens, pos, Keyword::Long)){
+            pos++;
+        }
+        if (is_keyword(tokens, pos, Keyword::Int)){
+            pos++;
+        }
+        return {TypeInt{8}, pos};
+    }
     return {nullopt, pos};
 }
 
 // param       = declspec declarator
-optional<PosRet<PNodeVar>> try_parse_param(const vector<Token>& tokens, int pos, Context& context){
+optional<PosRet<VarId>> try_parse_param(TokenStream& tokens, size_t pos, Context& context){
     auto [type, pos1] = try_parse_declspec(tokens, pos);
     if (!type) {
         return nullopt;
     }
     auto [node, param, pos2] = parse_declarator(tokens, pos1, *type, false, context);
     assert(param.size() == 0);
-    return make_pair(move(node), pos2);
+    return make_pair(node, pos2);
 }
 
 // type-suffix = func-params? ")"
 // func-params = param ("," param)*
-PosRet<vector<PNodeVar>> parse_func_suffix(const vector<Token>& tokens, int pos, Context& context){
-    vector<PNodeVar> params;
+PosRet<vector<VarId>> parse_func_suffix(TokenStream& tokens, size_t pos, Context& context){
+    vector<VarId> params;
     while(auto ret = try_parse_param(tokens, pos, context)){
         auto&& [param, pos1] = *ret;
         pos = pos1;
-        params.push_back(move(param));
-        if (!is_punct(tokens, pos, ",")){
+        params.push_back(param);
+        if (!is_punct(tokens, pos, Punct::Comma)){
             break;
         }
         pos++;
     }
-    expect_punct(tokens, pos, ")");
+    expect_punct(tokens, pos, Punct::RParen);
     return make_pair(move(params), pos+1);
 }
 
@@ -67,383 +80,481 @@ PosRet<vector<PNodeVar>> parse_func_suffix(const vector<Token>& tokens, int pos,
 //                | "[" num "]" (type-suffix)?
 //                | ε
 static
-PosRet<optional<vector<PNodeVar>>> 
-parse_type_suffix(const vector<Token>& tokens, int pos, Context& context, Type& type)
+PosRet<optional<vector<VarId>>> 
+parse_type_suffix(TokenStream& tokens, size_t pos, Context& context, Type& type)
 {
-    if (is_punct(tokens, pos, "(")) {
+    if (is_punct(tokens, pos, Punct::LParen)) {
         auto [ret, pos2] = parse_func_suffix(tokens, pos+1, context);
         {
             // create func type
             auto t = TypeFunc{};
             t.m_ret = make_shared<Type>(type);
             for(auto& v: ret){
-                t.m_params.emplace_back(make_shared<Type>(v->get_type()));
+                t.m_params.emplace_back(make_shared<Type>(context.ast().type(context.ast().var(v).type)));
             }
             type = t;
         }
         return make_pair(move(ret), pos2);
     }
-    else if (is_punct(tokens, pos, "[")){
+    else if (is_punct(tokens, pos, Punct::LBracket)){
         expect_kind(tokens, pos+1, TokenKind::Num);
-        auto array_size = tokens.at(pos+1).val;
-        expect_punct(tokens, pos+2, "]");
+        auto& size_token = tokens.at(pos+1);
+        auto array_size = tokens.num(size_token);
+        tokens.assert_at(array_size <= numeric_limits<int>::max(), size_token, "array is too large");
+        expect_punct(tokens, pos+2, Punct::RBracket);
         auto [rest, pos1] = parse_type_suffix(tokens, pos+3, context, type);
-        type = TypeArray{make_shared<Type>(type), array_size};
+        type = TypeArray{make_shared<Type>(type), static_cast<int>(array_size)};
         return make_pair(nullopt, pos1);
     }
     return make_pair(nullopt, pos);
 }
 
 // declarator = "*"* ident type-suffix
-PosRet<PNodeVar, vector<PNodeVar>>
-parse_declarator(const vector<Token>& tokens, int pos, Type type, bool is_global, Context& context){
-    while(is_punct(tokens, pos, "*")){
+PosRet<VarId, vector<VarId>>
+parse_declarator(TokenStream& tokens, size_t pos, Type type, bool is_global, Context& context){
+    while(is_punct(tokens, pos, Punct::Star)){
         ++pos;
         type = to_ptr(move(type));
     }
     expect_kind(tokens, pos, TokenKind::Ident);
-    auto var_name = tokens.at(pos);
+    auto name_token = tokens.at(pos);
     pos++;
     auto [suffix, pos1] = parse_type_suffix(tokens, pos, context, type);
-    auto var = make_shared<NodeVar>(var_name, type, is_global);
+    auto& ast = context.ast();
+    auto var = ast.add_var(name_token.loc, tokens.ident(name_token), ast.add_type(move(type)), is_global);
     context.set_variable(is_global, var);
     if (suffix){
-        return make_tuple(move(var), move(*suffix), pos1);
+        return make_tuple(var, move(*suffix), pos1);
     }
-    return {move(var), vector<PNodeVar>{}, pos1};
+    return {var, vector<VarId>{}, pos1};
 }
 
 // initializer = declarator ("=" expr)?
-PosRet<PINode> parse_initializer(const vector<Token>& tokens, int pos, Type type, Context& context) {
+PosRet<NodeId> parse_initializer(TokenStream& tokens, size_t pos, Type type, Context& context) {
+    auto loc = tokens.at(pos).loc;
     auto [pNode, param, pos_decl] = parse_declarator(tokens, pos, type, false, context);
     assert(param.size() == 0);
-    if (is_punct(tokens, pos_decl, "=")){
+    if (is_punct(tokens, pos_decl, Punct::Assign)){
+        auto loc_assign = tokens.at(pos_decl).loc;
         auto [expr, pos_expr] = parse_expr(tokens, pos_decl+1, context);
-        return {make_unique<NodeInitializer>(tokens.at(pos_decl), move(pNode), move(expr), type), pos_expr};
+        return {context.ast().init(loc_assign, pNode, expr), pos_expr};
     }
-    return {make_unique<NodeInitializer>(tokens.at(pos), move(pNode), nullptr, type), pos_decl};
+    return {context.ast().init(loc, pNode, 0), pos_decl};
 }
 
 
 // declaration = declspec (initializer ("," initializer)*)? ";"
-PosRet<PINode> 
-try_parse_declaration(const vector<Token>& tokens, int pos, Context& context) {
+PosRet<NodeId> 
+try_parse_declaration(TokenStream& tokens, size_t pos, Context& context) {
     auto [type, pos1] = try_parse_declspec(tokens, pos);
     if (!type){
-        return {nullptr, pos1};
+        return {0, pos1};
     }
-    vector<PINode> pNodes;
-    PINode pNode;
+    auto loc = tokens.at(pos).loc;
+    vector<NodeId> pNodes;
+    NodeId pNode;
     do {
         tie(pNode, pos1) = parse_initializer(tokens, pos1, *type, context);
-        pNodes.emplace_back(move(pNode));
-    } while(is_punct(tokens, pos1++, ","));
-    expect_punct(tokens, pos1-1, ";");
-    return {make_unique<NodeDeclaration>(tokens.at(pos), move(pNodes)), pos1};
+        pNodes.emplace_back(pNode);
+    } while(is_punct(tokens, pos1++, Punct::Comma));
+    expect_punct(tokens, pos1-1, Punct::Semicolon);
+    return {context.ast().block(loc, pNodes), pos1};
 }
 
 // func = ident "(" assign? ("," assign)* ")"
-PosRet<PITyped> parse_func(const vector<Token>& tokens, int pos, Context& context){
-    auto& token_ident = tokens.at(pos);
-    vector<PITyped> args;
+PosRet<NodeId> parse_func(TokenStream& tokens, size_t pos, Context& context){
+    auto token_ident = tokens.at(pos);
+    auto& ast = context.ast();
+    // the result is of the declared return type, or int
+    auto type = Ast::int_type;
+    if (auto func = context.variable(tokens.ident(token_ident), true)){
+        if (auto f = from_box<TypeFunc>(ast.type(ast.var(func).type))){
+            type = ast.add_type(*f->m_ret);
+        }
+    }
+    vector<NodeId> args;
     pos += 2;
-    PITyped expr;
-    if (is_punct(tokens, pos, ")")){
-        return {make_unique<NodeFunc>(token_ident, move(args)), pos+1};
+    NodeId expr;
+    if (is_punct(tokens, pos, Punct::RParen)){
+        return {ast.call(token_ident.loc, token_ident.id, args, type), pos+1};
     }
     tie(expr, pos) = parse_assign(tokens, pos, context);
-    args.push_back(move(expr));
-    while(is_punct(tokens, pos, ",")){
+    args.push_back(expr);
+    while(is_punct(tokens, pos, Punct::Comma)){
         tie(expr, pos) = parse_assign(tokens, pos+1, context);
-        args.push_back(move(expr));
+        args.push_back(expr);
     }
-    expect_punct(tokens, pos, ")");
-    return {make_unique<NodeFunc>(token_ident, move(args)), pos+1};
+    expect_punct(tokens, pos, Punct::RParen);
+    return {ast.call(token_ident.loc, token_ident.id, args, type), pos+1};
 }
 
 
 //  primary =  num | string | ident | func | "sizeof" expr | "(" expr ")" |  "(" compound-statement ")"
-PosRet<PITyped> 
-parse_primary(const vector<Token>& tokens, int pos, Context& context){
-    auto& token = tokens.at(pos);
-    auto token_val = token.punct;
-    if (is_punct(tokens, pos, "(") && is_punct(tokens, pos+1, "{")){
+PosRet<NodeId> 
+parse_primary(TokenStream& tokens, size_t pos, Context& context){
+    auto token = tokens.at(pos);
+    auto& ast = context.ast();
+    if (is_punct(tokens, pos, Punct::LParen) && is_punct(tokens, pos+1, Punct::LBrace)){
         Context sub_context(&context);
         auto [node,pos1] = parse_compound_statement(tokens, pos+2, sub_context);
-        auto expr = make_unique<NodeExpressVar>(tokens.at(pos), move(node));
-        expect_punct(tokens, pos1, ")");
-        return {move(expr), pos1+1};
+        auto expr = ast.stmt_expr(token.loc, node);
+        expect_punct(tokens, pos1, Punct::RParen);
+        return {expr, pos1+1};
     }
-    else if (is_punct(tokens, pos, "(")){
-        PITyped pNode;
+    else if (is_punct(tokens, pos, Punct::LParen)){
+        NodeId pNode;
         tie(pNode, pos) = parse_expr(tokens, pos+1, context);
-        expect_punct(tokens, pos, ")");
-        return {move(pNode), pos+1};
+        expect_punct(tokens, pos, Punct::RParen);
+        return {pNode, pos+1};
     }
-    else if (is_keyword(tokens, pos, "sizeof")) {
+    else if (is_keyword(tokens, pos, Keyword::Sizeof)) {
         auto [node, pos1] = parse_unary(tokens, pos+1, context);
-        auto num = make_unique<NodeNum>(size_of(node->get_type()));
-        return {move(num), pos1};
+        return {ast.num(token.loc, size_of(ast.type_of(node))), pos1};
     }
     else if (is_kind(tokens, pos, TokenKind::Ident)){
-        if (is_punct(tokens, pos+1, "(")){
+        if (is_punct(tokens, pos+1, Punct::LParen)){
             return parse_func(tokens, pos, context);
         }
-        auto is_global = context.variable(token.ident, true) != nullptr;
-        assert_at(context.variable(token.ident) != nullptr, token, "unknown variable");
-        auto tmp_var = context.variable(token.ident, is_global);
-        PITyped var;
-        if(tmp_var){
-            auto var_ = make_shared<NodeVar>(NodeVar(*tmp_var));
-            var_->m_base = tmp_var;
-            context.add_locals(var_);
-            var = move(var_); 
-        }
-        else {
-            auto var_ = make_shared<NodeVar>(token, Type{}, is_global);
-            context.set_variable(is_global, var_);
-            var = move(var_);
-        }
-        return {move(var), pos+1};
+        auto var = context.variable(tokens.ident(token));
+        tokens.assert_at(var != 0, token, "unknown variable");
+        return {ast.var_ref(token.loc, var), pos+1};
     }
     else if(is_kind(tokens, pos, TokenKind::String)) {
-        auto name = get_global_string_id();
-        auto type = TypeArray{make_shared<Type>(TypeChar{}), static_cast<int>(token.text->size())+1};
-        context.string_literal(name, token.text);
-        auto var = make_shared<NodeVar>(token, type, name, true);
-        context.set_variable(true, var);
-        return {move(var), pos+1};
+        auto text = tokens.string_literal(token);
+        auto type = TypeArray{make_shared<Type>(TypeChar{}), static_cast<int>(text.size())+1};
+        auto var = ast.add_var(token.loc, "", ast.add_type(type), true);
+        context.string_literal(var, move(text));
+        return {ast.var_ref(token.loc, var), pos+1};
     }
     else if(is_kind(tokens, pos, TokenKind::Num)) {
-        return {make_unique<NodeNum>(token), pos+1};
+        return {ast.num(token.loc, tokens.num(token)), pos+1};
     }
-    assert_at(false, token, "unknown token"); abort();
+    tokens.error_at(token, "unknown token"); abort();
 }
 
 // postfix = primary ("[" expr "]")*
-PosRet<PITyped> parse_postfix(const vector<Token>& tokens, int pos_, Context& context)
+PosRet<NodeId> parse_postfix(TokenStream& tokens, size_t pos_, Context& context)
 {
     auto [node, pos] = parse_primary(tokens, pos_, context);
-    while (is_punct(tokens, pos, "[")) {
+    while (is_punct(tokens, pos, Punct::LBracket)) {
+        auto loc = tokens.at(pos).loc;
         auto [expr, pos2] = parse_expr(tokens, pos+1, context);
-        auto token_punct = tokens.at(pos);
-        token_punct.from_punct("+");
-        node = make_unique<NodePunct>(token_punct, move(node), move(expr));
-        node = make_unique<NodeDeref>(tokens.at(pos), move(node));
-        expect_punct(tokens, pos2, "]");
+        node = context.ast().binary(loc, BinOp::Add, node, expr);
+        node = context.ast().deref(loc, node);
+        expect_punct(tokens, pos2, Punct::RBracket);
         pos = pos2+1;
     }
-    return {move(node), pos};
+    return {node, pos};
 }
 
 // unary = ("+" | "-" | "*" | "&") unary | postfix
-PosRet<PITyped> parse_unary(const vector<Token>& tokens, int pos, Context& context){
-    if (is_punct(tokens, pos, "+")){
+PosRet<NodeId> parse_unary(TokenStream& tokens, size_t pos, Context& context){
+    auto loc = tokens.at(pos).loc;
+    if (is_punct(tokens, pos, Punct::Plus)){
         return parse_unary(tokens, pos+1, context);
     }
-    else if (is_punct(tokens, pos, "-")){
+    else if (is_punct(tokens, pos, Punct::Minus)){
         auto [pNode, pos_end] = parse_unary(tokens, pos+1, context);
-        return {make_unique<NodePunct>(tokens.at(pos), make_unique<NodeNum>(0), move(pNode)), pos_end};
+        return {context.ast().binary(loc, BinOp::Sub, context.ast().num(loc, 0), pNode), pos_end};
     }
-    else if (is_punct(tokens, pos, "*")){
+    else if (is_punct(tokens, pos, Punct::Star)){
         auto [pNode, pos_end] = parse_unary(tokens, pos+1, context);
-        return {make_unique<NodeDeref>(tokens.at(pos), move(pNode)), pos_end};
+        return {context.ast().deref(loc, pNode), pos_end};
     }
-    else if (is_punct(tokens, pos, "&")){
+    else if (is_punct(tokens, pos, Punct::Amp)){
         auto [pNode, pos_end] = parse_unary(tokens, pos+1, context);
-        return {make_unique<NodeAddress>(tokens.at(pos), move(pNode)), pos_end};
+        return {context.ast().address(loc, pNode), pos_end};
     }
     return parse_postfix(tokens, pos, context);
 }
 
 //  mul     = unary ("*" unary | "/" unary)*
-PosRet<PITyped> parse_mul(const vector<Token>& tokens, int pos, Context& context){
-    return parse_left_joint_binary_operator(tokens, pos, {"*", "/"}, context, parse_unary);
+PosRet<NodeId> parse_mul(TokenStream& tokens, size_t pos, Context& context){
+    return parse_left_joint_binary_operator(tokens, pos, {Punct::Star, Punct::Slash}, context, parse_unary);
 }
 
 //  add    = mul ("+" mul | "-" mul)*
-PosRet<PITyped> parse_add(const vector<Token>& tokens, int pos, Context& context){
-    return parse_left_joint_binary_operator(tokens, pos, {"+", "-"}, context, parse_mul);
+PosRet<NodeId> parse_add(TokenStream& tokens, size_t pos, Context& context){
+    return parse_left_joint_binary_operator(tokens, pos, {Punct::Plus, Punct::Minus}, context, parse_mul);
 }
 
 //  relational = add ("<" add | "<=" add | ">" add | ">=" add)*
-PosRet<PITyped> parse_relational(const vector<Token>& tokens, int pos, Context& context){
-    return parse_left_joint_binary_operator(tokens, pos, {"<", "<=", ">", ">="}, context, parse_add);
+PosRet<NodeId> parse_relational(TokenStream& tokens, size_t pos, Context& context){
+    return parse_left_joint_binary_operator(tokens, pos, {Punct::Lt, Punct::Le, Punct::Gt, Punct::Ge}, context, parse_add);
 }
 
 //  equality   = relational ("==" relational | "!=" relational)*
-PosRet<PITyped> parse_equality(const vector<Token>& tokens, int pos, Context& context){
-    return parse_left_joint_binary_operator(tokens, pos, {"==", "!="}, context, parse_relational);
+PosRet<NodeId> parse_equality(TokenStream& tokens, size_t pos, Context& context){
+    return parse_left_joint_binary_operator(tokens, pos, {Punct::Eq, Punct::Ne}, context, parse_relational);
 }
 
 // assign     = equality ("=" assign)?
-PosRet<PITyped> parse_assign(const vector<Token>& tokens, int start_pos, Context& context){
+PosRet<NodeId> parse_assign(TokenStream& tokens, size_t start_pos, Context& context){
     auto [pNode, pos] = parse_equality(tokens, start_pos, context);
-    if (is_punct(tokens, pos, "=")){
+    if (is_punct(tokens, pos, Punct::Assign)){
+        auto loc = tokens.at(pos).loc;
         auto [pNode2, pos2] = parse_assign(tokens, pos+1, context);
-        pNode = make_unique<NodeAssign>(tokens.at(pos), move(pNode), move(pNode2));
+        pNode = context.ast().assign(loc, pNode, pNode2);
         pos = pos2;
     }
-    return {move(pNode), pos};
+    return {pNode, pos};
 }
 
 // expr = assign
-PosRet<PITyped> parse_expr(const vector<Token>& tokens, int start_pos, Context& context){
+PosRet<NodeId> parse_expr(TokenStream& tokens, size_t start_pos, Context& context){
     return parse_assign(tokens, start_pos, context);
 }
 
-PosRet<PINode> parse_statement(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_statement(TokenStream& tokens, size_t pos, Context& context);
 
 // compound-statement = (declaration | statement)* "}"
-PosRet<unique_ptr<NodeCompoundStatement>> parse_compound_statement(const vector<Token>& tokens, int pos, Context& context){
-    vector<PINode> pNodes;
-    auto token_start = tokens.at(pos);
-    while (!is_punct(tokens, pos, "}")){
-        PINode pNode;
+PosRet<NodeId> parse_compound_statement(TokenStream& tokens, size_t pos, Context& context){
+    vector<NodeId> pNodes;
+    auto loc = tokens.at(pos).loc;
+    while (!is_punct(tokens, pos, Punct::RBrace)){
+        NodeId pNode;
         tie(pNode, pos) = try_parse_declaration(tokens, pos, context);
         if(!pNode){
             tie(pNode, pos) = parse_statement(tokens, pos, context);
         }
-        pNodes.emplace_back(move(pNode));
+        pNodes.emplace_back(pNode);
     }
-    return {make_unique<NodeCompoundStatement>(token_start, move(pNodes)), pos+1};
+    return {context.ast().block(loc, pNodes), pos+1};
 }
 
 // expr_statement_return = "return" expr ";"
-PosRet<PINode> parse_statement_return(const vector<Token>& tokens, int pos, Context& context){
-    assert(is_keyword(tokens, pos, "return"));
+PosRet<NodeId> parse_statement_return(TokenStream& tokens, size_t pos, Context& context){
+    assert(is_keyword(tokens, pos, Keyword::Return));
+    auto loc = tokens.at(pos).loc;
     auto [pNode, pos2] = parse_expr(tokens, pos+1, context);
-    expect_punct(tokens, pos2, ";");
-    return {make_unique<NodeRet>(tokens.at(pos), move(pNode), context.func_name()), pos2+1};
+    expect_punct(tokens, pos2, Punct::Semicolon);
+    return {context.ast().ret(loc, pNode), pos2+1};
 }
 
 // expr_statement = expr? ";"
-PosRet<PINode> parse_expr_statement(const vector<Token>& tokens, int pos, Context& context){
-    if (is_punct(tokens, pos, ";")){
-        return {get_null_statement(tokens.at(pos)), pos+1};
+PosRet<NodeId> parse_expr_statement(TokenStream& tokens, size_t pos, Context& context){
+    if (is_punct(tokens, pos, Punct::Semicolon)){
+        return {get_null_statement(tokens.at(pos).loc, context), pos+1};
     }
     auto [pNode, pos2] = parse_expr(tokens, pos, context);
-    expect_punct(tokens, pos2, ";");
-    return {move(pNode), pos2+1};
+    expect_punct(tokens, pos2, Punct::Semicolon);
+    return {pNode, pos2+1};
 }
 
 // statement_for = "for" "(" expr_statement expr_statement expr? ")" statement
-PosRet<PINode> parse_statement_for(const vector<Token>& tokens, int pos, Context& context){
-    assert(is_keyword(tokens, pos, "for"));
-    expect_punct(tokens, pos+1, "(");
+PosRet<NodeId> parse_statement_for(TokenStream& tokens, size_t pos, Context& context){
+    assert(is_keyword(tokens, pos, Keyword::For));
+    auto loc = tokens.at(pos).loc;
+    expect_punct(tokens, pos+1, Punct::LParen);
     auto [expr1, pos1] = parse_expr_statement(tokens, pos+2, context);
     auto [expr2, pos2] = parse_expr_statement(tokens, pos1, context);
-    PINode expr3 = get_null_statement(tokens.at(pos2));
-    int pos3 = pos2; 
-    if (!is_punct(tokens, pos2, ")")) {
+    NodeId expr3 = get_null_statement(tokens.at(pos2).loc, context);
+    size_t pos3 = pos2; 
+    if (!is_punct(tokens, pos2, Punct::RParen)) {
         tie(expr3, pos3) = parse_expr(tokens, pos2, context);
-        expect_punct(tokens, pos3, ")");
+        expect_punct(tokens, pos3, Punct::RParen);
     }
     auto [statement, pos_end] = parse_statement(tokens, pos3+1, context);
-    return {make_unique<NodeFor>(tokens.at(pos), move(expr1), move(expr2), move(expr3), move(statement)), pos_end};
+    return {context.ast().for_(loc, expr1, expr2, expr3, statement), pos_end};
 }
 
 // statement_while = "while" "(" expr ")" statement
-PosRet<PINode> parse_statement_while(const vector<Token>& tokens, int pos, Context& context){
-    assert(is_keyword(tokens, pos, "while"));
-    expect_punct(tokens, pos+1, "(");
+PosRet<NodeId> parse_statement_while(TokenStream& tokens, size_t pos, Context& context){
+    assert(is_keyword(tokens, pos, Keyword::While));
+    auto loc = tokens.at(pos).loc;
+    expect_punct(tokens, pos+1, Punct::LParen);
     auto [expr, pos_expr] = parse_expr(tokens, pos+2, context);
-    expect_punct(tokens, pos_expr, ")");
+    expect_punct(tokens, pos_expr, Punct::RParen);
     auto [statement, pos_statement] = parse_statement(tokens, pos_expr+1, context);
-    return {make_unique<NodeFor>(tokens.at(pos), get_null_statement(tokens.at(pos)), move(expr), get_null_statement(tokens.at(pos)), move(statement)), pos_statement};
+    return {context.ast().for_(loc, get_null_statement(loc, context), expr, get_null_statement(loc, context), statement), pos_statement};
 }
 
 // statement_if = "if" "(" expr ")" statement ("else" statement)?
-PosRet<PINode> parse_statement_if(const vector<Token>& tokens, int pos, Context& context){
-    assert(is_keyword(tokens, pos, "if"));
-    expect_punct(tokens, pos+1, "(");
+PosRet<NodeId> parse_statement_if(TokenStream& tokens, size_t pos, Context& context){
+    assert(is_keyword(tokens, pos, Keyword::If));
+    auto loc = tokens.at(pos).loc;
+    expect_punct(tokens, pos+1, Punct::LParen);
     auto [expr, pos2] = parse_expr(tokens, pos+2, context);
-    expect_punct(tokens, pos2, ")");
+    expect_punct(tokens, pos2, Punct::RParen);
     auto [statement_if, pos3] = parse_statement(tokens, pos2+1, context);
-    if (is_keyword(tokens, pos3, "else")){
+    if (is_keyword(tokens, pos3, Keyword::Else)){
         auto [statement_else, pos4] = parse_statement(tokens, pos3+1, context);
-        return {make_unique<NodeIf>(tokens.at(pos), move(expr), move(statement_if), move(statement_else)), pos4};
+        return {context.ast().if_(loc, expr, statement_if, statement_else), pos4};
     }
-    return {make_unique<NodeIf>(tokens.at(pos), move(expr), move(statement_if), nullptr), pos3};
+    return {context.ast().if_(loc, expr, statement_if, 0), pos3};
 }
 
 // statement = statement_if | statement_for | statement_while | "{" compound-statement |  "return" expr ";" |  expr_statement |
-PosRet<PINode> parse_statement(const vector<Token>& tokens, int pos, Context& context){
-    if (is_keyword(tokens, pos, "if")){
+PosRet<NodeId> parse_statement(TokenStream& tokens, size_t pos, Context& context){
+    if (is_keyword(tokens, pos, Keyword::If)){
         return parse_statement_if(tokens, pos, context);
     }
-    if (is_keyword(tokens, pos, "for")){
+    if (is_keyword(tokens, pos, Keyword::For)){
         return parse_statement_for(tokens, pos, context);
     }
-    if (is_keyword(tokens, pos, "while")){
+    if (is_keyword(tokens, pos, Keyword::While)){
         return parse_statement_while(tokens, pos, context);
     }
-    if (is_punct(tokens, pos, "{")){
+    if (is_punct(tokens, pos, Punct::LBrace)){
         Context sub_context(&context);
         return parse_compound_statement(tokens, pos+1, sub_context);
     }
-    if (is_keyword(tokens, pos, "return")){
+    if (is_keyword(tokens, pos, Keyword::Return)){
         return parse_statement_return(tokens, pos, context);
     }
     return parse_expr_statement(tokens, pos, context);
 }
 
 // func_def = "{" compound-statement
-PosRet<PINode> 
-parse_func_def(const vector<Token>& tokens, int pos, const NodeVar& node, 
-        std::vector<PNodeVar> &&param, Context& context){
-    expect_punct(tokens, pos, "{");
+NodeFuncDef
+parse_func_def(TokenStream& tokens, size_t& pos, VarId func, 
+        std::vector<VarId> &&param, Context& context){
+    expect_punct(tokens, pos, Punct::LBrace);
+    auto loc = tokens.at(pos).loc;
     auto [state, pos_state] = parse_compound_statement(tokens, pos+1, context);
-    // assign stack offset
+    auto& ast = context.ast();
+    // assign stack offset, each local aligned within the 16-byte aligned frame
     int offset = 0;
-    for(PNodeVar local : context.locals()){
-        auto this_size = size_of(local->get_type());
-        if (local->m_base){
-            local->offset = local->m_base->offset;
-        }
-        else {
-            local->offset = offset;
-            offset += this_size;
-        }
-    }
-    for(PNodeVar local : context.locals()){
-        local->offset = offset-local->offset;
+    for(auto local : context.locals()){
+        auto& type = ast.type(ast.var(local).type);
+        offset = round_up(offset, align_of(type));
+        ast.var(local).offset = offset;
+        offset += size_of(type);
     }
     offset = round_up(offset, 16);
-    return {make_unique<NodeFuncDef>(tokens.at(pos), node.name, move(state), node.get_type(), 
-            move(param), offset), pos_state};
+    for(auto local : context.locals()){
+        ast.var(local).offset = offset-ast.var(local).offset;
+    }
+    auto& var = ast.var(func);
+    NodeFuncDef def{nullptr, loc, var.name, var.type, move(param), state, offset, {}};
+    pos = pos_state;
+    return def;
 }
 
+// Position just past the "}" matching the "{" at pos.
+static size_t skip_func_body(TokenStream& tokens, size_t pos){
+    expect_punct(tokens, pos, Punct::LBrace);
+    size_t depth = 0;
+    do {
+        auto& token = tokens.at(pos++);
+        if (token.kind == TokenKind::Eof){
+            tokens.error_at(token, "'}' is expected");
+        }
+        if (token.kind == TokenKind::Punct && token.punct() == Punct::LBrace){
+            ++depth;
+        }
+        else if (token.kind == TokenKind::Punct && token.punct() == Punct::RBrace){
+            --depth;
+        }
+    } while (depth > 0);
+    return pos;
+}
+
+// Parses the body of a function whose declarator was parsed into the
+// program arena. The function gets an arena of its own, into which the
+// function and its parameters are imported. Its string literals are named
+// after it, so functions can be parsed in any order.
+static NodeFuncDef
+parse_func_body(TokenStream& tokens, size_t& pos, VarId func, const vector<VarId>& params,
+        const Context& context_main, VarId visible){
+    auto& main_ast = context_main.ast();
+    Phase phase("parse function");
+    phase.detail(main_ast.var(func).name);
+    auto ast = make_unique<Ast>(tokens);
+    Context context(*ast, context_main, visible);
+    auto own_func = ast->import_var(main_ast, func);
+    context.set_variable(true, own_func);
+    vector<VarId> own_params;
+    for (auto param : params){
+        own_params.push_back(ast->import_var(main_ast, param));
+        context.set_variable(false, own_params.back());
+    }
+    auto def = parse_func_def(tokens, pos, own_func, move(own_params), context);
+    def.m_string_literals = move(context.string_literal());
+    for (size_t i = 0; i < def.m_string_literals.size(); ++i){
+        ast->var(def.m_string_literals[i].first).name = ".L.." + def.m_name + "." + to_string(i);
+    }
+    ast->shrink_to_fit();
+    ast->count_stats();
+    stats().add(Counter::Functions, 1);
+    def.ast = move(ast);
+    return def;
+}
 
 // program = (declspec declarator func_def | global-variable)*
 // global-veriable = declspec ( declarator ("," declarator) * ) ";"
-PosRet<PINode> parse_program(const vector<Token>& tokens, int pos){
-    Context context_main{};
-    vector<PINode> nodes;
-    PINode node;
-    while(pos < tokens.size()){
+//
+// Globals and function signatures are registered in the program arena.
+// For each function definition, on_func gets where the definition starts
+// and the position of its "{", and returns the position after the body.
+template<class OnFunc>
+static size_t parse_top_level(TokenStream& tokens, size_t pos, NodeProgram& program,
+        Context& context_main, OnFunc on_func){
+    auto& ast = program.ast;
+    while(!is_kind(tokens, pos, TokenKind::Eof)){
         Context context(&context_main);
         context.reset_locals();
+        auto start = tokens.at(pos).loc;
         auto [type, pos1] = try_parse_declspec(tokens, pos);
+        if (!type){
+            tokens.error_at(start, "expected a type");
+        }
         auto [node_, param, pos2] = parse_declarator(tokens, pos1, *type, true, context);
-        type = node_->get_type();
-        context.set_func_name(node_->name);
-        if (is_type_of<TypeFunc>(*type)){
-            tie(node, pos) = parse_func_def(tokens, pos2, *node_.get(), move(param), context);
-            nodes.push_back(move(node));
+        if (is_type_of<TypeFunc>(ast.type(ast.var(node_).type))){
+            pos = on_func(start, pos2, node_, move(param));
         }
         else {
             pos = pos2;
-            nodes.push_back(node_);
-            while (is_punct(tokens, pos, ",")){
+            program.m_globals.push_back(node_);
+            while (is_punct(tokens, pos, Punct::Comma)){
                 auto [node_, param, pos2] = parse_declarator(tokens, pos+1, *type, true, context);
                 pos = pos2;
-                nodes.push_back(node_);
+                program.m_globals.push_back(node_);
             }
-            expect_punct(tokens, pos, ";");
+            expect_punct(tokens, pos, Punct::Semicolon);
             pos++;
         }
     }
-    return {make_unique<NodeProgram>(move(nodes), context_main.string_literal()), pos};
+    return pos;
+}
+
+// A sequential pre-pass registers globals and function signatures and skips
+// function bodies by matching braces. The bodies can then be parsed in any
+// order and on any thread with parse_func_job.
+ProgramOutline parse_outline(TokenStream& tokens, size_t pos){
+    ProgramOutline outline;
+    outline.program = make_unique<NodeProgram>(tokens);
+    outline.context = make_unique<Context>(outline.program->ast);
+    outline.pos = parse_top_level(tokens, pos, *outline.program, *outline.context, [&](SourceLoc start, size_t pos, VarId func, vector<VarId> params){
+        auto loc = tokens.at(pos).loc;
+        auto visible = static_cast<VarId>(outline.program->ast.var_count());
+        auto end = skip_func_body(tokens, pos);
+        auto& close = tokens.at(end - 1);
+        outline.funcs.push_back({pos, loc, func, move(params), visible, start, close.loc + close.len});
+        return end;
+    });
+    outline.program->ast.count_stats();
+    return outline;
+}
+
+// Parses one function body of the outline with a cursor of its own.
+NodeFuncDef parse_func_job(const TokenStream& tokens, const ProgramOutline& outline, size_t index){
+    auto& job = outline.funcs[index];
+    TokenStream cursor(tokens, job.pos, job.loc);
+    auto pos = job.pos;
+    return parse_func_body(cursor, pos, job.func, job.params, *outline.context, job.visible);
 }
 
+// Parses the functions in order and hands each one to emit as soon as it is
+// complete instead of keeping it in the program.
+PosRet<unique_ptr<NodeProgram>> parse_program(TokenStream& tokens, size_t pos, const function<void(NodeFuncDef)>& emit){
+    auto program = make_unique<NodeProgram>(tokens);
+    Context context_main(program->ast);
+    pos = parse_top_level(tokens, pos, *program, context_main, [&](SourceLoc, size_t pos, VarId func, vector<VarId> params){
+        auto visible = static_cast<VarId>(program->ast.var_count());
+        emit(parse_func_body(tokens, pos, func, params, context_main, visible));
+        return pos;
+    });
+    program->ast.count_stats();
+    return {move(program), pos};
+}
@@ -2,32 +2,59 @@
 #include "common.h"
 #include "node.h"
 
+// Scope of names while parsing. A function context owns a fresh arena and
+// sees the globals of the program context that were declared before the
+// function; they are imported into its arena the first time they are used.
 class Context {
-    string m_func_name;
-    shared_ptr<vector<PNodeVar>> m_locals
-        = make_shared<vector<PNodeVar>>();
-    map<string, PNodeVar> m_var;
-    shared_ptr<map<string, PNodeVar>> m_var_global
-        = make_shared<map<string, PNodeVar>>();
-    shared_ptr<map<string, shared_ptr<const string>>> m_string_literal 
-        = make_shared<map<string, shared_ptr<const string>>>();
-    Context* m_parent_context;
+    Ast& m_ast;
+    shared_ptr<vector<VarId>> m_locals
+        = make_shared<vector<VarId>>();
+    map<string, VarId> m_var;
+    shared_ptr<map<string, VarId>> m_var_global
+        = make_shared<map<string, VarId>>();
+    shared_ptr<vector<pair<VarId, string>>> m_string_literal
+        = make_shared<vector<pair<VarId, string>>>();
+    Context* m_parent_context = nullptr;
+    const Context* m_outer = nullptr;
+    VarId m_visible = 0; // globals of m_outer with a smaller id are visible
 public:
-    Context() = default;
+    Context(Ast& ast) : m_ast(ast) {}
+    Context(Ast& ast, const Context& outer, VarId visible) :
+        m_ast(ast),
+        m_outer(&outer),
+        m_visible(visible)
+        {}
     Context(Context* parent_context) : 
-        m_func_name(parent_context->m_func_name),
+        m_ast(parent_context->m_ast),
         m_locals(parent_context->m_locals),
         m_var(),
         m_var_global(parent_context->m_var_global),
         m_string_literal(parent_context->m_string_literal),
-        m_parent_context(parent_context)
+        m_parent_context(parent_context),
+        m_outer(parent_context->m_outer),
+        m_visible(parent_context->m_visible)
         {}
 private:
-    PNodeVar global(const string& name) const{
+    VarId find_global(const string& name) const{
         auto it = m_var_global->find(name);
-        return it == m_var_global->end() ? nullptr : it->second;
+        return it == m_var_global->end() ? 0 : it->second;
+    }
+    VarId global(const string& name){
+        if (auto var = find_global(name)){
+            return var;
+        }
+        if (!m_outer){
+            return 0;
+        }
+        auto outer = m_outer->find_global(name);
+        if (outer == 0 || outer >= m_visible){
+            return 0;
+        }
+        auto var = m_ast.import_var(m_outer->m_ast, outer);
+        (*m_var_global)[name] = var;
+        return var;
     }
-    PNodeVar local(const string& name) const{
+    VarId local(const string& name) const{
         auto it = m_var.find(name);
         if (it != m_var.end()){
             return it->second;
@@ -35,140 +62,154 @@ private:
         if (m_parent_context){
             return m_parent_context->local(name);
         }
-        return nullptr;
+        return 0;
     }
 public:
-    const auto& locals() {return *m_locals;}
-    void add_locals(PNodeVar lvar) { 
-        for (auto l : *m_locals){
-            if (l == lvar){
-                throw;
-            }
-        }
-        m_locals->emplace_back(lvar);
+    // The global of this context named name if it was declared before
+    // visible, or 0.
+    VarId visible_global(const string& name, VarId visible) const{
+        auto var = find_global(name);
+        return var < visible ? var : 0;
     }
-    void reset_locals() { m_locals = make_shared<vector<PNodeVar>>();}
-    PNodeVar variable(const string& name, bool is_global) const{
+    Ast& ast() { return m_ast; }
+    const Ast& ast() const { return m_ast; }
+    const auto& locals() {return *m_locals;}
+    // lvar was just created, so it cannot be in the list already
+    void add_locals(VarId lvar) { m_locals->emplace_back(lvar); }
+    void reset_locals() { m_locals = make_shared<vector<VarId>>();}
+    VarId variable(const string& name, bool is_global){
         return is_global ? global(name) : local(name);
     }
-    PNodeVar variable(const string& name) const{
-        const auto& l = local(name);
+    VarId variable(const string& name){
+        auto l = local(name);
         return l ? l : global(name);
     }
-    void set_variable(bool is_global, PNodeVar type){
-        const string& name = type->name;
+    void set_variable(bool is_global, VarId var){
+        const string& name = m_ast.var(var).name;
         if (is_global){
-            (*m_var_global)[name] = type;
+            (*m_var_global)[name] = var;
         }
         else {
-            m_var[name] = type;
+            m_var[name] = var;
+            add_locals(var);
         }
-        add_locals(type);
-    }
-    void string_literal(const string& name, shared_ptr<const string> val){
-        m_string_literal->emplace(name, move(val));
     }
-    void set_func_name(optref<const string> func_name_in){
-        m_func_name = *func_name_in;
+    // String literals in order of appearance. They are named once the
+    // function they appear in is known.
+    void string_literal(VarId var, string val){
+        m_string_literal->emplace_back(var, move(val));
     }
-    const string& func_name() const{
-        return m_func_name;
-    }
-    const map<string, shared_ptr<const string>>& string_literal(){
+    vector<pair<VarId, string>>& string_literal(){
         return *m_string_literal;
     }
 };
 
-inline auto get_null_statement(Token token){
-    return make_unique<NodeNull>(token);
+inline NodeId get_null_statement(SourceLoc loc, Context& context){
+    return context.ast().null(loc);
 }
 
-inline bool is_kind(const vector<Token>& tokens, int pos, TokenKind kind){
-    if (pos >= tokens.size()){
-        verror_at(tokens.back(), to_string(pos) + " is out of range of tokens", true);
-    }
+inline bool is_kind(TokenStream& tokens, size_t pos, TokenKind kind){
     return tokens.at(pos).kind == kind;
 }
 
-inline void expect_kind(const vector<Token>& tokens, int pos, TokenKind kind){
+inline void expect_kind(TokenStream& tokens, size_t pos, TokenKind kind){
     if (!is_kind(tokens, pos, kind)){
-        verror_at(tokens.at(pos), "TokenKind " + to_string((int)kind) + " is expected", false);
+        tokens.error_at(tokens.at(pos), "TokenKind " + std::to_string((int)kind) + " is expected", false);
     }
 }
 
-inline bool is_punct(const vector<Token>& tokens, int pos, const string& op){
-    return is_kind(tokens, pos, TokenKind::Punct) && tokens.at(pos).punct == op;
+inline bool is_punct(TokenStream& tokens, size_t pos, Punct op){
+    return is_kind(tokens, pos, TokenKind::Punct) && tokens.at(pos).punct() == op;
 }
 
-inline void expect_punct(const vector<Token>& tokens, int pos, const string& op){
+inline void expect_punct(TokenStream& tokens, size_t pos, Punct op){
     if (!is_punct(tokens, pos, op)){
-        verror_at(tokens.at(pos), "'" + op + "' is expected");
+        tokens.error_at(tokens.at(pos), "'" + string(to_string(op)) + "' is expected");
     }
 }
 
-inline bool is_keyword(const vector<Token>& tokens, int pos, const string& keyword){
-    if (pos >= tokens.size()){
-        verror_at(tokens.back(), "'" + keyword + "' is expected", true);
-    }
-    return tokens.at(pos).kind == TokenKind::Keyword && tokens.at(pos).ident == keyword;
+inline bool is_keyword(TokenStream& tokens, size_t pos, Keyword keyword){
+    return tokens.at(pos).kind == TokenKind::Keyword && tokens.at(pos).id == static_cast<uint32_t>(keyword);
 }
 
-inline void expect_keyword(const vector<Token>& tokens, int pos, const string& keyword){
+inline void expect_keyword(TokenStream& tokens, size_t pos, Keyword keyword){
     if (!is_keyword(tokens, pos, keyword)){
-        verror_at(tokens.at(pos), "'" + keyword + "' is expected");
+        tokens.error_at(tokens.at(pos), "'" + string(keywords[static_cast<int>(keyword)]) + "' is expected");
     }
 }
 
 template<class ...T>
-using PosRet = tuple<T..., int>;
+using PosRet = tuple<T..., size_t>;
+
+using PaserType = function<PosRet<NodeId>(TokenStream& tokens, size_t start_pos, Context& context)>;
 
-using PaserType = function<PosRet<PITyped>(const vector<Token>& tokens, int start_pos, Context& context)>;
+PosRet<NodeId> parse_left_joint_binary_operator(TokenStream& tokens, size_t start_pos, initializer_list<Punct> operators, Context& context, PaserType next_perser);
 
-PosRet<PITyped> parse_left_joint_binary_operator(const vector<Token>& tokens, int start_pos, const set<string>& operators, Context& context, PaserType next_perser);
+PosRet<NodeId> parse_expr(TokenStream& tokens, size_t start_pos, Context& context);
 
-PosRet<PITyped> parse_expr(const vector<Token>& tokens, int start_pos, Context& context);
+PosRet<optional<Type>> try_parse_declspec(TokenStream& tokens, size_t pos);
 
-PosRet<optional<Type>> try_parse_declspec(const vector<Token>& tokens, int pos);
+PosRet<VarId, vector<VarId>>
+parse_declarator(TokenStream& tokens, size_t pos, Type type, bool is_global, Context& context);
 
-PosRet<PNodeVar, vector<PNodeVar>>
-parse_declarator(const vector<Token>& tokens, int pos, Type type, bool is_global, Context& context);
+PosRet<NodeId> parse_initializer(TokenStream& tokens, size_t pos, Type type, Context& context);
 
-PosRet<PINode> parse_initializer(const vector<Token>& tokens, int pos, Type type);
+PosRet<NodeId> try_parse_declaration(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PINode> try_parse_declaration(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_primary(TokenStream& tokens, size_t start_pos, Context& context);
 
-PosRet<PITyped> parse_primary(const vector<Token>& tokens, int start_pos, Context& context);
+PosRet<NodeId> parse_unary(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PITyped> parse_unary(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_mul(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PITyped> parse_mul(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_add(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PITyped> parse_add(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_relational(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PITyped> parse_relational(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_equality(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PITyped> parse_equality(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_assign(TokenStream& tokens, size_t start_pos, Context& context);
 
-PosRet<PITyped> parse_assign(const vector<Token>& tokens, int start_pos, Context& context);
+PosRet<NodeId> parse_expr(TokenStream& tokens, size_t start_pos, Context& context);
 
-PosRet<PITyped> parse_expr(const vector<Token>& tokens, int start_pos, Context& context);
+PosRet<NodeId> parse_statement(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PINode> parse_statement(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_compound_statement(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<unique_ptr<NodeCompoundStatement>> parse_compound_statement(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_statement_return(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PINode> parse_statement_return(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_expr_statement(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PINode> parse_expr_statement(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_statement_for(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PINode> parse_statement_for(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_statement_while(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PINode> parse_statement_while(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_statement_if(TokenStream& tokens, size_t pos, Context& context);
 
-PosRet<PINode> parse_statement_if(const vector<Token>& tokens, int pos, Context& context);
+PosRet<NodeId> parse_statement(TokenStream& tokens, size_t pos, Context& context);
+
+// A function body found by the pre-pass, to be parsed on its own.
+struct FuncJob {
+    size_t pos;       // the "{" of the body
+    SourceLoc loc;
+    VarId func;
+    vector<VarId> params;
+    VarId visible;    // globals declared before the body
+    SourceLoc start;  // the first token of the definition
+    SourceLoc end;    // just after the "}" of the body
+};
+
+// Result of the pre-pass over a translation unit: the program with its
+// globals and function signatures, and the function bodies still to parse.
+struct ProgramOutline {
+    unique_ptr<NodeProgram> program;
+    unique_ptr<Context> context;
+    vector<FuncJob> funcs;
+    size_t pos;
+};
 
-PosRet<PINode> parse_statement(const vector<Token>& tokens, int pos, Context& context);
+ProgramOutline parse_outline(TokenStream& tokens, size_t pos);
 
-PosRet<PINode> parse_func_def(const vector<Token>& tokens, int pos);
+NodeFuncDef parse_func_job(const TokenStream& tokens, const ProgramOutline& outline, size_t index);
 
-PosRet<PINode> parse_program(const vector<Token>& tokens, int pos);
+PosRet<unique_ptr<NodeProgram>> parse_program(TokenStream& tokens, size_t pos, const function<void(NodeFuncDef)>& emit);
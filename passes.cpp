@@ -0,0 +1,367 @@
+#include "passes.h"
+
+// Rewrites every use of a register r to alias[r] when that is set. Aliases
+// are recorded already resolved, so one lookup is enough.
+static void apply_aliases(IrFunc& func, const vector<Reg>& alias){
+    for (auto& block : func.blocks){
+        for (auto& inst : block.insts){
+            for_each_use(func, inst, [&](Reg& r){
+                if (alias[r]){
+                    r = alias[r];
+                }
+            });
+        }
+    }
+}
+
+static void successors(const Inst& term, auto&& f){
+    if (term.op == Op::Jmp){
+        f(term.t);
+    }
+    else if (term.op == Op::Br){
+        f(term.t);
+        f(term.f);
+    }
+}
+
+static vector<bool> reachable(const IrFunc& func){
+    vector<bool> seen(func.blocks.size());
+    vector<BlockId> stack = {0};
+    seen[0] = true;
+    while (!stack.empty()){
+        auto id = stack.back();
+        stack.pop_back();
+        successors(func.blocks[id].insts.back(), [&](BlockId next){
+            if (!seen[next]){
+                seen[next] = true;
+                stack.push_back(next);
+            }
+        });
+    }
+    return seen;
+}
+
+// Evaluates binary instructions, extensions and branches whose operands
+// are constants, and forwards the other operand of x + 0, x - 0, x * 1 and x / 1.
+static void fold(IrFunc& func){
+    vector<optional<int64_t>> value(func.reg_count);
+    vector<Reg> alias(func.reg_count);
+    auto resolve = [&](Reg r){ return alias[r] ? alias[r] : r; };
+    for (auto& block : func.blocks){
+        for (auto& inst : block.insts){
+            for_each_use(func, inst, [&](Reg& r){ r = resolve(r); });
+            if (inst.op == Op::Imm){
+                value[inst.dst] = inst.imm;
+            }
+            else if (inst.op == Op::Extend && value[inst.a]){
+                auto result = extend(inst.type, *value[inst.a]);
+                inst = {Op::Imm, IrType::I64, inst.dst, 0, 0, result};
+                value[inst.dst] = result;
+            }
+            else if (inst.op == Op::Br && value[inst.a]){
+                inst = {Op::Jmp, IrType::I64, 0, 0, 0, 0, *value[inst.a] ? inst.t : inst.f};
+            }
+            else if (is_binary(inst.op) && value[inst.a] && value[inst.b]){
+                // wrap around like the 64-bit machine instructions
+                auto a = static_cast<uint64_t>(*value[inst.a]);
+                auto b = static_cast<uint64_t>(*value[inst.b]);
+                auto sa = *value[inst.a], sb = *value[inst.b];
+                optional<int64_t> result;
+                switch (inst.op){
+                case Op::Add: result = a + b; break;
+                case Op::Sub: result = a - b; break;
+                case Op::Mul: result = a * b; break;
+                case Op::Div:
+                    if (sb != 0 && !(sa == INT64_MIN && sb == -1)){
+                        result = sa / sb;
+                    }
+                    break;
+                case Op::Eq: result = sa == sb; break;
+                case Op::Ne: result = sa != sb; break;
+                case Op::Lt: result = sa < sb; break;
+                case Op::Le: result = sa <= sb; break;
+                default: break;
+                }
+                if (result){
+                    inst = {Op::Imm, IrType::I64, inst.dst, 0, 0, *result};
+                    value[inst.dst] = result;
+                }
+            }
+            else if (is_binary(inst.op)){
+                auto is = [&](Reg r, int64_t v){ return value[r] && *value[r] == v; };
+                Reg same = 0;
+                if ((inst.op == Op::Add || inst.op == Op::Sub) && is(inst.b, 0)){
+                    same = inst.a;
+                }
+                else if (inst.op == Op::Add && is(inst.a, 0)){
+                    same = inst.b;
+                }
+                else if ((inst.op == Op::Mul || inst.op == Op::Div) && is(inst.b, 1)){
+                    same = inst.a;
+                }
+                else if (inst.op == Op::Mul && is(inst.a, 1)){
+                    same = inst.b;
+                }
+                if (same){
+                    alias[inst.dst] = same;
+                    value[inst.dst] = value[same];
+                }
+            }
+        }
+    }
+    apply_aliases(func, alias);
+}
+
+// Within a block, a load of a local that was just stored or loaded with the
+// same width reuses that value. A narrower store is only remembered when
+// the value is known to fit, since otherwise the load would truncate, and
+// an extension of a value known to fit is dropped. Calls and stores through
+// other pointers may write any local whose address was taken, so they
+// forget everything.
+static void forward(IrFunc& func){
+    constexpr int64_t unknown = -1;
+    vector<int64_t> slot(func.reg_count, unknown);
+    // bytes that hold the value of a register, sign extended to 64 bits
+    vector<int> width(func.reg_count, 8);
+    for (auto& block : func.blocks){
+        for (auto& inst : block.insts){
+            if (inst.op == Op::LocalAddr){
+                slot[inst.dst] = inst.imm;
+            }
+            else if (inst.op == Op::Load || inst.op == Op::Extend){
+                width[inst.dst] = size_of(inst.type);
+            }
+            else if (inst.op == Op::Imm){
+                width[inst.dst] = inst.imm == static_cast<int8_t>(inst.imm) ? 1
+                    : inst.imm == static_cast<int16_t>(inst.imm) ? 2
+                    : inst.imm == static_cast<int32_t>(inst.imm) ? 4 : 8;
+            }
+            else if (Op::Eq <= inst.op && inst.op <= Op::Le){
+                width[inst.dst] = 1;
+            }
+        }
+    }
+    vector<Reg> alias(func.reg_count);
+    auto resolve = [&](Reg r){ return alias[r] ? alias[r] : r; };
+    struct Known {
+        int64_t offset;     // the slot spans [-offset, -offset + size) from the frame base
+        int size;
+        Reg value;
+    };
+    vector<Known> known;
+    for (auto& block : func.blocks){
+        known.clear();
+        for (auto& inst : block.insts){
+            if (inst.op == Op::Call){
+                known.clear();
+            }
+            else if (inst.op == Op::Extend && width[resolve(inst.a)] <= size_of(inst.type)){
+                alias[inst.dst] = resolve(inst.a);
+            }
+            else if (inst.op == Op::Store){
+                auto offset = slot[inst.a];
+                if (offset == unknown){
+                    known.clear();
+                    continue;
+                }
+                auto size = size_of(inst.type);
+                erase_if(known, [&](auto& entry){
+                    return -offset < -entry.offset + entry.size && -entry.offset < -offset + size;
+                });
+                auto value = resolve(inst.b);
+                if (width[value] <= size){
+                    known.push_back({offset, size, value});
+                }
+            }
+            else if (inst.op == Op::Load && slot[inst.a] != unknown){
+                auto offset = slot[inst.a];
+                auto size = size_of(inst.type);
+                auto it = find_if(known.begin(), known.end(), [&](auto& entry){ return entry.offset == offset && entry.size == size; });
+                if (it != known.end()){
+                    alias[inst.dst] = it->value;
+                }
+                else {
+                    known.push_back({offset, size, inst.dst});
+                }
+            }
+        }
+    }
+    apply_aliases(func, alias);
+}
+
+static bool is_pure(Op op){
+    return op == Op::Imm || op == Op::LocalAddr || op == Op::GlobalAddr
+        || op == Op::Param || op == Op::Load || op == Op::Extend || is_binary(op);
+}
+
+// Removes instructions without side effects whose result is never used,
+// then renumbers the remaining registers densely so that the frame shrinks.
+static void dce(IrFunc& func){
+    vector<uint32_t> uses(func.reg_count);
+    for (auto& block : func.blocks){
+        for (auto& inst : block.insts){
+            for_each_use(func, inst, [&](Reg r){ ++uses[r]; });
+        }
+    }
+    vector<bool> dead(func.reg_count);
+    for (bool changed = true; changed;){
+        changed = false;
+        for (auto block = func.blocks.rbegin(); block != func.blocks.rend(); ++block){
+            for (auto inst = block->insts.rbegin(); inst != block->insts.rend(); ++inst){
+                if (inst->dst && !dead[inst->dst] && !uses[inst->dst] && is_pure(inst->op)){
+                    dead[inst->dst] = true;
+                    for_each_use(func, *inst, [&](Reg r){ --uses[r]; });
+                    changed = true;
+                }
+            }
+        }
+    }
+    vector<Reg> renumber(func.reg_count);
+    Reg next = 1;
+    for (auto& block : func.blocks){
+        erase_if(block.insts, [&](const Inst& inst){ return inst.dst && dead[inst.dst]; });
+        for (auto& inst : block.insts){
+            if (inst.dst){
+                renumber[inst.dst] = next++;
+            }
+        }
+    }
+    for (auto& block : func.blocks){
+        for (auto& inst : block.insts){
+            inst.dst = renumber[inst.dst];
+            for_each_use(func, inst, [&](Reg& r){ r = renumber[r]; });
+        }
+    }
+    func.reg_count = next;
+}
+
+// Appends a block to its only predecessor when that ends in a jump to it,
+// and drops unreachable blocks. Blocks keep their relative order so that
+// fallthrough in the emitted code is preserved.
+static void simplify_cfg(IrFunc& func){
+    auto& blocks = func.blocks;
+    auto live = reachable(func);
+    vector<uint32_t> preds(blocks.size());
+    for (BlockId id = 0; id < blocks.size(); ++id){
+        if (live[id]){
+            successors(blocks[id].insts.back(), [&](BlockId next){ ++preds[next]; });
+        }
+    }
+    for (BlockId id = 0; id < blocks.size(); ++id){
+        while (live[id] && blocks[id].insts.back().op == Op::Jmp){
+            auto next = blocks[id].insts.back().t;
+            if (next == id || next == 0 || preds[next] != 1){
+                break;
+            }
+            auto& insts = blocks[id].insts;
+            insts.pop_back();
+            insts.insert(insts.end(), blocks[next].insts.begin(), blocks[next].insts.end());
+            blocks[next].insts.clear();
+            live[next] = false;
+        }
+    }
+    vector<BlockId> renumber(blocks.size());
+    BlockId count = 0;
+    for (BlockId id = 0; id < blocks.size(); ++id){
+        if (live[id]){
+            renumber[id] = count;
+            if (count != id){
+                blocks[count] = move(blocks[id]);
+            }
+            ++count;
+        }
+    }
+    blocks.resize(count);
+    for (auto& block : blocks){
+        auto& term = block.insts.back();
+        term.t = renumber[term.t];
+        term.f = renumber[term.f];
+    }
+}
+
+static constexpr Pass passes[] = {
+    {"simplify-cfg", "merge straight-line blocks and drop unreachable ones", simplify_cfg},
+    {"forward", "reuse values stored to or loaded from locals within a block", forward},
+    {"fold", "evaluate constant expressions and branches", fold},
+    {"dce", "remove unused computations", dce},
+};
+
+span<const Pass> all_passes(){
+    return passes;
+}
+
+static const Pass& find_pass(string_view name){
+    for (auto& pass : passes){
+        if (pass.name == name){
+            return pass;
+        }
+    }
+    throw invalid_argument("unknown pass: " + string(name));
+}
+
+PassPipeline::PassPipeline(vector<const Pass*> passes)
+    : m_passes(move(passes)),
+      m_nanos(make_unique<atomic<uint64_t>[]>(m_passes.size())),
+      m_runs(make_unique<atomic<uint64_t>[]>(m_passes.size())){}
+
+PassPipeline PassPipeline::for_level(int level){
+    vector<const Pass*> list;
+    if (level >= 2){
+        list = {&find_pass("simplify-cfg"), &find_pass("forward")};
+    }
+    if (level >= 1){
+        for (auto name : {"fold", "dce", "simplify-cfg"}){
+            list.push_back(&find_pass(name));
+        }
+    }
+    return PassPipeline(move(list));
+}
+
+PassPipeline PassPipeline::parse(string_view list){
+    vector<const Pass*> result;
+    while (!list.empty()){
+        auto comma = list.find(',');
+        auto name = list.substr(0, comma);
+        if (!name.empty()){
+            result.push_back(&find_pass(name));
+        }
+        list = comma == string_view::npos ? "" : list.substr(comma + 1);
+    }
+    return PassPipeline(move(result));
+}
+
+void PassPipeline::run(IrFunc& func) const{
+    for (size_t i = 0; i < m_passes.size(); ++i){
+        auto start = chrono::steady_clock::now();
+        m_passes[i]->run(func);
+        auto elapsed = chrono::steady_clock::now() - start;
+        m_nanos[i].fetch_add(chrono::duration_cast<chrono::nanoseconds>(elapsed).count(), memory_order_relaxed);
+        m_runs[i].fetch_add(1, memory_order_relaxed);
+#ifndef NDEBUG
+        string error;
+        if (!verify(func, &error)){
+            throw logic_error("invalid IR after " + string(m_passes[i]->name) + ": " + error);
+        }
+#endif
+    }
+}
+
+void PassPipeline::merge(const PassPipeline& other){
+    for (size_t i = 0; i < m_passes.size() && i < other.m_passes.size(); ++i){
+        m_nanos[i] += other.m_nanos[i].load();
+        m_runs[i] += other.m_runs[i].load();
+    }
+}
+
+void PassPipeline::report(ostream& out) const{
+    out << "pass            time(ms)  functions\n";
+    uint64_t total = 0;
+    for (size_t i = 0; i < m_passes.size(); ++i){
+        auto nanos = m_nanos[i].load();
+        total += nanos;
+        out << left << setw(16) << m_passes[i]->name
+            << right << setw(8) << fixed << setprecision(3) << nanos / 1e6
+            << setw(11) << m_runs[i].load() << '\n';
+    }
+    out << left << setw(16) << "total" << right << setw(8) << total / 1e6 << '\n';
+}
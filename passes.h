@@ -0,0 +1,38 @@
+#pragma once
+#include "common.h"
+#include "ir.h"
+
+// Transformations of IrFunc, run one function at a time in a fixed order.
+
+struct Pass {
+    string_view name;
+    string_view description;
+    void (*run)(IrFunc& func);
+};
+
+// Every pass, in the order they are listed by --help.
+span<const Pass> all_passes();
+
+// An ordered list of passes shared by all code generation threads. The
+// time spent in each entry is accumulated across threads.
+class PassPipeline {
+    vector<const Pass*> m_passes;
+    unique_ptr<atomic<uint64_t>[]> m_nanos;
+    unique_ptr<atomic<uint64_t>[]> m_runs;
+
+    explicit PassPipeline(vector<const Pass*> passes);
+public:
+    // Presets: 0 runs nothing, 1 folds constants and drops dead code, 2 also
+    // forwards stores of locals to their loads.
+    static PassPipeline for_level(int level);
+    // A comma separated list of pass names. Throws invalid_argument on an
+    // unknown name.
+    static PassPipeline parse(string_view list);
+
+    bool empty() const { return m_passes.empty(); }
+    void run(IrFunc& func) const;
+    // Adds the times of a pipeline with the same passes to this one.
+    void merge(const PassPipeline& other);
+    // Writes the accumulated time of every entry.
+    void report(ostream& out) const;
+};
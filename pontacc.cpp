@@ -0,0 +1,239 @@
+#include "pontacc.h"
+#include "parser.h"
+#include "spsc_queue.h"
+#include "tokenizer.h"
+
+// The lexer, the parser and the code generator each run on a thread of
+// their own. Tokens and finished functions are handed over through queues,
+// and the data sections are written after the functions.
+static void compile_pipelined(string_view text, ostream& out, const CodegenOptions& options, Stats& session_stats){
+    TokenStream tokens(text, true);
+    SpscQueue<unique_ptr<NodeFuncDef>, 64> funcs;
+    exception_ptr codegen_error;
+    thread codegen([&]{
+        StatsScope scope(session_stats);
+        while (auto func = funcs.pop()){
+            // after an error keep taking functions so that the parser is not blocked
+            if (codegen_error){
+                continue;
+            }
+            try {
+                generate_func(*func, out, options);
+            }
+            catch (...){
+                codegen_error = current_exception();
+            }
+        }
+    });
+    PosRet<unique_ptr<NodeProgram>> parsed;
+    try {
+        Phase phase("parse");
+        parsed = parse_program(tokens, 0, [&](NodeFuncDef func){
+            funcs.push(make_unique<NodeFuncDef>(move(func)));
+        });
+    }
+    catch (...){
+        funcs.push(nullptr);
+        codegen.join();
+        throw;
+    }
+    funcs.push(nullptr);
+    codegen.join();
+    if (codegen_error){
+        rethrow_exception(codegen_error);
+    }
+    auto& [node, pos] = parsed;
+    if (!is_kind(tokens, pos, TokenKind::Eof)) {
+        tokens.error_at(tokens.at(pos), "Not parsed");
+    }
+    stats().add(Counter::Tokens, tokens.lexed());
+    if (!options.dump_ir){
+        Phase phase("data");
+        generate_data(*node, out, options);
+    }
+}
+
+// The output of a function depends on the text of its definition and on
+// the types of the globals it refers to; labels and string literals are
+// named after the function, so its position in the file does not matter.
+static string function_key(string_view prefix, const TokenStream& tokens, const ProgramOutline& outline, const FuncJob& job){
+    Hasher hasher;
+    hasher.add(prefix).add("function").add(tokens.source().substr(job.start, job.end - job.start));
+    TokenStream cursor(tokens, job.pos, job.loc);
+    vector<VarId> globals;
+    for (auto pos = job.pos; cursor.at(pos).loc < job.end; ++pos){
+        auto& token = cursor.at(pos);
+        if (token.kind == TokenKind::Ident){
+            if (auto var = outline.context->visible_global(cursor.ident(token), job.visible)){
+                globals.push_back(var);
+            }
+        }
+    }
+    sort(globals.begin(), globals.end());
+    globals.erase(unique(globals.begin(), globals.end()), globals.end());
+    auto& ast = outline.program->ast;
+    for (auto var : globals){
+        hasher.add(ast.var(var).name).add(signature(ast.type(ast.var(var).type)));
+    }
+    return hasher.hex();
+}
+
+// A pre-pass outlines the program and writes the globals. Function bodies
+// are then parsed and generated by the pool a batch at a time, written out
+// in source order and released, so memory is bounded by a batch of
+// functions rather than by the whole program. With a cache, functions whose
+// key is found are not parsed at all.
+static void compile_parallel(string_view text, ostream& out, ThreadPool& pool, const CodegenOptions& options, Stats& session_stats,
+        const CompileCache* cache, string_view cache_key){
+    TokenStream tokens(text);
+    auto outline = [&]{
+        Phase phase("outline");
+        return parse_outline(tokens, 0);
+    }();
+    if (!is_kind(tokens, outline.pos, TokenKind::Eof)) {
+        tokens.error_at(tokens.at(outline.pos), "Not parsed");
+    }
+    stats().add(Counter::Tokens, tokens.lexed());
+    if (!options.dump_ir){
+        Phase phase("data");
+        generate_data(*outline.program, out, options);
+    }
+    auto& funcs = outline.funcs;
+    vector<ostringstream> buffers(pool.size() * 16);
+    for (size_t start = 0; start < funcs.size(); start += buffers.size()){
+        auto count = min(buffers.size(), funcs.size() - start);
+        // without a cache the first function of a batch goes straight to the output
+        pool.run(count, [&](size_t i){
+            StatsScope scope(session_stats);
+            buffers[i].str("");
+            if (!cache){
+                generate_func(parse_func_job(tokens, outline, start + i), i == 0 ? out : buffers[i], options);
+                return;
+            }
+            auto key = function_key(cache_key, tokens, outline, outline.funcs[start + i]);
+            if (auto text = cache->get(key)){
+                stats().add(Counter::CacheHits, 1);
+                buffers[i] << *text;
+                return;
+            }
+            stats().add(Counter::CacheMisses, 1);
+            generate_func(parse_func_job(tokens, outline, start + i), buffers[i], options);
+            cache->put(key, buffers[i].view());
+        });
+        Phase phase("write");
+        for (size_t i = cache ? 0 : 1; i < count; ++i){
+            out << buffers[i].view();
+        }
+    }
+}
+
+Session::Session(CompileOptions options):
+    m_options(move(options)),
+    m_passes(m_options.passes ? PassPipeline::parse(*m_options.passes) : PassPipeline::for_level(m_options.level)),
+    m_pool(max<size_t>(1, m_options.threads))
+{
+    if (m_options.stats || m_options.trace){
+        m_stats.enable(m_options.trace);
+    }
+    if (m_options.cache_functions && m_options.cache_dir.empty()){
+        throw invalid_argument("caching functions needs a cache directory");
+    }
+    if (!m_options.cache_dir.empty()){
+        m_cache.emplace(m_options.cache_dir);
+        // the number of threads does not change the output
+        m_cache_key = Hasher().add(compiler_version()).add(m_options.passes ? "passes=" + *m_options.passes : "O" + to_string(m_options.level))
+            .add(to_string(m_options.pipeline) + to_string(m_options.emit_ir) + to_string(m_options.object)).hex();
+    }
+}
+
+void Session::compile_uncached(string_view source, ostream& out){
+    CodegenOptions options{m_passes.empty() ? nullptr : &m_passes, m_options.emit_ir, m_options.object};
+    if (m_options.pipeline){
+        compile_pipelined(source, out, options, m_stats);
+    }
+    else {
+        // the pipelined mode does not outline the program, so it caches whole files only
+        auto functions = m_options.cache_functions ? &*m_cache : nullptr;
+        compile_parallel(source, out, m_pool, options, m_stats, functions, m_cache_key);
+    }
+}
+
+// A whole file is looked up first; on a miss its functions may still be
+// found one by one.
+void Session::compile_cached(string_view source, ostream& out){
+    if (!m_cache){
+        compile_uncached(source, out);
+        return;
+    }
+    auto key = Hasher().add(m_cache_key).add("file").add(source).hex();
+    if (auto text = m_cache->get(key)){
+        stats().add(Counter::CacheHits, 1);
+        out << *text;
+        return;
+    }
+    stats().add(Counter::CacheMisses, 1);
+    ostringstream buffer;
+    compile_uncached(source, buffer);
+    m_cache->put(key, buffer.view());
+    out << buffer.view();
+}
+
+// An object is put together from the records of the whole file, which
+// are what the cache keeps.
+ObjectImage Session::compile_object(string_view source){
+    StatsScope scope(m_stats);
+    ostringstream records;
+    compile_cached(source, records);
+    Phase phase("object");
+    return read_records(records.view());
+}
+
+void Session::compile(string_view source, ostream& out){
+    StatsScope scope(m_stats);
+    if (!m_options.object){
+        compile_cached(source, out);
+        return;
+    }
+    auto image = compile_object(source);
+    Phase phase("object");
+    write_elf(image, out);
+}
+
+IrProgram Session::compile_ir(string_view source){
+    StatsScope scope(m_stats);
+    IrProgram program;
+    TokenStream tokens(source);
+    auto [node, pos] = [&]{
+        Phase phase("parse");
+        return parse_program(tokens, 0, [&](NodeFuncDef func){
+            Phase phase("lower");
+            phase.detail(func.m_name);
+            program.funcs.push_back(lower_func(func));
+            if (!m_passes.empty()){
+                m_passes.run(program.funcs.back());
+            }
+            for (const auto& [var, text] : func.m_string_literals){
+                program.strings.emplace_back(func.ast->var(var).name, unescape_string(text) + '\0');
+            }
+        });
+    }();
+    if (!is_kind(tokens, pos, TokenKind::Eof)) {
+        tokens.error_at(tokens.at(pos), "Not parsed");
+    }
+    for (auto global : node->m_globals){
+        auto& var = node->ast.var(global);
+        program.globals.emplace_back(var.name, size_of(node->ast.type(var.type)));
+    }
+    return program;
+}
+
+CompileResult Session::compile(string_view source){
+    ostringstream out;
+    try {
+        compile(source, out);
+    }
+    catch (const CompileError& e){
+        return {"", e.diagnostic()};
+    }
+    return {move(out).str(), nullopt};
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "common.h"
+#include "cache.h"
+#include "interpreter.h"
+#include "object.h"
+#include "passes.h"
+#include "stats.h"
+#include "thread_pool.h"
+
+// Library interface of the compiler, built as libpontacc.a. A Session
+// turns C source into assembly; sessions share no mutable state, so any
+// number of them can compile concurrently on different threads.
+
+struct CompileOptions {
+    int level = 0;                // optimization level, 0 to 2
+    optional<string> passes;      // comma separated pass list overriding level
+    size_t threads = 1;           // threads parsing and generating functions
+    bool pipeline = false;        // lex, parse and generate on threads of their own
+    bool emit_ir = false;         // write the IR instead of assembly
+    bool object = false;          // write an ELF relocatable object instead of assembly
+    bool stats = false;           // collect the statistics of stats()
+    bool trace = false;           // also keep every phase occurrence for a trace
+    string cache_dir;             // reuse outputs stored in this directory, if set
+    bool cache_functions = false; // on a miss, also reuse the unchanged functions
+};
+
+struct CompileResult {
+    string assembly;              // or the object
+    optional<Diagnostic> error;
+
+    bool ok() const { return !error; }
+};
+
+// One compiler instance. Its thread pool and statistics live as long as the
+// session and are reused by every compile. A session itself is used by one
+// thread at a time.
+class Session {
+    CompileOptions m_options;
+    PassPipeline m_passes;
+    ThreadPool m_pool;
+    Stats m_stats;
+    optional<CompileCache> m_cache;
+    string m_cache_key; // the compiler and the options that change the output
+
+    void compile_uncached(string_view source, ostream& out);
+    void compile_cached(string_view source, ostream& out);
+public:
+    // Throws invalid_argument on an unknown pass, or on cache_functions
+    // without a cache_dir.
+    explicit Session(CompileOptions options = {});
+    Session(const Session&) = delete;
+
+    // Writes the assembly of source to out as it is generated, unless it
+    // comes from the cache; an object is written once complete. Throws
+    // CompileError on the first error in the source.
+    void compile(string_view source, ostream& out);
+    // Returns the assembly, or the diagnostic of the first error.
+    CompileResult compile(string_view source);
+    // The object of source, to be loaded into memory. Needs object set in
+    // the options.
+    ObjectImage compile_object(string_view source);
+    // Every function of source as IR after the passes, for the
+    // interpreter. The cache is not used.
+    IrProgram compile_ir(string_view source);
+
+    const PassPipeline& passes() const { return m_passes; }
+    PassPipeline& passes() { return m_passes; }
+    Stats& stats() { return m_stats; }
+};
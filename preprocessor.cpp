@@ -0,0 +1,969 @@
+#include "preprocessor.h"
+#include <sys/stat.h>
+
+enum class PpKind : uint8_t { Ident, Number, String, Punct };
+
+// A preprocessing token. The text points into the file it was read from,
+// or into strings owned by the preprocessor for pasted and stringified
+// tokens.
+struct PpToken {
+    PpKind kind = PpKind::Punct;
+    string_view text;
+    bool space = false;     // preceded by white space
+    uint32_t line = 0;      // line of the file the token is on
+};
+
+// A line of a file with the lines joined to it by a backslash or a
+// comment.
+struct PpLine {
+    uint32_t line;          // first line, counting from 1
+    uint32_t count = 1;     // lines it spans
+    bool directive = false;
+    vector<PpToken> tokens; // without the # of a directive
+};
+
+// A file split into lines of tokens.
+struct Header {
+    string text;
+    vector<PpLine> lines;
+    string guard;           // macro of its include guard, if it has one
+    bool once = false;      // has #pragma once
+    int64_t mtime = 0;
+    int64_t size = 0;
+};
+
+static constexpr string_view puncts[] = {
+    "...", "<<=", ">>=",
+    "==", "!=", "<=", ">=", "->", "++", "--", "&&", "||", "<<", ">>",
+    "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "##",
+};
+
+static bool is_ident_start(char c){
+    return isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+static bool is_ident_char(char c){
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+[[noreturn]] static void error_in(string_view file_text, const char* at, const string& file, string_view message){
+    size_t offset = at ? at - file_text.data() : 0;
+    auto start = file_text.rfind('\n', offset == 0 ? 0 : offset - 1);
+    start = start == string_view::npos || offset == 0 ? 0 : start + 1;
+    auto end = file_text.find('\n', offset);
+    auto line = count(file_text.begin(), file_text.begin() + start, '\n');
+    Diagnostic diagnostic{static_cast<size_t>(line) + 1, offset - start + 1, string(message),
+        string(file_text.substr(start, end == string_view::npos ? string_view::npos : end - start))};
+    diagnostic.file = file;
+    throw CompileError(move(diagnostic));
+}
+
+// Splits text into lines of tokens. Comments become white space.
+static vector<PpLine> lex_lines(string_view text, const string& file){
+    vector<PpLine> lines;
+    uint32_t line = 1;
+    PpLine current{line, 1, false, {}};
+    bool space = false;
+    bool at_start = true;
+    auto finish = [&]{
+        current.count = line - current.line + 1;
+        lines.push_back(move(current));
+        current = PpLine{++line, 1, false, {}};
+        space = false;
+        at_start = true;
+    };
+    size_t p = 0;
+    while (p < text.size()){
+        auto c = text[p];
+        if (c == '\n'){
+            ++p;
+            finish();
+            continue;
+        }
+        if (c == '\\' && p + 1 < text.size() && text[p + 1] == '\n'){
+            p += 2;
+            ++line;
+            continue;
+        }
+        if (isspace(static_cast<unsigned char>(c))){
+            ++p;
+            space = true;
+            continue;
+        }
+        if (text.substr(p, 2) == "//"){
+            p = min(text.find('\n', p), text.size());
+            continue;
+        }
+        if (text.substr(p, 2) == "/*"){
+            auto end = text.find("*/", p + 2);
+            if (end == string_view::npos){
+                error_in(text, text.data() + p, file, "unterminated comment");
+            }
+            line += count(text.begin() + p, text.begin() + end, '\n');
+            p = end + 2;
+            space = true;
+            continue;
+        }
+        if (at_start && c == '#'){
+            ++p;
+            current.directive = true;
+            at_start = false;
+            space = false;
+            continue;
+        }
+        at_start = false;
+        auto start = p;
+        PpKind kind;
+        if (is_ident_start(c)){
+            kind = PpKind::Ident;
+            while (p < text.size() && is_ident_char(text[p])){
+                ++p;
+            }
+        }
+        else if (isdigit(static_cast<unsigned char>(c)) || (c == '.' && p + 1 < text.size() && isdigit(static_cast<unsigned char>(text[p + 1])))){
+            kind = PpKind::Number;
+            ++p;
+            while (p < text.size()){
+                if (strchr("eEpP", text[p]) && p + 1 < text.size() && (text[p + 1] == '+' || text[p + 1] == '-')){
+                    p += 2;
+                }
+                else if (is_ident_char(text[p]) || text[p] == '.'){
+                    ++p;
+                }
+                else {
+                    break;
+                }
+            }
+        }
+        else if (c == '"' || c == '\''){
+            kind = PpKind::String;
+            ++p;
+            while (p < text.size() && text[p] != c && text[p] != '\n'){
+                p += text[p] == '\\' ? 2 : 1;
+            }
+            if (p >= text.size() || text[p] != c){
+                error_in(text, text.data() + start, file, "unterminated literal");
+            }
+            ++p;
+        }
+        else {
+            kind = PpKind::Punct;
+            auto it = find_if(begin(puncts), end(puncts), [&](string_view punct){ return text.substr(p).starts_with(punct); });
+            p += it == end(puncts) ? 1 : it->size();
+        }
+        current.tokens.push_back({kind, text.substr(start, p - start), space, line});
+        space = false;
+    }
+    if (!current.tokens.empty() || current.directive){
+        current.count = line - current.line + 1;
+        lines.push_back(move(current));
+    }
+    return lines;
+}
+
+static bool is(const PpToken& token, string_view text){
+    return token.kind != PpKind::String && token.text == text;
+}
+
+// An include guard is an #ifndef or #if !defined of a macro around the
+// whole file, whose first line defines that macro.
+static string find_guard(const vector<PpLine>& lines){
+    auto first = find_if(lines.begin(), lines.end(), [](auto& line){ return !line.tokens.empty() || line.directive; });
+    if (first == lines.end() || !first->directive || first->tokens.empty()){
+        return "";
+    }
+    auto& t = first->tokens;
+    string_view name;
+    if (t.size() == 2 && is(t[0], "ifndef") && t[1].kind == PpKind::Ident){
+        name = t[1].text;
+    }
+    else if (t.size() == 4 && is(t[0], "if") && is(t[1], "!") && is(t[2], "defined") && t[3].kind == PpKind::Ident){
+        name = t[3].text;
+    }
+    else if (t.size() == 6 && is(t[0], "if") && is(t[1], "!") && is(t[2], "defined") && is(t[3], "(") && is(t[5], ")")){
+        name = t[4].text;
+    }
+    else {
+        return "";
+    }
+    auto next = find_if(first + 1, lines.end(), [](auto& line){ return !line.tokens.empty() || line.directive; });
+    if (next == lines.end() || !next->directive || next->tokens.size() < 2 || !is(next->tokens[0], "define") || next->tokens[1].text != name){
+        return "";
+    }
+    // the #endif of the first line must be the last line
+    int depth = 0;
+    for (auto line = first; line != lines.end(); ++line){
+        if (!line->directive || line->tokens.empty()){
+            if (depth == 0 && !line->tokens.empty()){
+                return "";
+            }
+            continue;
+        }
+        auto& directive = line->tokens[0].text;
+        if (directive == "if" || directive == "ifdef" || directive == "ifndef"){
+            ++depth;
+        }
+        else if ((directive == "else" || directive == "elif") && depth == 1){
+            return "";
+        }
+        else if (directive == "endif" && --depth == 0){
+            auto rest = find_if(line + 1, lines.end(), [](auto& line){ return !line.tokens.empty() || line.directive; });
+            return rest == lines.end() ? string(name) : "";
+        }
+    }
+    return "";
+}
+
+static bool stat_file(const string& path, int64_t& mtime, int64_t& size){
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)){
+        return false;
+    }
+    mtime = st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+    size = st.st_size;
+    return true;
+}
+
+// Headers of every preprocessor run in the process, by path.
+class HeaderCache {
+    mutex m_mutex;
+    map<string, shared_ptr<const Header>> m_headers;
+public:
+    // The header at path, or nullptr if there is no such file.
+    shared_ptr<const Header> get(const string& path){
+        int64_t mtime, size;
+        if (!stat_file(path, mtime, size)){
+            return nullptr;
+        }
+        {
+            lock_guard lock(m_mutex);
+            auto it = m_headers.find(path);
+            if (it != m_headers.end() && it->second->mtime == mtime && it->second->size == size){
+                return it->second;
+            }
+        }
+        ifstream file(path, ios::binary);
+        if (!file){
+            return nullptr;
+        }
+        auto header = make_shared<Header>();
+        stringstream text;
+        text << file.rdbuf();
+        header->text = move(text).str();
+        header->lines = lex_lines(header->text, path);
+        header->guard = find_guard(header->lines);
+        header->once = any_of(header->lines.begin(), header->lines.end(), [](auto& line){
+            return line.directive && line.tokens.size() == 2 && is(line.tokens[0], "pragma") && is(line.tokens[1], "once");
+        });
+        header->mtime = mtime;
+        header->size = size;
+        lock_guard lock(m_mutex);
+        m_headers[path] = header;
+        return header;
+    }
+};
+
+static HeaderCache header_cache;
+
+struct Macro {
+    bool function_like = false;
+    bool variadic = false;
+    vector<string_view> params;
+    vector<PpToken> body;
+};
+
+using HideSet = vector<string_view>;
+
+// A token being expanded, with the macros that must not be expanded in it
+// again.
+struct Tok {
+    PpToken token;
+    const HideSet* hide = nullptr;
+};
+
+class Preprocessor {
+    const PreprocessOptions& m_options;
+    Preprocessed m_result;
+    map<string, Macro, less<>> m_macros;
+    set<string> m_included_once;
+    vector<shared_ptr<const Header>> m_headers; // macros point into their text
+    deque<string> m_strings;
+    deque<HideSet> m_hide_sets;
+    int m_depth = 0;
+
+    // what is being read, for errors and __FILE__
+    string_view m_text;
+    uint32_t m_file = 0;
+
+    [[noreturn]] void error(const PpToken& token, string_view message){
+        error_in(m_text, token.text.data() >= m_text.data() && token.text.data() <= m_text.data() + m_text.size() ? token.text.data() : nullptr,
+            m_file == 0 ? "" : m_result.files[m_file], message);
+    }
+    [[noreturn]] void error(const PpLine& line, string_view message){
+        if (!line.tokens.empty()){
+            error(line.tokens[0], message);
+        }
+        error_in(m_text, nullptr, m_file == 0 ? "" : m_result.files[m_file], message);
+    }
+
+    string_view own(string text){
+        return m_strings.emplace_back(move(text));
+    }
+
+    const HideSet* hide_with(const HideSet* hide, string_view name){
+        HideSet set = hide ? *hide : HideSet{};
+        set.insert(lower_bound(set.begin(), set.end(), name), name);
+        return &m_hide_sets.emplace_back(move(set));
+    }
+    static bool hidden(const Tok& tok){
+        return tok.hide && binary_search(tok.hide->begin(), tok.hide->end(), tok.token.text);
+    }
+    const HideSet* intersect(const HideSet* a, const HideSet* b){
+        if (!a || !b){
+            return nullptr;
+        }
+        HideSet set;
+        set_intersection(a->begin(), a->end(), b->begin(), b->end(), back_inserter(set));
+        return &m_hide_sets.emplace_back(move(set));
+    }
+
+    // Arguments of a function-like macro whose "(" was just taken from
+    // input, which holds the tokens to come in reverse order.
+    vector<vector<Tok>> read_args(const Macro& macro, const Tok& name, vector<Tok>& input, Tok& close){
+        vector<vector<Tok>> args(1);
+        int depth = 0;
+        while (true){
+            if (input.empty()){
+                error(name.token, "unterminated argument list invoking macro");
+            }
+            auto tok = move(input.back());
+            input.pop_back();
+            if (depth == 0 && is(tok.token, ")")){
+                close = tok;
+                break;
+            }
+            if (is(tok.token, "(")){
+                ++depth;
+            }
+            else if (is(tok.token, ")")){
+                --depth;
+            }
+            else if (depth == 0 && is(tok.token, ",") && (!macro.variadic || args.size() < macro.params.size())){
+                args.emplace_back();
+                continue;
+            }
+            args.back().push_back(move(tok));
+        }
+        if (macro.params.empty() && args.size() == 1 && args[0].empty()){
+            args.clear();
+        }
+        if (macro.variadic && args.size() + 1 == macro.params.size()){
+            args.emplace_back();
+        }
+        if (args.size() != macro.params.size()){
+            error(name.token, "wrong number of arguments for macro " + string(name.token.text));
+        }
+        return args;
+    }
+
+    PpToken stringize(const vector<Tok>& arg, uint32_t line){
+        string text = "\"";
+        for (size_t i = 0; i < arg.size(); ++i){
+            if (i > 0 && arg[i].token.space){
+                text += ' ';
+            }
+            for (auto c : arg[i].token.text){
+                if (arg[i].token.kind == PpKind::String && (c == '"' || c == '\\')){
+                    text += '\\';
+                }
+                text += c;
+            }
+        }
+        return {PpKind::String, own(text + "\""), false, line};
+    }
+
+    PpToken paste(const PpToken& lhs, const PpToken& rhs){
+        auto text = own(string(lhs.text) + string(rhs.text));
+        auto lines = lex_lines(text, "");
+        if (lines.size() != 1 || lines[0].tokens.size() != 1 || lines[0].directive){
+            error(lhs, "pasting \"" + string(lhs.text) + "\" and \"" + string(rhs.text) + "\" does not give a valid token");
+        }
+        auto token = lines[0].tokens[0];
+        token.space = lhs.space;
+        token.line = lhs.line;
+        return token;
+    }
+
+    // The body of a macro with its parameters replaced by the arguments.
+    vector<Tok> substitute(const Macro& macro, const vector<vector<Tok>>& args){
+        auto param = [&](const PpToken& token) -> const vector<Tok>* {
+            if (token.kind != PpKind::Ident){
+                return nullptr;
+            }
+            auto it = find(macro.params.begin(), macro.params.end(), token.text);
+            return it == macro.params.end() ? nullptr : &args[it - macro.params.begin()];
+        };
+        vector<Tok> result;
+        auto& body = macro.body;
+        for (size_t i = 0; i < body.size(); ++i){
+            auto& token = body[i];
+            if (is(token, "#") && macro.function_like){
+                auto arg = i + 1 < body.size() ? param(body[i + 1]) : nullptr;
+                if (!arg){
+                    error(token, "'#' is not followed by a macro parameter");
+                }
+                auto literal = stringize(*arg, token.line);
+                literal.space = token.space;
+                result.push_back({literal});
+                ++i;
+                continue;
+            }
+            if (is(token, "##")){
+                if (result.empty() || i + 1 == body.size()){
+                    error(token, "'##' cannot appear at either end of a macro expansion");
+                }
+                auto& next = body[++i];
+                if (auto arg = param(next)){
+                    if (!arg->empty()){
+                        result.back().token = paste(result.back().token, (*arg)[0].token);
+                        result.insert(result.end(), arg->begin() + 1, arg->end());
+                    }
+                }
+                else {
+                    result.back().token = paste(result.back().token, next);
+                }
+                continue;
+            }
+            if (auto arg = param(token)){
+                // an operand of ## is not expanded
+                if (i + 1 < body.size() && is(body[i + 1], "##")){
+                    if (arg->empty() && i + 2 < body.size()){
+                        i += 2;
+                        if (auto rhs = param(body[i])){
+                            result.insert(result.end(), rhs->begin(), rhs->end());
+                        }
+                        else {
+                            result.push_back({body[i]});
+                        }
+                    }
+                    else {
+                        result.insert(result.end(), arg->begin(), arg->end());
+                    }
+                    continue;
+                }
+                auto expanded = expand(*arg);
+                if (!expanded.empty()){
+                    expanded[0].token.space = token.space;
+                }
+                result.insert(result.end(), expanded.begin(), expanded.end());
+                continue;
+            }
+            result.push_back({token});
+        }
+        return result;
+    }
+
+    // Replaces the macros in tokens until none is left to expand.
+    vector<Tok> expand(const vector<Tok>& tokens){
+        vector<Tok> input(tokens.rbegin(), tokens.rend());
+        vector<Tok> output;
+        while (!input.empty()){
+            auto tok = move(input.back());
+            input.pop_back();
+            auto& token = tok.token;
+            if (token.kind != PpKind::Ident || hidden(tok)){
+                output.push_back(move(tok));
+                continue;
+            }
+            if (token.text == "__LINE__" || token.text == "__FILE__"){
+                auto text = token.text == "__LINE__" ? to_string(token.line) : "\"" + m_result.files[m_file] + "\"";
+                output.push_back({{token.text == "__LINE__" ? PpKind::Number : PpKind::String, own(move(text)), token.space, token.line}});
+                continue;
+            }
+            auto it = m_macros.find(token.text);
+            if (it == m_macros.end()){
+                output.push_back(move(tok));
+                continue;
+            }
+            auto& macro = it->second;
+            vector<Tok> body;
+            const HideSet* hide;
+            if (!macro.function_like){
+                body = substitute(macro, {});
+                hide = hide_with(tok.hide, it->first);
+            }
+            else {
+                if (input.empty() || !is(input.back().token, "(")){
+                    output.push_back(move(tok));
+                    continue;
+                }
+                input.pop_back();
+                Tok close;
+                auto args = read_args(macro, tok, input, close);
+                body = substitute(macro, args);
+                hide = hide_with(intersect(tok.hide, close.hide), it->first);
+            }
+            for (auto& t : body){
+                t.hide = t.hide ? unite(t.hide, hide) : hide;
+                t.token.line = token.line;
+            }
+            if (!body.empty()){
+                body[0].token.space = token.space;
+            }
+            input.insert(input.end(), body.rbegin(), body.rend());
+        }
+        return output;
+    }
+    const HideSet* unite(const HideSet* a, const HideSet* b){
+        HideSet set;
+        set_union(a->begin(), a->end(), b->begin(), b->end(), back_inserter(set));
+        return &m_hide_sets.emplace_back(move(set));
+    }
+
+    void define(const PpLine& line){
+        auto& t = line.tokens;
+        if (t.size() < 2 || t[1].kind != PpKind::Ident){
+            error(line, "macro name is expected");
+        }
+        Macro macro;
+        size_t i = 2;
+        if (i < t.size() && is(t[i], "(") && !t[i].space){
+            macro.function_like = true;
+            ++i;
+            while (i < t.size() && !is(t[i], ")")){
+                if (!macro.params.empty()){
+                    if (!is(t[i], ",")){
+                        error(t[i], "',' is expected");
+                    }
+                    ++i;
+                }
+                if (i < t.size() && is(t[i], "...")){
+                    macro.variadic = true;
+                    macro.params.push_back("__VA_ARGS__");
+                    ++i;
+                    break;
+                }
+                if (i == t.size() || t[i].kind != PpKind::Ident){
+                    error(line, "parameter name is expected");
+                }
+                macro.params.push_back(t[i++].text);
+            }
+            if (i == t.size() || !is(t[i], ")")){
+                error(line, "')' is expected");
+            }
+            ++i;
+        }
+        macro.body.assign(t.begin() + i, t.end());
+        if (!macro.body.empty()){
+            macro.body[0].space = false;
+        }
+        m_macros.insert_or_assign(string(t[1].text), move(macro));
+    }
+
+    // Value of the expression of an #if or #elif.
+    bool condition(const PpLine& line){
+        vector<Tok> tokens;
+        auto& t = line.tokens;
+        for (size_t i = 1; i < t.size(); ++i){
+            if (is(t[i], "defined")){
+                auto paren = i + 1 < t.size() && is(t[i + 1], "(");
+                auto name = i + 1 + paren;
+                if (name >= t.size() || t[name].kind != PpKind::Ident || (paren && (name + 1 >= t.size() || !is(t[name + 1], ")")))){
+                    error(t[i], "macro name is expected after defined");
+                }
+                tokens.push_back({{PpKind::Number, m_macros.contains(t[name].text) ? "1" : "0", true, t[i].line}});
+                i = name + paren;
+                continue;
+            }
+            tokens.push_back({t[i]});
+        }
+        auto expanded = expand(tokens);
+        if (expanded.empty()){
+            error(line, "#if with no expression");
+        }
+        size_t pos = 0;
+        auto value = evaluate(expanded, pos, 0);
+        if (pos != expanded.size()){
+            error(expanded[pos].token, "extra tokens in #if expression");
+        }
+        return value != 0;
+    }
+
+    int64_t primary(const vector<Tok>& t, size_t& pos){
+        if (pos == t.size()){
+            error(t.back().token, "expression is expected");
+        }
+        auto& token = t[pos++].token;
+        if (is(token, "(")){
+            auto value = evaluate(t, pos, 0);
+            if (pos == t.size() || !is(t[pos].token, ")")){
+                error(token, "')' is expected");
+            }
+            ++pos;
+            return value;
+        }
+        if (is(token, "-")) return -primary(t, pos);
+        if (is(token, "+")) return primary(t, pos);
+        if (is(token, "!")) return !primary(t, pos);
+        if (is(token, "~")) return ~primary(t, pos);
+        if (token.kind == PpKind::Number){
+            auto text = string(token.text);
+            while (!text.empty() && strchr("uUlL", text.back())){
+                text.pop_back();
+            }
+            char* end;
+            auto value = strtoull(text.c_str(), &end, 0);
+            if (*end){
+                error(token, "invalid integer constant in #if");
+            }
+            return static_cast<int64_t>(value);
+        }
+        if (token.kind == PpKind::String && token.text.starts_with('\'') && token.text.size() >= 3){
+            if (token.text[1] != '\\'){
+                return token.text[1];
+            }
+            switch (token.text[2]){
+            case 'n': return '\n';
+            case 't': return '\t';
+            case '0': return 0;
+            default: return token.text[2];
+            }
+        }
+        // an identifier that is not a macro
+        if (token.kind == PpKind::Ident){
+            return 0;
+        }
+        error(token, "invalid token in #if expression");
+    }
+
+    // Precedence climbing over the binary operators, then ?:.
+    int64_t evaluate(const vector<Tok>& t, size_t& pos, int min_precedence){
+        static const map<string_view, int> precedence = {
+            {"||", 1}, {"&&", 2}, {"|", 3}, {"^", 4}, {"&", 5}, {"==", 6}, {"!=", 6},
+            {"<", 7}, {">", 7}, {"<=", 7}, {">=", 7}, {"<<", 8}, {">>", 8},
+            {"+", 9}, {"-", 9}, {"*", 10}, {"/", 10}, {"%", 10},
+        };
+        auto lhs = primary(t, pos);
+        while (pos < t.size() && t[pos].token.kind == PpKind::Punct){
+            auto& op = t[pos].token;
+            if (is(op, "?")){
+                if (min_precedence > 0){
+                    break;
+                }
+                ++pos;
+                auto then = evaluate(t, pos, 0);
+                if (pos == t.size() || !is(t[pos].token, ":")){
+                    error(op, "':' is expected");
+                }
+                ++pos;
+                auto else_ = evaluate(t, pos, 0);
+                lhs = lhs ? then : else_;
+                continue;
+            }
+            auto it = precedence.find(op.text);
+            if (it == precedence.end() || it->second < min_precedence){
+                break;
+            }
+            ++pos;
+            auto rhs = evaluate(t, pos, it->second + 1);
+            auto name = op.text;
+            if ((name == "/" || name == "%") && rhs == 0){
+                error(op, "division by zero in #if");
+            }
+            lhs = name == "||" ? lhs || rhs : name == "&&" ? lhs && rhs
+                : name == "|" ? lhs | rhs : name == "^" ? lhs ^ rhs : name == "&" ? lhs & rhs
+                : name == "==" ? lhs == rhs : name == "!=" ? lhs != rhs
+                : name == "<" ? lhs < rhs : name == ">" ? lhs > rhs : name == "<=" ? lhs <= rhs : name == ">=" ? lhs >= rhs
+                : name == "<<" ? lhs << rhs : name == ">>" ? lhs >> rhs
+                : name == "+" ? lhs + rhs : name == "-" ? lhs - rhs
+                : name == "*" ? lhs * rhs : name == "/" ? lhs / rhs : lhs % rhs;
+        }
+        return lhs;
+    }
+
+    // The path of an included file: next to the including file for "name",
+    // then in the include directories.
+    optional<string> find_include(string_view name, bool quoted){
+        if (name.starts_with('/')){
+            return string(name);
+        }
+        vector<filesystem::path> dirs;
+        if (quoted){
+            dirs.push_back(filesystem::path(m_result.files[m_file]).parent_path());
+        }
+        dirs.insert(dirs.end(), m_options.include_dirs.begin(), m_options.include_dirs.end());
+        for (auto& dir : dirs){
+            auto path = (dir / name).lexically_normal().string();
+            int64_t mtime, size;
+            if (stat_file(path, mtime, size)){
+                return path;
+            }
+        }
+        return nullopt;
+    }
+
+    void include(const PpLine& line){
+        auto& t = line.tokens;
+        if (t.size() < 2){
+            error(line, "file name is expected after #include");
+        }
+        string name;
+        bool quoted = false;
+        if (t[1].kind == PpKind::String && t[1].text.starts_with('"')){
+            name = string(t[1].text.substr(1, t[1].text.size() - 2));
+            quoted = true;
+        }
+        else if (is(t[1], "<")){
+            size_t i = 2;
+            for (; i < t.size() && !is(t[i], ">"); ++i){
+                name += t[i].text;
+            }
+            if (i == t.size()){
+                error(t[1], "'>' is expected");
+            }
+        }
+        else {
+            error(t[1], "file name is expected after #include");
+        }
+        auto path = find_include(name, quoted);
+        if (!path){
+            error(t[1], name + ": file not found");
+        }
+        if (m_included_once.contains(*path)){
+            return;
+        }
+        auto header = header_cache.get(*path);
+        if (!header){
+            error(t[1], name + ": file cannot be read");
+        }
+        if (!header->guard.empty() && m_macros.contains(header->guard)){
+            return;
+        }
+        if (header->once){
+            m_included_once.insert(*path);
+        }
+        if (++m_depth > 200){
+            error(t[1], "#include nests too deeply");
+        }
+        m_headers.push_back(header);
+        auto saved_text = m_text;
+        auto saved_file = m_file;
+        m_result.files.push_back(*path);
+        m_text = header->text;
+        m_file = m_result.files.size() - 1;
+        process(header->lines);
+        m_text = saved_text;
+        m_file = saved_file;
+        --m_depth;
+    }
+
+    // Writes the tokens of lines [first, last) after expanding their macros,
+    // each on the line of the file it came from.
+    void write(const vector<PpLine>& lines, size_t first, size_t last){
+        vector<Tok> tokens;
+        for (auto i = first; i < last; ++i){
+            for (auto& token : lines[i].tokens){
+                tokens.push_back({token});
+            }
+        }
+        auto line = lines[first].line;
+        auto end = lines[last - 1].line + lines[last - 1].count;
+        auto in_text = [&](const PpToken& token){
+            return token.text.data() >= m_text.data() && token.text.data() + token.text.size() <= m_text.data() + m_text.size();
+        };
+        const PpToken* previous = nullptr;
+        for (auto& tok : expand(tokens)){
+            auto& token = tok.token;
+            while (line < token.line){
+                new_line(line++);
+                previous = nullptr;
+            }
+            // tokens as they are in the file keep their columns, for diagnostics
+            auto from = previous && in_text(*previous) ? previous->text.data() + previous->text.size()
+                : !previous ? m_text.data() + m_text.rfind('\n', token.text.data() - m_text.data()) + 1 : nullptr;
+            if (from && in_text(token) && from <= token.text.data() && !memchr(from, '\n', token.text.data() - from)){
+                m_result.text.append(token.text.data() - from, ' ');
+            }
+            else if (previous && (token.space || needs_space(*previous, token))){
+                m_result.text += ' ';
+            }
+            m_result.text += token.text;
+            previous = &token;
+        }
+        while (line < end){
+            new_line(line++);
+        }
+    }
+
+    // Whether two tokens written next to each other would be read as one.
+    static bool needs_space(const PpToken& lhs, const PpToken& rhs){
+        if (lhs.kind != PpKind::Punct && rhs.kind != PpKind::Punct){
+            return true;
+        }
+        if (lhs.kind != PpKind::Punct || rhs.kind != PpKind::Punct){
+            return false;
+        }
+        auto joined = string(lhs.text) + rhs.text[0];
+        return joined == "//" || joined == "/*" || any_of(begin(puncts), end(puncts), [&](string_view punct){ return punct.starts_with(joined); });
+    }
+
+    void new_line(uint32_t line){
+        m_result.text += '\n';
+        m_result.lines.emplace_back(m_file, line);
+    }
+
+    void skip(const PpLine& line){
+        for (uint32_t i = 0; i < line.count; ++i){
+            new_line(line.line + i);
+        }
+    }
+
+    struct Conditional {
+        bool parent;    // the enclosing region is included
+        bool taken;     // a branch was included
+        bool active;    // the current branch is included
+        bool seen_else;
+    };
+
+    void process(const vector<PpLine>& lines){
+        vector<Conditional> conditionals;
+        auto active = [&]{ return conditionals.empty() || conditionals.back().active; };
+        size_t i = 0;
+        while (i < lines.size()){
+            auto& line = lines[i];
+            if (!line.directive){
+                if (!active()){
+                    skip(line);
+                    ++i;
+                    continue;
+                }
+                // consecutive lines, so that a macro invocation may span them
+                auto last = i;
+                while (last < lines.size() && !lines[last].directive){
+                    ++last;
+                }
+                write(lines, i, last);
+                i = last;
+                continue;
+            }
+            ++i;
+            skip(line);
+            if (line.tokens.empty()){
+                continue;
+            }
+            auto& t = line.tokens;
+            auto name = t[0].text;
+            if (name == "if" || name == "ifdef" || name == "ifndef"){
+                bool parent = active();
+                bool value = false;
+                if (parent){
+                    if (name == "if"){
+                        value = condition(line);
+                    }
+                    else {
+                        if (t.size() < 2 || t[1].kind != PpKind::Ident){
+                            error(line, "macro name is expected");
+                        }
+                        value = m_macros.contains(t[1].text) == (name == "ifdef");
+                    }
+                }
+                conditionals.push_back({parent, value, value, false});
+            }
+            else if (name == "elif" || name == "else"){
+                if (conditionals.empty() || conditionals.back().seen_else){
+                    error(line, "#" + string(name) + " without #if");
+                }
+                auto& c = conditionals.back();
+                if (name == "else"){
+                    c.active = c.parent && !c.taken;
+                    c.seen_else = true;
+                }
+                else {
+                    c.active = c.parent && !c.taken && condition(line);
+                }
+                c.taken = c.taken || c.active;
+            }
+            else if (name == "endif"){
+                if (conditionals.empty()){
+                    error(line, "#endif without #if");
+                }
+                conditionals.pop_back();
+            }
+            else if (!active()){
+                continue;
+            }
+            else if (name == "define"){
+                define(line);
+            }
+            else if (name == "undef"){
+                if (t.size() < 2 || t[1].kind != PpKind::Ident){
+                    error(line, "macro name is expected");
+                }
+                m_macros.erase(string(t[1].text));
+            }
+            else if (name == "include"){
+                include(line);
+            }
+            else if (name == "error"){
+                error(line, "#error" + string(t.size() > 1 ? " " : "") + (t.size() > 1 ? string(t[1].text) : ""));
+            }
+            else if (name != "pragma" && name != "line" && name != "warning"){
+                error(t[0], "invalid preprocessing directive #" + string(name));
+            }
+        }
+        if (!conditionals.empty()){
+            error_in(m_text, nullptr, m_file == 0 ? "" : m_result.files[m_file], "unterminated conditional directive");
+        }
+    }
+
+public:
+    explicit Preprocessor(const PreprocessOptions& options): m_options(options){
+        for (auto& [name, value] : options.defines){
+            auto text = own("define " + name + " " + value);
+            auto lines = lex_lines(text, "");
+            if (lines.size() != 1 || lines[0].tokens.empty()){
+                throw invalid_argument("invalid macro definition: " + name);
+            }
+            define(lines[0]);
+        }
+    }
+
+    Preprocessed run(string_view text, const string& file_name){
+        m_result.files.push_back(file_name);
+        m_text = text;
+        process(lex_lines(text, ""));
+        return move(m_result);
+    }
+};
+
+static bool has_directives(string_view text){
+    for (size_t p = text.find('#'); p != string_view::npos; p = text.find('#', p + 1)){
+        auto start = text.rfind('\n', p);
+        start = start == string_view::npos ? 0 : start + 1;
+        auto before = text.substr(start, p - start);
+        if (all_of(before.begin(), before.end(), [](char c){ return c == ' ' || c == '\t'; })){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool needs_preprocessing(string_view text, const PreprocessOptions& options){
+    return !options.defines.empty() || has_directives(text)
+        || text.find("__LINE__") != string_view::npos || text.find("__FILE__") != string_view::npos;
+}
+
+void Preprocessed::locate(Diagnostic& diagnostic) const{
+    if (diagnostic.line == 0 || diagnostic.line > lines.size()){
+        return;
+    }
+    auto [file, line] = lines[diagnostic.line - 1];
+    diagnostic.line = line;
+    if (file != 0){
+        diagnostic.file = files[file];
+    }
+}
+
+Preprocessed preprocess(string_view text, const string& file_name, const PreprocessOptions& options){
+    return Preprocessor(options).run(text, file_name);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "common.h"
+
+// The C preprocessor: #include with search paths, object and function-like
+// macros with # and ##, conditional inclusion, #pragma once and include
+// guards. It writes the translation unit as one text for the lexer.
+//
+// Headers are read and split into tokens once per process and shared by
+// every preprocessor run; a header is read again when its size or time of
+// modification changes. A header whose include guard is defined, or that
+// has #pragma once and was included before, is skipped without looking at
+// its lines.
+
+struct PreprocessOptions {
+    vector<string> include_dirs;                // searched in order by #include
+    vector<pair<string, string>> defines;       // name and replacement, from -D
+};
+
+// Every line of every file read is one line of text, so that a position in
+// the text can be traced back to the file it came from.
+struct Preprocessed {
+    string text;
+    vector<string> files;                       // the input first, then the headers
+    vector<pair<uint32_t, uint32_t>> lines;     // file index and line of each line of text
+
+    // Rewrites the line of a diagnostic in text to the line of the file it
+    // came from, and names that file if it is a header.
+    void locate(Diagnostic& diagnostic) const;
+};
+
+// Whether the preprocessor has anything to do with text: a line starting
+// with #, a macro defined by the options, or a use of __LINE__ or __FILE__.
+bool needs_preprocessing(string_view text, const PreprocessOptions& options);
+
+// Preprocesses text, read from file_name. Throws CompileError, with the
+// file of the diagnostic set when the error is in a header.
+Preprocessed preprocess(string_view text, const string& file_name, const PreprocessOptions& options);
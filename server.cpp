@@ -0,0 +1,276 @@
+#include "server.h"
+#include "driver.h"
+#include <csignal>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Messages are sequences of strings, each preceded by its length as a
+// 32-bit integer. A request holds the working directory, the number of
+// arguments, the arguments and the standard input if it is used; the
+// response holds the exit status, the standard output and the standard
+// error.
+
+static void write_all(int fd, const char* data, size_t size){
+    while (size){
+        auto n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR){
+            continue;
+        }
+        if (n <= 0){
+            throw runtime_error("failed to write to socket: "s + strerror(errno));
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+static void read_all(int fd, char* data, size_t size){
+    while (size){
+        auto n = ::read(fd, data, size);
+        if (n < 0 && errno == EINTR){
+            continue;
+        }
+        if (n <= 0){
+            throw runtime_error("connection closed");
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+static void write_string(int fd, string_view s){
+    uint32_t size = s.size();
+    write_all(fd, reinterpret_cast<const char*>(&size), sizeof(size));
+    write_all(fd, s.data(), s.size());
+}
+
+static string read_string(int fd){
+    uint32_t size;
+    read_all(fd, reinterpret_cast<char*>(&size), sizeof(size));
+    string s(size, '\0');
+    read_all(fd, s.data(), size);
+    return s;
+}
+
+static sockaddr_un socket_address(const string& path){
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)){
+        throw invalid_argument("socket path is too long");
+    }
+    strcpy(address.sun_path, path.c_str());
+    return address;
+}
+
+string default_socket_path(){
+    if (auto runtime = getenv("XDG_RUNTIME_DIR"); runtime && *runtime){
+        return runtime + "/pontacc.sock"s;
+    }
+    return "/tmp/pontacc-" + to_string(getuid()) + "/server.sock";
+}
+
+// Creates the directory of the default socket in /tmp, and refuses one
+// that another user could have made or can write to.
+static void make_private_dir(const filesystem::path& dir){
+    if (mkdir(dir.c_str(), 0700) < 0 && errno != EEXIST){
+        throw runtime_error("failed to create " + dir.string() + ": " + strerror(errno));
+    }
+    struct stat info;
+    if (lstat(dir.c_str(), &info) < 0 || !S_ISDIR(info.st_mode) || info.st_uid != getuid() || (info.st_mode & 077)){
+        throw runtime_error(dir.string() + " is not a private directory");
+    }
+}
+
+// Whether the other end of a connection runs as the same user, whose files
+// the server reads and writes.
+static bool same_user(int fd){
+    ucred peer;
+    socklen_t size = sizeof(peer);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) == 0 && peer.uid == getuid();
+}
+
+static void serve(int fd, SessionCache& sessions){
+    try {
+        auto cwd = read_string(fd);
+        auto count = stoul(read_string(fd));
+        vector<string> args;
+        for (size_t i = 0; i < count; ++i){
+            args.push_back(read_string(fd));
+        }
+        auto input = read_string(fd);
+        ostringstream out, err;
+        DriverContext context{out, err, cwd, nullopt, &sessions};
+        if (find(args.begin(), args.end(), "-") != args.end()){
+            context.stdin_data = input;
+        }
+        auto status = run_driver(args, context);
+        write_string(fd, to_string(status));
+        write_string(fd, out.view());
+        write_string(fd, err.view());
+    }
+    catch (const exception& e){
+        cerr << "pontacc server: " << e.what() << endl;
+    }
+    ::close(fd);
+}
+
+// Connections accepted and waiting for a worker. The listener stops
+// accepting while it is full, so that further clients wait in the backlog.
+class ConnectionQueue {
+    mutex m_mutex;
+    condition_variable m_changed;
+    deque<int> m_fds;
+    size_t m_capacity;
+    bool m_stop = false;
+public:
+    explicit ConnectionQueue(size_t capacity): m_capacity(capacity) {}
+
+    void push(int fd){
+        unique_lock lock(m_mutex);
+        m_changed.wait(lock, [&]{ return m_fds.size() < m_capacity; });
+        m_fds.push_back(fd);
+        m_changed.notify_all();
+    }
+
+    // The next connection, or -1 once stopped.
+    int pop(){
+        unique_lock lock(m_mutex);
+        m_changed.wait(lock, [&]{ return m_stop || !m_fds.empty(); });
+        if (m_stop){
+            return -1;
+        }
+        auto fd = m_fds.front();
+        m_fds.pop_front();
+        m_changed.notify_all();
+        return fd;
+    }
+
+    // Closes the connections not yet served.
+    void stop(){
+        lock_guard lock(m_mutex);
+        m_stop = true;
+        for (auto fd : m_fds){
+            ::close(fd);
+        }
+        m_fds.clear();
+        m_changed.notify_all();
+    }
+};
+
+// A fixed number of workers serve the connections. SIGINT and SIGTERM are
+// taken through a signalfd next to the listener, so the server stops
+// between accepts, lets the workers finish their requests and joins them.
+int run_server(const string& socket_path){
+    auto address = socket_address(socket_path);
+    if (socket_path == default_socket_path() && !getenv("XDG_RUNTIME_DIR")){
+        make_private_dir(filesystem::path(socket_path).parent_path());
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0){
+        throw runtime_error("failed to create socket: "s + strerror(errno));
+    }
+    // a socket left behind by a server that was killed
+    unlink(socket_path.c_str());
+    // only the owner may connect
+    auto mask = umask(0177);
+    auto bound = bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    umask(mask);
+    if (!bound || listen(listener, 64) < 0){
+        throw runtime_error("failed to listen on " + socket_path + ": " + strerror(errno));
+    }
+    // blocked before the workers start, so that they inherit the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    int stop_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (stop_fd < 0){
+        throw runtime_error("failed to create signalfd: "s + strerror(errno));
+    }
+    signal(SIGPIPE, SIG_IGN);
+    // requests run side by side on the workers, each on a single thread
+    auto worker_count = max(2u, thread::hardware_concurrency());
+    SessionCache sessions(1, worker_count);
+    ConnectionQueue queue(worker_count);
+    vector<thread> workers;
+    for (size_t i = 0; i < worker_count; ++i){
+        workers.emplace_back([&]{
+            for (int fd; (fd = queue.pop()) >= 0;){
+                serve(fd, sessions);
+            }
+        });
+    }
+    int status = 0;
+    while (!status){
+        pollfd fds[] = {{listener, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            cerr << "pontacc server: failed to poll: " << strerror(errno) << endl;
+            status = 1;
+        }
+        else if (fds[1].revents){
+            signalfd_siginfo info;
+            status = read(stop_fd, &info, sizeof(info)) == sizeof(info) ? 128 + info.ssi_signo : 1;
+        }
+        else if (fds[0].revents){
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0){
+                continue;
+            }
+            if (!same_user(fd)){
+                cerr << "pontacc server: refused a connection from another user" << endl;
+                ::close(fd);
+                continue;
+            }
+            queue.push(fd);
+        }
+    }
+    queue.stop();
+    for (auto& worker : workers){
+        worker.join();
+    }
+    unlink(socket_path.c_str());
+    ::close(listener);
+    ::close(stop_fd);
+    return status;
+}
+
+int run_client(const string& socket_path, const vector<string>& args){
+    // a program runs in the process that asked for it
+    if (find(args.begin(), args.end(), "--run") != args.end() || find(args.begin(), args.end(), "--interpret") != args.end()){
+        return run_driver(args, {cout, cerr});
+    }
+    auto address = socket_address(socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    // a server of another user could read the files named by the arguments
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || !same_user(fd)){
+        if (fd >= 0){
+            ::close(fd);
+        }
+        return run_driver(args, {cout, cerr});
+    }
+    string input;
+    if (find(args.begin(), args.end(), "-") != args.end()){
+        stringstream text;
+        text << cin.rdbuf();
+        input = text.str();
+    }
+    write_string(fd, filesystem::current_path().string());
+    write_string(fd, to_string(args.size()));
+    for (auto& arg : args){
+        write_string(fd, arg);
+    }
+    write_string(fd, input);
+    auto status = stoi(read_string(fd));
+    cout << read_string(fd) << flush;
+    cerr << read_string(fd) << flush;
+    ::close(fd);
+    return status;
+}
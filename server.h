@@ -0,0 +1,22 @@
+#pragma once
+#include "common.h"
+
+// A compile server keeps one process resident and runs the command lines
+// that clients send it over a Unix socket. Its output and exit status go
+// back to the client, which behaves like a local run. What is saved per
+// request is the process start and the setup of a session: its pass
+// pipeline, statistics and cache are reused by the next request with the
+// same options. Each request still lexes and parses into an interner and
+// arena of its own, so interning is not amortized across requests.
+
+// $XDG_RUNTIME_DIR/pontacc.sock, or /tmp/pontacc-<uid>/server.sock in a
+// directory only the user can enter.
+string default_socket_path();
+
+// Serves until SIGINT or SIGTERM and returns 128 plus the signal. The
+// socket is only accessible to the user, and connections from other users
+// are refused.
+int run_server(const string& socket_path);
+
+// Runs the command line on the server, or locally when no server listens.
+int run_client(const string& socket_path, const vector<string>& args);
@@ -0,0 +1,65 @@
+#pragma once
+#include "common.h"
+
+// Bounded lock-free queue between one producer and one consumer thread.
+// Each side keeps a cached copy of the other side's index and rereads it
+// only when the queue looks full or empty. A side that has to wait spins
+// for a while and then sleeps on the index it is waiting for; the other
+// side wakes it only when the queue was empty or full.
+template<class T, uint32_t Capacity>
+class SpscQueue {
+    static_assert(has_single_bit(Capacity));
+    static constexpr int spin_count = 64;
+
+    array<T, Capacity> m_items;
+    alignas(64) atomic<uint32_t> m_head = 0;   // next slot to pop
+    uint32_t m_tail_cache = 0;                 // consumer's view of m_tail
+    alignas(64) atomic<uint32_t> m_tail = 0;   // next slot to push
+    uint32_t m_head_cache = 0;                 // producer's view of m_head
+
+    // Waits until index no longer holds old and returns the new value.
+    static uint32_t wait_change(atomic<uint32_t>& index, uint32_t old){
+        for (int i = 0; i < spin_count; ++i){
+            auto now = index.load(memory_order_acquire);
+            if (now != old){
+                return now;
+            }
+        }
+        index.wait(old, memory_order_seq_cst);
+        return index.load(memory_order_acquire);
+    }
+
+public:
+    void push(T item){
+        auto tail = m_tail.load(memory_order_relaxed);
+        if (tail - m_head_cache == Capacity){
+            m_head_cache = m_head.load(memory_order_seq_cst);
+            while (tail - m_head_cache == Capacity){
+                m_head_cache = wait_change(m_head, m_head_cache);
+            }
+        }
+        m_items[tail % Capacity] = move(item);
+        m_tail.store(tail + 1, memory_order_seq_cst);
+        // the consumer only sleeps on an empty queue
+        if (m_head.load(memory_order_seq_cst) == tail){
+            m_tail.notify_one();
+        }
+    }
+
+    T pop(){
+        auto head = m_head.load(memory_order_relaxed);
+        if (head == m_tail_cache){
+            m_tail_cache = m_tail.load(memory_order_seq_cst);
+            while (head == m_tail_cache){
+                m_tail_cache = wait_change(m_tail, m_tail_cache);
+            }
+        }
+        T item = move(m_items[head % Capacity]);
+        m_head.store(head + 1, memory_order_seq_cst);
+        // the producer only sleeps on a full queue
+        if (m_tail.load(memory_order_seq_cst) - head == Capacity){
+            m_head.notify_one();
+        }
+        return item;
+    }
+};
@@ -0,0 +1,166 @@
+#include "stats.h"
+#include <sys/resource.h>
+
+static thread_local AllocCount allocs;
+
+AllocCount thread_allocs(){
+    return allocs;
+}
+
+void count_alloc(size_t bytes){
+    ++allocs.count;
+    allocs.bytes += bytes;
+}
+
+static thread_local Stats* current_stats = nullptr;
+
+Stats& stats(){
+    // never enabled, so it is never written to
+    static Stats disabled;
+    return current_stats ? *current_stats : disabled;
+}
+
+StatsScope::StatsScope(Stats& stats): m_previous(current_stats){
+    current_stats = &stats;
+}
+
+StatsScope::~StatsScope(){
+    current_stats = m_previous;
+}
+
+void Stats::enable(bool trace){
+    m_enabled = true;
+    m_trace = trace;
+    m_start = Clock::now();
+}
+
+// Small ids for the threads in the trace, in order of their first event.
+static uint32_t thread_index(){
+    static atomic<uint32_t> next = 0;
+    static thread_local uint32_t index = next++;
+    return index;
+}
+
+void Stats::record(string_view name, string detail, Clock::time_point start, Clock::time_point end, AllocCount allocs){
+    auto nanos = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+    lock_guard lock(m_mutex);
+    auto it = find_if(m_phases.begin(), m_phases.end(), [&](auto& phase){ return phase.first == name; });
+    if (it == m_phases.end()){
+        m_phases.emplace_back(string(name), Total{});
+        it = m_phases.end() - 1;
+    }
+    auto& total = it->second;
+    total.nanos += nanos;
+    total.calls += 1;
+    total.allocs.count += allocs.count;
+    total.allocs.bytes += allocs.bytes;
+    if (m_trace){
+        auto since = chrono::duration_cast<chrono::nanoseconds>(start - m_start).count();
+        m_events.push_back({string(name), move(detail), thread_index(), static_cast<uint64_t>(since), nanos});
+    }
+}
+
+void Stats::merge(const Stats& other){
+    scoped_lock lock(m_mutex, other.m_mutex);
+    for (size_t i = 0; i < m_counters.size(); ++i){
+        m_counters[i] += other.m_counters[i].load();
+    }
+    for (auto& [name, total] : other.m_phases){
+        auto it = find_if(m_phases.begin(), m_phases.end(), [&](auto& phase){ return phase.first == name; });
+        if (it == m_phases.end()){
+            m_phases.emplace_back(name, total);
+            continue;
+        }
+        it->second.nanos += total.nanos;
+        it->second.calls += total.calls;
+        it->second.allocs.count += total.allocs.count;
+        it->second.allocs.bytes += total.allocs.bytes;
+    }
+    // events are relative to the start of this Stats
+    auto shift = chrono::duration_cast<chrono::nanoseconds>(other.m_start - m_start).count();
+    for (auto e : other.m_events){
+        e.start = max<int64_t>(0, static_cast<int64_t>(e.start) + shift);
+        m_events.push_back(move(e));
+    }
+}
+
+static constexpr string_view counter_names[] = {
+    "tokens", "functions", "nodes", "var imports", "types",
+    "ir instructions", "instructions", "output bytes", "cache hits",
+    "cache misses",
+};
+static_assert(size(counter_names) == static_cast<size_t>(Counter::Count));
+
+static uint64_t peak_rss_kib(){
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void Stats::report_time(ostream& out) const{
+    lock_guard lock(m_mutex);
+    auto wall = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - m_start).count();
+    out << "phase              time(ms)     calls    allocs   alloc(KiB)\n";
+    for (auto& [name, total] : m_phases){
+        out << left << setw(16) << name << right
+            << setw(12) << fixed << setprecision(3) << total.nanos / 1e6
+            << setw(10) << total.calls
+            << setw(10) << total.allocs.count
+            << setw(13) << total.allocs.bytes / 1024 << '\n';
+    }
+    out << left << setw(16) << "wall" << right << setw(12) << wall / 1e6 << '\n';
+    // phases run on several threads, so their sum may exceed the wall time
+}
+
+void Stats::report_counters(ostream& out) const{
+    for (size_t i = 0; i < m_counters.size(); ++i){
+        out << left << setw(18) << counter_names[i] << right << setw(14) << m_counters[i].load() << '\n';
+    }
+    out << left << setw(18) << "peak rss (KiB)" << right << setw(14) << peak_rss_kib() << '\n';
+}
+
+static void write_string(ostream& out, string_view text){
+    out << '"';
+    for (auto c : text){
+        if (c == '"' || c == '\\'){
+            out << '\\';
+        }
+        out << c;
+    }
+    out << '"';
+}
+
+void Stats::write_json(ostream& out) const{
+    lock_guard lock(m_mutex);
+    out << "{\n  \"phases\": [";
+    for (size_t i = 0; i < m_phases.size(); ++i){
+        auto& [name, total] = m_phases[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": ";
+        write_string(out, name);
+        out << ", \"nanos\": " << total.nanos << ", \"calls\": " << total.calls
+            << ", \"allocs\": " << total.allocs.count << ", \"alloc_bytes\": " << total.allocs.bytes << "}";
+    }
+    out << "\n  ],\n  \"counters\": {";
+    for (size_t i = 0; i < m_counters.size(); ++i){
+        out << (i ? ",\n" : "\n") << "    ";
+        write_string(out, counter_names[i]);
+        out << ": " << m_counters[i].load();
+    }
+    out << "\n  },\n  \"peak_rss_kib\": " << peak_rss_kib() << "\n}\n";
+}
+
+void Stats::write_trace(ostream& out) const{
+    lock_guard lock(m_mutex);
+    out << fixed << setprecision(3) << "{\"traceEvents\": [";
+    for (size_t i = 0; i < m_events.size(); ++i){
+        auto& e = m_events[i];
+        out << (i ? ",\n" : "\n") << "{\"name\": ";
+        write_string(out, e.detail.empty() ? e.name : e.name + " " + e.detail);
+        out << ", \"cat\": ";
+        write_string(out, e.name);
+        // timestamps are in microseconds
+        out << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.thread
+            << ", \"ts\": " << e.start / 1000.0 << ", \"dur\": " << e.nanos / 1000.0 << "}";
+    }
+    out << "\n]}\n";
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include "common.h"
+
+// Compile time instrumentation. Phases are scopes whose wall time and heap
+// allocations are summed by name; counters are sizes of the work done.
+// Nothing is recorded until enable() is called, so a disabled Phase costs
+// one branch. Every compile session owns a Stats, which stats() returns on
+// the threads working for it.
+
+enum class Counter : uint8_t {
+    Tokens,          // tokens lexed from the input
+    Functions,       // function bodies parsed
+    Nodes,           // AST nodes created
+    VarImports,      // variables copied into a function arena
+    Types,           // types created
+    IrInstructions,  // IR instructions after the passes
+    Instructions,    // machine instructions selected
+    OutputBytes,     // bytes of assembly written
+    CacheHits,       // files or functions taken from the compile cache
+    CacheMisses,     // files or functions compiled and added to it
+    Count,
+};
+
+// Heap allocations made by the current thread so far, as reported by
+// count_alloc(). The compiler's executable calls it from its operator new;
+// a program embedding the library keeps its own allocator and sees zeros
+// unless it does the same.
+struct AllocCount {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+};
+AllocCount thread_allocs();
+void count_alloc(size_t bytes);
+
+class Stats {
+    using Clock = chrono::steady_clock;
+    struct Total {
+        uint64_t nanos = 0;
+        uint64_t calls = 0;
+        AllocCount allocs;
+    };
+    struct Event {
+        string name;
+        string detail;
+        uint32_t thread;
+        uint64_t start;
+        uint64_t nanos;
+    };
+
+    bool m_enabled = false;
+    bool m_trace = false;
+    Clock::time_point m_start = Clock::now();
+    array<atomic<uint64_t>, static_cast<size_t>(Counter::Count)> m_counters{};
+    mutable mutex m_mutex;
+    vector<pair<string, Total>> m_phases; // in order of first occurrence
+    vector<Event> m_events;
+
+public:
+    // With trace, every occurrence of a phase is kept as well.
+    void enable(bool trace);
+    bool enabled() const { return m_enabled; }
+    bool tracing() const { return m_trace; }
+
+    void add(Counter counter, uint64_t n){
+        if (m_enabled){
+            m_counters[static_cast<size_t>(counter)].fetch_add(n, memory_order_relaxed);
+        }
+    }
+    void record(string_view name, string detail, Clock::time_point start, Clock::time_point end, AllocCount allocs);
+    // Adds the phases, counters and events of another Stats to this one.
+    void merge(const Stats& other);
+
+    // Table of the phases.
+    void report_time(ostream& out) const;
+    // Table of the counters and the peak memory.
+    void report_counters(ostream& out) const;
+    void write_json(ostream& out) const;
+    // Chrome trace event format, for chrome://tracing or Perfetto.
+    void write_trace(ostream& out) const;
+};
+
+// The Stats installed on this thread, or a disabled one.
+Stats& stats();
+
+// Installs a Stats on the current thread for the lifetime of the scope.
+class StatsScope {
+    Stats* m_previous;
+public:
+    explicit StatsScope(Stats& stats);
+    StatsScope(const StatsScope&) = delete;
+    ~StatsScope();
+};
+
+// Records the enclosing scope as one occurrence of a phase.
+class Phase {
+    string_view m_name;
+    string m_detail;
+    bool m_active;
+    chrono::steady_clock::time_point m_start;
+    AllocCount m_allocs;
+public:
+    explicit Phase(string_view name): m_name(name), m_active(stats().enabled()){
+        if (m_active){
+            m_allocs = thread_allocs();
+            m_start = chrono::steady_clock::now();
+        }
+    }
+    Phase(const Phase&) = delete;
+    ~Phase(){
+        if (m_active){
+            auto end = chrono::steady_clock::now();
+            auto allocs = thread_allocs();
+            allocs.count -= m_allocs.count;
+            allocs.bytes -= m_allocs.bytes;
+            stats().record(m_name, move(m_detail), m_start, end, allocs);
+        }
+    }
+    // Names the occurrence in the trace, e.g. with the function it works on.
+    void detail(const string& text){
+        if (m_active && stats().tracing()){
+            m_detail = text;
+        }
+    }
+};
+
+// Output buffer that counts the bytes passing through to another buffer.
+class CountingBuf : public streambuf {
+    streambuf* m_target;
+protected:
+    int overflow(int c) override {
+        if (c == EOF){
+            return traits_type::not_eof(c);
+        }
+        stats().add(Counter::OutputBytes, 1);
+        return m_target->sputc(c);
+    }
+    streamsize xsputn(const char* s, streamsize n) override {
+        stats().add(Counter::OutputBytes, n);
+        return m_target->sputn(s, n);
+    }
+    int sync() override { return m_target->pubsync(); }
+public:
+    explicit CountingBuf(streambuf* target): m_target(target){}
+};
@@ -17,7 +17,7 @@ assert() {
     input="$2"
 
     echo "$input" > /tmp/tmp.c
-    ./pontacc -o tmp.s /tmp/tmp.c || exit
+    ./pontacc $PONTACC_FLAGS -o tmp.s /tmp/tmp.c || exit
     gcc -static -o tmp tmp.s tmp2.o
     ./tmp
     actual="$?"
@@ -149,17 +149,17 @@ assert 3 'int main() { int x[2][3]; int *y=x; y[3]=3; return x[1][0]; }'
 assert 4 'int main() { int x[2][3]; int *y=x; y[4]=4; return x[1][1]; }'
 assert 5 'int main() { int x[2][3]; int *y=x; y[5]=5; return x[1][2]; }'
 
-assert 8 'int main() { int x; return sizeof(x); }'
-assert 8 'int main() { int x; return sizeof x; }'
+assert 4 'int main() { int x; return sizeof(x); }'
+assert 4 'int main() { int x; return sizeof x; }'
 assert 8 'int main() { int *x; return sizeof(x); }'
-assert 32 'int main() { int x[4]; return sizeof(x); }'
-assert 96 'int main() { int x[3][4]; return sizeof(x); }'
-assert 32 'int main() { int x[3][4]; return sizeof(*x); }'
-assert 8 'int main() { int x[3][4]; return sizeof(**x); }'
-assert 9 'int main() { int x[3][4]; return sizeof(**x) + 1; }'
-assert 9 'int main() { int x[3][4]; return sizeof **x + 1; }'
-assert 8 'int main() { int x[3][4]; return sizeof(**x + 1); }'
-assert 8 'int main() { int x=1; return sizeof(x=2); }'
+assert 16 'int main() { int x[4]; return sizeof(x); }'
+assert 48 'int main() { int x[3][4]; return sizeof(x); }'
+assert 16 'int main() { int x[3][4]; return sizeof(*x); }'
+assert 4 'int main() { int x[3][4]; return sizeof(**x); }'
+assert 5 'int main() { int x[3][4]; return sizeof(**x) + 1; }'
+assert 5 'int main() { int x[3][4]; return sizeof **x + 1; }'
+assert 4 'int main() { int x[3][4]; return sizeof(**x + 1); }'
+assert 4 'int main() { int x=1; return sizeof(x=2); }'
 assert 1 'int main() { int x=1; sizeof(x=2); return x; }'
 
 assert 0 'int x; int main() { return x; }'
@@ -171,8 +171,8 @@ assert 1 'int x[4]; int main() { x[0]=0; x[1]=1; x[2]=2; x[3]=3; return x[1]; }'
 assert 2 'int x[4]; int main() { x[0]=0; x[1]=1; x[2]=2; x[3]=3; return x[2]; }'
 assert 3 'int x[4]; int main() { x[0]=0; x[1]=1; x[2]=2; x[3]=3; return x[3]; }'
 
-assert 8 'int x; int main() { return sizeof(x); }'
-assert 32 'int x[4]; int main() { return sizeof(x); }'
+assert 4 'int x; int main() { return sizeof(x); }'
+assert 16 'int x[4]; int main() { return sizeof(x); }'
 
 assert 1 'int main() { char x=1; return x; }'
 assert 1 'int main() { char x=1; char y=2; return x; }'
@@ -180,6 +180,12 @@ assert 2 'int main() { char x=1; char y=2; return y; }'
 
 assert 1 'int main() { char x; return sizeof(x); }'
 assert 10 'int main() { char x[10]; return sizeof(x); }'
+assert 2 'int main() { short x; return sizeof(x); }'
+assert 8 'int main() { long x; return sizeof(x); }'
+assert 8 'int main() { int x; long y; return sizeof(x + y); }'
+assert 4 'int main() { char x; short y; return sizeof(x + y); }'
+assert 0 'int main() { long x=65536; int y=x*x; return y; }'
+assert 1 'long f() { long x=65536; return x*x; } int main() { return f() / 65536 == 65536; }'
 assert 1 'int main() { return sub_char(7, 3, 3); } int sub_char(char a, char b, char c) { return a-b-c; }'
 
 assert 0 'int main() { return ""[0]; }'
@@ -224,6 +230,8 @@ assert 2 'int main() { return ({ 0; 1; 2; }); }'
 assert 1 'int main() { ({ 0; return 1; 2; }); return 3; }'
 assert 6 'int main() { return ({ 1; }) + ({ 2; }) + ({ 3; }); }'
 assert 3 'int main() { return ({ int x=3; x; }); }'
+assert 2 'int main() { int x=1; return x + 1 + ({ x=5; 0; }); }'
+assert 7 'int main() { int x=1; int y=2; return (x + y) * 2 + ({ x=5; y=6; 1; }); }'
 
 assert 2 'int main() { /* return 1; */ return 2; }'
 assert 2 'int main() { // return 1;
@@ -18,6 +18,205 @@ rm -f $tmp/out
 [ -f $tmp/out ]
 check -o
 
+# read from stdin, write to stdout
+echo 'int main() { return 0; }' | ./pontacc - | grep -q 'main:'
+check stdin
+
+# output does not depend on the number of threads
+for i in 1 2 3 4 5 6 7 8; do
+    echo "int g$i; int f$i(int x) { char *s = \"f$i\"; return g$i + x + s[0]; }"
+done > $tmp/funcs.c
+./pontacc --threads=1 -o $tmp/out1 $tmp/funcs.c &&
+./pontacc --threads=4 -o $tmp/out4 $tmp/funcs.c &&
+cmp -s $tmp/out1 $tmp/out4
+check --threads
+
+# --pipeline emits the same code with the data sections last
+./pontacc --pipeline -o $tmp/outp $tmp/funcs.c &&
+sort $tmp/out1 > $tmp/sorted1 && sort $tmp/outp > $tmp/sortedp &&
+cmp -s $tmp/sorted1 $tmp/sortedp
+check --pipeline
+
+# --emit-ir lists the IR of every function instead of assembly
+./pontacc --emit-ir $tmp/funcs.c > $tmp/ir &&
+[ `grep -c '^func ' $tmp/ir` -eq 8 ] && ! grep -q 'main:\|\.text' $tmp/ir
+check --emit-ir
+
+# a long expression is lowered without recursing once per operand
+bench/gen.sh expr 32000 > $tmp/deep.c &&
+./pontacc --emit-ir -o $tmp/deep.ir $tmp/deep.c
+check "--emit-ir of a deep expression"
+
+# and compiled into trees of bounded depth
+awk 'BEGIN { printf "int main() { int x; x = 1; return x"; for (i = 1; i < 20000; i++) printf " + x"; print " - 19958; }" }' > $tmp/deepsum.c
+status=0
+for o in -O0 -O2; do
+    ./pontacc $o -o $tmp/deepsum.s $tmp/deepsum.c && cc -o $tmp/deepsum $tmp/deepsum.s 2> /dev/null && $tmp/deepsum
+    [ $? -eq 42 ] || status=1
+done
+[ $status -eq 0 ] && ./pontacc -o /dev/null $tmp/deep.c
+check "deep expression"
+
+# optimization levels change the code but not its result
+cat > $tmp/opt.c <<EOF
+int g; int f(int x) { int y; y = x * 1 + 0; if (2 < 1) return 9; g = y; return g + y; }
+int main() { char s[3]; s[1] = 4; return f(3) + s[1] * (10 - 2 * 5); }
+EOF
+status=6
+for o in -O0 -O1 -O2 --passes=fold,forward,dce,simplify-cfg; do
+    ./pontacc $o -o $tmp/opt.s $tmp/opt.c && cc -o $tmp/opt $tmp/opt.s 2> /dev/null && $tmp/opt
+    [ $? -eq 6 ] || status=$?
+done
+[ $status -eq 6 ]
+check -O
+
+# unknown passes are rejected
+! ./pontacc --passes=fold,nope $tmp/empty.c 2> /dev/null
+check --passes
+
+# --time-passes reports every pass of the pipeline
+./pontacc -O1 --time-passes -o /dev/null $tmp/funcs.c 2>&1 | grep -q '^dce '
+check --time-passes
+
+# -ftime-report and --stats report on stderr without changing the output
+./pontacc -ftime-report --stats -o $tmp/outs $tmp/funcs.c 2> $tmp/report &&
+cmp -s $tmp/out1 $tmp/outs && grep -q '^codegen ' $tmp/report && grep -q '^functions  *8$' $tmp/report
+check -ftime-report
+
+# --stats-json and --trace write files
+./pontacc --stats-json=$tmp/stats.json --trace=$tmp/trace.json -o /dev/null $tmp/funcs.c &&
+grep -q '"parse function"' $tmp/stats.json && grep -q '"traceEvents"' $tmp/trace.json &&
+[ `grep -c '"ph": "X"' $tmp/trace.json` -ge 16 ]
+check --stats-json
+
+# errors are reported with their position and leave no output behind
+printf 'int main() {\n  return 1 $ 2;\n}\n' > $tmp/error.c
+status=0
+for mode in --threads=1 --threads=4 --pipeline; do
+    rm -f $tmp/error.s
+    ./pontacc $mode -o $tmp/error.s $tmp/error.c 2> $tmp/error.txt
+    [ $? -eq 1 ] && [ ! -f $tmp/error.s ] && grep -q '^           ^ Unknown operator$' $tmp/error.txt || status=1
+done
+[ $status -eq 0 ]
+check error
+
+# several inputs compile to their own .s files, also when listed in a response file
+mkdir $tmp/batch
+for i in 1 2 3 4 5; do cp $tmp/funcs.c $tmp/batch/f$i.c; done
+echo "$tmp/batch/f3.c '$tmp/batch/f4.c'" > $tmp/batch/more.rsp
+echo "$tmp/batch/f5.c" > $tmp/batch/last.rsp
+echo "@$tmp/batch/last.rsp" >> $tmp/batch/more.rsp
+./pontacc --threads=1 -j 3 $tmp/batch/f1.c $tmp/batch/f2.c @$tmp/batch/more.rsp 2> $tmp/summary &&
+grep -q '5 files, 0 failed' $tmp/summary &&
+for i in 1 2 3 4 5; do cat $tmp/out1 >> $tmp/expected; cat $tmp/batch/f$i.s >> $tmp/actual; done &&
+cmp -s $tmp/expected $tmp/actual
+check -j
+
+# a failing input does not stop the others
+rm -f $tmp/batch/*.s
+! ./pontacc -j 2 $tmp/batch/f1.c $tmp/error.c $tmp/batch/f2.c 2> $tmp/summary &&
+[ -f $tmp/batch/f1.s ] && [ -f $tmp/batch/f2.s ] && grep -q '3 files, 1 failed' $tmp/summary &&
+grep -q "^$tmp/error.c:2:12: Unknown operator" $tmp/summary
+check "-j with an error"
+
+# the preprocessor reads headers from -I directories, takes -D definitions
+# and reports errors in a header with its name
+mkdir $tmp/include
+cat > $tmp/include/macros.h <<EOF
+#ifndef MACROS_H
+#define MACROS_H
+#define SQUARE(x) ((x) * (x))
+#define CAT(a, b) a ## b
+#endif
+EOF
+cat > $tmp/pp.c <<EOF
+#include <macros.h>
+#include "include/macros.h"
+#if defined(BASE) && BASE > 1
+int main() { int CAT(v, 1) = SQUARE(BASE); return v1 - 1; }
+#else
+int main() { return 1; }
+#endif
+EOF
+./pontacc -I $tmp/include -DBASE=3 -o $tmp/pp.s $tmp/pp.c && cc -o $tmp/pp $tmp/pp.s 2> /dev/null && $tmp/pp
+[ $? -eq 8 ] && ./pontacc -E -I $tmp/include $tmp/pp.c | grep -q 'return 1' &&
+printf 'int f() {\n  return 1 $ 2;\n}\n' > $tmp/include/bad.h && echo '#include "include/bad.h"' > $tmp/bad.c &&
+! ./pontacc -o /dev/null $tmp/bad.c 2> $tmp/error.txt && grep -q "^$tmp/include/bad.h:2:12:$" $tmp/error.txt
+check -I
+
+# -D and __LINE__ apply to input without directives too
+echo 'int main() { return N + __LINE__; }' > $tmp/nodirectives.c
+./pontacc -DN=3 -o $tmp/nodirectives.s $tmp/nodirectives.c && cc -o $tmp/nodirectives $tmp/nodirectives.s 2> /dev/null && $tmp/nodirectives
+[ $? -eq 4 ]
+check "-D without directives"
+
+# --cache reuses whole files, and with --cache-functions the unchanged
+# functions of a changed file
+./pontacc --cache=$tmp/cache -o $tmp/outc $tmp/funcs.c &&
+./pontacc --cache=$tmp/cache --stats -o $tmp/outc $tmp/funcs.c 2> $tmp/report &&
+cmp -s $tmp/out1 $tmp/outc && grep -q '^cache hits  *1$' $tmp/report &&
+./pontacc --cache=$tmp/fcache --cache-functions -o $tmp/outc $tmp/funcs.c &&
+sed 's/return g3 + x/return g3 - x/' $tmp/funcs.c > $tmp/funcs2.c && ./pontacc -o $tmp/out2 $tmp/funcs2.c &&
+./pontacc --cache=$tmp/fcache --cache-functions --stats -o $tmp/outc $tmp/funcs2.c 2> $tmp/report &&
+cmp -s $tmp/out2 $tmp/outc && grep -q '^cache hits  *7$' $tmp/report && grep -q '^cache misses  *2$' $tmp/report
+check --cache
+
+# a server compiles for clients like a local run, and clients fall back to
+# compiling themselves when no server listens
+./pontacc --client=$tmp/none.sock -o $tmp/outc $tmp/funcs.c && cmp -s $tmp/out1 $tmp/outc
+check "--client without a server"
+./pontacc --server=$tmp/sock & server=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do [ -S $tmp/sock ] && break; sleep 0.1; done
+cd $tmp && $OLDPWD/pontacc --client=$tmp/sock -o outc funcs.c; status=$?; cd $OLDPWD
+[ $status -eq 0 ] && cmp -s $tmp/out1 $tmp/outc &&
+./pontacc --client=$tmp/sock --threads=1 < $tmp/funcs.c - > $tmp/outc && cmp -s $tmp/out1 $tmp/outc &&
+./pontacc --client=$tmp/sock -o $tmp/outc $tmp/funcs.c && cmp -s $tmp/out1 $tmp/outc
+status=$?
+./pontacc --client=$tmp/sock -o $tmp/error.s $tmp/error.c 2> $tmp/error.txt
+[ $? -eq 1 ] && grep -q '^           ^ Unknown operator$' $tmp/error.txt || status=1
+kill $server; wait $server 2> /dev/null
+[ $status -eq 0 ] && [ ! -S $tmp/sock ]
+check --server
+
+# -c writes an object next to the input that links like the assembly,
+# and with several inputs an object for each
+cp $tmp/opt.c $tmp/obj.c
+./pontacc -c $tmp/obj.c && cc -o $tmp/obj $tmp/obj.o && $tmp/obj
+[ $? -eq 6 ] && ./pontacc -O2 -c -o $tmp/obj2.o $tmp/opt.c && cc -o $tmp/obj2 $tmp/obj2.o && $tmp/obj2
+[ $? -eq 6 ] && ./pontacc -c -j 2 $tmp/batch/f1.c $tmp/batch/f2.c 2> /dev/null &&
+nm $tmp/batch/f1.o | grep -q ' T f8$' && nm $tmp/batch/f2.o | grep -q ' B g8$' &&
+! ./pontacc -c --emit-ir $tmp/obj.c 2> /dev/null
+check -c
+
+# globals are aligned like gcc aligns them, in objects and in assembly
+echo 'char c; int x; short s; long l; char a[16];' > $tmp/align.c
+./pontacc -c $tmp/align.c && nm $tmp/align.o > $tmp/align.txt &&
+grep -q '^0000000000000004 B x$' $tmp/align.txt && grep -q '^0000000000000008 B s$' $tmp/align.txt &&
+grep -q '^0000000000000010 B l$' $tmp/align.txt && grep -q '^0000000000000020 B a$' $tmp/align.txt &&
+./pontacc -o $tmp/align.s $tmp/align.c && grep -B1 '^x:$' $tmp/align.s | grep -q '\.align 4$' &&
+grep -B1 '^a:$' $tmp/align.s | grep -q '\.align 16$' && cc -c -o $tmp/align_s.o $tmp/align.s &&
+nm $tmp/align_s.o | grep -q '^0000000000000004 [BD] x$'
+check "global alignment"
+
+# --run calls main in memory with the arguments after the input, and
+# resolves functions in libc and in the --load libraries
+./pontacc --run $tmp/opt.c
+[ $? -eq 6 ] && echo 'int main(int argc, char **argv) { printf("%s", argv[2]); return argc; }' > $tmp/run.c &&
+./pontacc -O2 --run $tmp/run.c a bc > $tmp/run.txt
+[ $? -eq 3 ] && [ "`cat $tmp/run.txt`" = "bc" ] &&
+echo 'int twice(int x) { return x * 2; }' > $tmp/lib.c && cc -shared -fPIC -o $tmp/lib.so $tmp/lib.c &&
+echo 'int main() { return twice(21); }' > $tmp/uselib.c && ./pontacc --run --load=$tmp/lib.so $tmp/uselib.c
+[ $? -eq 42 ] && ! ./pontacc --run $tmp/uselib.c 2> $tmp/error.txt && grep -q 'undefined symbol: twice' $tmp/error.txt
+check --run
+
+# --interpret runs the same programs without generating code
+./pontacc --interpret $tmp/opt.c
+[ $? -eq 6 ] && ./pontacc -O2 --interpret $tmp/run.c a bc > $tmp/run.txt
+[ $? -eq 3 ] && [ "`cat $tmp/run.txt`" = "bc" ] && ./pontacc --interpret --load=$tmp/lib.so $tmp/uselib.c
+[ $? -eq 42 ] && echo 'int main() { int x; x = 0; return 1 / x; }' > $tmp/div.c &&
+! ./pontacc --interpret $tmp/div.c 2> $tmp/error.txt && grep -q 'division by zero' $tmp/error.txt
+check --interpret
+
 # --help
 ./pontacc --help 2>&1 | grep -q pontacc
 check --help
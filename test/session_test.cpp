@@ -0,0 +1,81 @@
+// Compiles snippets through the library on several threads at once, each
+// thread with sessions of its own, and checks that every result matches
+// the output of a session used alone.
+#include "../pontacc.h"
+
+static string snippet(int i){
+    return "int g" + to_string(i) + "; int f(int x) { char *s = \"s" + to_string(i) + "\"; return x * "
+        + to_string(i) + " + s[0]; } int main() { return f(" + to_string(i) + "); }";
+}
+
+int main(){
+    constexpr int threads = 4, per_thread = 200;
+    vector<string> expected;
+    Session reference;
+    for (int i = 0; i < threads * per_thread; ++i){
+        auto result = reference.compile(snippet(i));
+        if (!result.ok()){
+            cerr << "unexpected error: " << result.error->to_string();
+            return 1;
+        }
+        expected.push_back(result.assembly);
+    }
+    atomic<int> failures = 0;
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t){
+        workers.emplace_back([&, t]{
+            CompileOptions options;
+            options.level = t % 3;
+            options.threads = 2;
+            options.pipeline = t == 3;
+            options.stats = true;
+            Session session(options);
+            for (int i = t * per_thread; i < (t + 1) * per_thread; ++i){
+                auto result = session.compile(snippet(i));
+                // optimized output differs, so only -O0 is compared
+                if (!result.ok() || (options.level == 0 && !options.pipeline && result.assembly != expected[i])){
+                    ++failures;
+                }
+            }
+        });
+    }
+    for (auto& w : workers){
+        w.join();
+    }
+    if (failures){
+        cerr << failures << " snippets were compiled differently" << endl;
+        return 1;
+    }
+    auto result = reference.compile("int main() {\n  return 1 +;\n}\n");
+    if (result.ok() || result.error->line != 2 || result.error->column != 13){
+        cerr << "wrong diagnostic" << endl;
+        return 1;
+    }
+    for (auto text : {";", "main() { return 0; }"}){
+        auto result = reference.compile(text);
+        if (result.ok() || result.error->column != 1){
+            cerr << "no diagnostic for a missing type" << endl;
+            return 1;
+        }
+    }
+    // the first error in the source is reported whatever the thread count,
+    // even when the functions after it fail sooner
+    string source = "int f0() { int x = 0;";
+    for (int i = 0; i < 2000; ++i){
+        source += " x = x + " + to_string(i) + ";";
+    }
+    source += " return x +; }";
+    for (int i = 1; i < 8; ++i){
+        source += " int f" + to_string(i) + "() { return +; }";
+    }
+    for (size_t threads : {1, 4, 8}){
+        CompileOptions options;
+        options.threads = threads;
+        auto result = Session(options).compile(source);
+        if (result.ok() || result.error->column != source.find("+; }") + 2){
+            cerr << "wrong diagnostic with " << threads << " threads" << endl;
+            return 1;
+        }
+    }
+    cout << "OK" << endl;
+}
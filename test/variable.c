@@ -13,17 +13,17 @@ int main() {
   ASSERT(3, ({ int foo=3; foo; }));
   ASSERT(8, ({ int foo123=3; int bar=5; foo123+bar; }));
 
-  ASSERT(8, ({ int x; sizeof(x); }));
-  ASSERT(8, ({ int x; sizeof x; }));
+  ASSERT(4, ({ int x; sizeof(x); }));
+  ASSERT(4, ({ int x; sizeof x; }));
   ASSERT(8, ({ int *x; sizeof(x); }));
-  ASSERT(32, ({ int x[4]; sizeof(x); }));
-  ASSERT(96, ({ int x[3][4]; sizeof(x); }));
-  ASSERT(32, ({ int x[3][4]; sizeof(*x); }));
-  ASSERT(8, ({ int x[3][4]; sizeof(**x); }));
-  ASSERT(9, ({ int x[3][4]; sizeof(**x) + 1; }));
-  ASSERT(9, ({ int x[3][4]; sizeof **x + 1; }));
-  ASSERT(8, ({ int x[3][4]; sizeof(**x + 1); }));
-  ASSERT(8, ({ int x=1; sizeof(x=2); }));
+  ASSERT(16, ({ int x[4]; sizeof(x); }));
+  ASSERT(48, ({ int x[3][4]; sizeof(x); }));
+  ASSERT(16, ({ int x[3][4]; sizeof(*x); }));
+  ASSERT(4, ({ int x[3][4]; sizeof(**x); }));
+  ASSERT(5, ({ int x[3][4]; sizeof(**x) + 1; }));
+  ASSERT(5, ({ int x[3][4]; sizeof **x + 1; }));
+  ASSERT(4, ({ int x[3][4]; sizeof(**x + 1); }));
+  ASSERT(4, ({ int x=1; sizeof(x=2); }));
   ASSERT(1, ({ int x=1; sizeof(x=2); x; }));
 
   ASSERT(0, g1);
@@ -33,8 +33,8 @@ int main() {
   ASSERT(2, ({ g2[0]=0; g2[1]=1; g2[2]=2; g2[3]=3; g2[2]; }));
   ASSERT(3, ({ g2[0]=0; g2[1]=1; g2[2]=2; g2[3]=3; g2[3]; }));
 
-  ASSERT(8, sizeof(g1));
-  ASSERT(32, sizeof(g2));
+  ASSERT(4, sizeof(g1));
+  ASSERT(16, sizeof(g2));
 
   ASSERT(1, ({ char x=1; x; }));
   ASSERT(1, ({ char x=1; char y=2; x; }));
@@ -43,6 +43,23 @@ int main() {
   ASSERT(1, ({ char x; sizeof(x); }));
   ASSERT(10, ({ char x[10]; sizeof(x); }));
 
+  ASSERT(2, ({ short x; sizeof(x); }));
+  ASSERT(4, ({ short int x[2]; sizeof(x); }));
+  ASSERT(8, ({ long x; sizeof(x); }));
+  ASSERT(8, ({ long long int x; sizeof(x); }));
+  ASSERT(8, ({ int x; long y; sizeof(x + y); }));
+  ASSERT(4, ({ char x; short y; sizeof(x + y); }));
+  ASSERT(-1, ({ short x = 65535; x; }));
+  ASSERT(1, ({ int x[2]; x[0] = 1; x[1] = 2; x[0]; }));
+  ASSERT(2, ({ int x[2]; x[0] = 1; x[1] = 2; x[1]; }));
+  ASSERT(65536, ({ long x = 65536; long y = x * x; y / 65536; }));
+  ASSERT(0, ({ long x = 65536; int y = x * x; y; }));
+  ASSERT(0, ({ long x; x = 4294967296; x == 0; }));
+  ASSERT(1, ({ long x = 4294967297; x / 65536 / 65536; }));
+  ASSERT(3, ({ long x = 4294967299; x - 4294967296; }));
+  ASSERT(4, ({ sizeof(2147483647); }));
+  ASSERT(8, ({ sizeof(2147483648); }));
+
   ASSERT(2, ({ int x=2; { int x=3; } x; }));
   ASSERT(2, ({ int x=2; { int x=3; } int y=4; x; }));
   ASSERT(3, ({ int x=2; { x=3; } x; }));
@@ -0,0 +1,107 @@
+#pragma once
+#include "common.h"
+
+// Fixed set of worker threads. run() hands the indices [0, n) out to the
+// workers and to the calling thread, and returns when all of them are done.
+// An exception thrown by a job stops the remaining indices from being
+// started; the jobs already started finish, and the exception of the lowest
+// index is rethrown by run(), so which one is reported does not depend on
+// the number of threads. A job can also be told which thread
+// runs it: the caller is worker 0 and the pool threads are 1 to size() - 1.
+class ThreadPool {
+    vector<thread> m_threads;
+    mutex m_mutex;
+    condition_variable m_wake;
+    condition_variable m_done;
+    function<void(size_t, size_t)> m_job;
+    size_t m_size = 0;
+    atomic<size_t> m_next = 0;
+    size_t m_pending = 0;       // workers still on the current job
+    uint64_t m_generation = 0;  // bumped for every job
+    bool m_stop = false;
+    exception_ptr m_error;
+    size_t m_error_index = 0;
+
+    void work(size_t worker){
+        for (size_t i; (i = m_next++) < m_size;){
+            try {
+                m_job(i, worker);
+            }
+            catch (...){
+                lock_guard lock(m_mutex);
+                // indices are handed out in order, so every lower one has started
+                if (!m_error || i < m_error_index){
+                    m_error = current_exception();
+                    m_error_index = i;
+                }
+                m_next = m_size;
+            }
+        }
+    }
+
+    void loop(size_t worker){
+        uint64_t seen = 0;
+        unique_lock lock(m_mutex);
+        while (true){
+            m_wake.wait(lock, [&]{ return m_stop || m_generation != seen; });
+            if (m_stop){
+                return;
+            }
+            seen = m_generation;
+            lock.unlock();
+            work(worker);
+            lock.lock();
+            if (--m_pending == 0){
+                m_done.notify_one();
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threads){
+        for (size_t i = 1; i < threads; ++i){
+            m_threads.emplace_back([this, i]{ loop(i); });
+        }
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ~ThreadPool(){
+        {
+            lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto& t : m_threads){
+            t.join();
+        }
+    }
+
+    size_t size() const { return m_threads.size() + 1; }
+
+    void run(size_t n, function<void(size_t)> job){
+        run_on_workers(n, [&job](size_t i, size_t){ job(i); });
+    }
+
+    void run_on_workers(size_t n, function<void(size_t index, size_t worker)> job){
+        if (m_threads.empty() || n <= 1){
+            for (size_t i = 0; i < n; ++i){
+                job(i, 0);
+            }
+            return;
+        }
+        {
+            lock_guard lock(m_mutex);
+            m_job = move(job);
+            m_size = n;
+            m_next = 0;
+            m_pending = m_threads.size();
+            ++m_generation;
+        }
+        m_wake.notify_all();
+        work(0);
+        unique_lock lock(m_mutex);
+        m_done.wait(lock, [&]{ return m_pending == 0; });
+        if (m_error){
+            rethrow_exception(exchange(m_error, nullptr));
+        }
+    }
+};
@@ -1,84 +1,620 @@
-
 #pragma once
 #include "common.h"
+#include "spsc_queue.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-enum class TokenKind {
+enum class TokenKind : uint8_t {
     Unknown,
     Num,
     Punct,
     Ident,
     Keyword,
     String,
+    Eof,
+};
+
+enum class Punct : uint8_t {
+    None,
+    Le, Ge, Eq, Ne,
+    Plus, Minus, Star, Slash,
+    LParen, RParen, Lt, Gt, Assign, Semicolon,
+    LBrace, RBrace, Amp, Comma, LBracket, RBracket,
+};
+
+// Spelling of each Punct.
+inline constexpr pair<string_view, Punct> punct_spellings[] = {
+    {"<=", Punct::Le}, {">=", Punct::Ge}, {"==", Punct::Eq}, {"!=", Punct::Ne},
+    {"+", Punct::Plus}, {"-", Punct::Minus}, {"*", Punct::Star}, {"/", Punct::Slash},
+    {"(", Punct::LParen}, {")", Punct::RParen}, {"<", Punct::Lt}, {">", Punct::Gt},
+    {"=", Punct::Assign}, {";", Punct::Semicolon}, {"{", Punct::LBrace}, {"}", Punct::RBrace},
+    {"&", Punct::Amp}, {",", Punct::Comma}, {"[", Punct::LBracket}, {"]", Punct::RBracket},
+};
+
+inline constexpr string_view to_string(Punct punct){
+    for (auto [spelling, p] : punct_spellings){
+        if (p == punct){
+            return spelling;
+        }
+    }
+    return "";
+}
+
+// Keywords are interned first, so their ids are the enum values.
+enum class Keyword : uint32_t {
+    Return, If, Else, For, While, Continue, Break, Int, Char, Sizeof, Short, Long,
+    Count
+};
+
+inline constexpr string_view keywords[] = {
+    "return", "if", "else", "for", "while", "continue", "break", "int", "char", "sizeof", "short", "long",
+};
+static_assert(size(keywords) == static_cast<size_t>(Keyword::Count));
+
+// Keyword lookup through a perfect hash generated at compile time. The
+// hash only looks at the length and the first and last characters.
+inline constexpr size_t keyword_table_size = 32;
+
+constexpr uint32_t keyword_hash(string_view s, uint32_t seed){
+    return (static_cast<uint8_t>(s[0]) * seed + static_cast<uint8_t>(s.back()) + s.size() * 3) % keyword_table_size;
+}
+
+constexpr uint32_t find_keyword_seed(){
+    for (uint32_t seed = 1; seed < 1000; ++seed){
+        array<bool, keyword_table_size> used{};
+        bool collision = false;
+        for (auto keyword : keywords){
+            auto h = keyword_hash(keyword, seed);
+            collision |= used[h];
+            used[h] = true;
+        }
+        if (!collision){
+            return seed;
+        }
+    }
+    return 0;
+}
+
+inline constexpr uint32_t keyword_seed = find_keyword_seed();
+static_assert(keyword_seed != 0, "no perfect hash for the keyword set");
+
+// Keyword index + 1 for each hash slot, 0 for empty slots.
+inline constexpr auto keyword_table = []{
+    array<uint8_t, keyword_table_size> table{};
+    for (size_t i = 0; i < size(keywords); ++i){
+        table[keyword_hash(keywords[i], keyword_seed)] = i + 1;
+    }
+    return table;
+}();
+
+constexpr optional<Keyword> find_keyword(string_view s){
+    if (s.size() < 2 || s.size() > 8){
+        return nullopt;
+    }
+    auto index = keyword_table[keyword_hash(s, keyword_seed)];
+    if (index == 0 || keywords[index - 1] != s){
+        return nullopt;
+    }
+    return static_cast<Keyword>(index - 1);
+}
+static_assert(find_keyword("sizeof") == Keyword::Sizeof && !find_keyword("size"));
+
+// Character classes used to dispatch on the first byte of a token.
+enum CharClass : uint8_t {
+    CC_Space = 1,
+    CC_Digit = 2,
+    CC_IdentStart = 4,
+    CC_Punct = 8,
+    CC_Quote = 16,
 };
 
-inline set<string> keywords = {
-    "return",
-    "if",
-    "else",
-    "for",
-    "while",
-    "continue",
-    "break",
-    "int",
-    "char",
-    "sizeof"
+inline constexpr auto char_class = []{
+    array<uint8_t, 256> table{};
+    for (char c : string_view(" \t\n\v\f\r")){
+        table[static_cast<uint8_t>(c)] = CC_Space;
+    }
+    for (int c = '0'; c <= '9'; ++c){
+        table[c] = CC_Digit;
+    }
+    for (int c = 'a'; c <= 'z'; ++c){
+        table[c] = table[c - 'a' + 'A'] = CC_IdentStart;
+    }
+    table['_'] = CC_IdentStart;
+    for (char c : string_view("<>=!+-*/(),;{}&[]")){
+        table[static_cast<uint8_t>(c)] = CC_Punct;
+    }
+    table['"'] = CC_Quote;
+    return table;
+}();
+
+inline bool is_ident_char(char c){
+    return char_class[static_cast<uint8_t>(c)] & (CC_Digit | CC_IdentStart);
+}
+
+// Two-state maximal-munch DFA for punctuators: the first character selects
+// a state, and a following '=' may extend it.
+struct PunctState {
+    Punct single = Punct::None;
+    Punct with_eq = Punct::None;
 };
 
+inline constexpr auto punct_states = []{
+    array<PunctState, 256> table{};
+    for (auto [spelling, punct] : punct_spellings){
+        auto& state = table[static_cast<uint8_t>(spelling[0])];
+        if (spelling.size() == 1){
+            state.single = punct;
+        }
+        else {
+            state.with_eq = punct;
+        }
+    }
+    return table;
+}();
+
+// Bulk scanners. Each returns the first position at or after p that stops
+// the run; the SSE2 versions test 16 bytes per step and fall back to the
+// scalar loop for the tail.
+#ifdef __SSE2__
+inline __m128i sse_in_range(__m128i x, char lo, char hi){
+    auto ge = _mm_cmpeq_epi8(_mm_max_epu8(x, _mm_set1_epi8(lo)), x);
+    auto le = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(hi)), x);
+    return _mm_and_si128(ge, le);
+}
+
+template<class Match>
+inline size_t sse_find(string_view text, size_t p, Match match){
+    while (p + 16 <= text.size()){
+        auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text.data() + p));
+        if (uint32_t mask = _mm_movemask_epi8(match(x))){
+            return p + countr_zero(mask);
+        }
+        p += 16;
+    }
+    return p;
+}
+#endif
+
+inline size_t skip_space(string_view text, size_t p){
+    // most runs are empty or a single blank
+    if (p < text.size() && !(char_class[static_cast<uint8_t>(text[p])] & CC_Space)){
+        return p;
+    }
+    if (p + 1 < text.size() && !(char_class[static_cast<uint8_t>(text[p + 1])] & CC_Space)){
+        return p + 1;
+    }
+#ifdef __SSE2__
+    p = sse_find(text, p, [](__m128i x){
+        auto space = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), sse_in_range(x, '\t', '\r'));
+        return _mm_xor_si128(space, _mm_set1_epi8(-1));
+    });
+#endif
+    while (p < text.size() && (char_class[static_cast<uint8_t>(text[p])] & CC_Space)){
+        ++p;
+    }
+    return p;
+}
+
+inline size_t skip_ident(string_view text, size_t p){
+#ifdef __SSE2__
+    p = sse_find(text, p, [](__m128i x){
+        auto lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        auto ident = _mm_or_si128(_mm_or_si128(sse_in_range(x, '0', '9'), sse_in_range(lower, 'a', 'z')),
+                                  _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+        return _mm_xor_si128(ident, _mm_set1_epi8(-1));
+    });
+#endif
+    while (p < text.size() && is_ident_char(text[p])){
+        ++p;
+    }
+    return p;
+}
+
+// Position of the first c1 or c2 at or after p, or text.size().
+inline size_t find_either(string_view text, size_t p, char c1, char c2){
+#ifdef __SSE2__
+    p = sse_find(text, p, [c1, c2](__m128i x){
+        return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(c1)), _mm_cmpeq_epi8(x, _mm_set1_epi8(c2)));
+    });
+#endif
+    while (p < text.size() && text[p] != c1 && text[p] != c2){
+        ++p;
+    }
+    return p;
+}
+
+// Position just past the "*/" closing a block comment whose body starts at p.
+inline size_t skip_block_comment(string_view text, size_t p){
+    while ((p = find_either(text, p, '*', '*')) < text.size()){
+        if (p + 1 < text.size() && text[p + 1] == '/'){
+            return p + 2;
+        }
+        ++p;
+    }
+    return text.size();
+}
+
+// The value of a string of decimal digits, or nullopt when it does not fit
+// in an int64_t.
+inline optional<int64_t> parse_decimal(string_view digits){
+    uint64_t value = 0;
+    for (auto c : digits){
+        value = value * 10 + (c - '0');
+        if (value > static_cast<uint64_t>(numeric_limits<int64_t>::max())){
+            return nullopt;
+        }
+    }
+    return static_cast<int64_t>(value);
+}
+
+// Byte offset into the source. 64-bit so that inputs over 4 GB work.
+using SourceLoc = uint64_t;
+
 struct Token {
-    int val;
-    shared_ptr<const string> text;
-    string punct;
-    string ident;
-    TokenKind kind;
-    // info 
-    string_view statement;
-    string_view m_curr_line;
-    int loc; // Token location
-    int len;   // Token length
-    int m_line_no;
-    int m_line_pos;
+    SourceLoc loc = 0;  // offset of the token in the source
+    uint32_t id = 0;    // Punct, interned identifier or keyword; a number is read by TokenStream::num
+    uint32_t len = 0;
+    TokenKind kind = TokenKind::Unknown;
+
+    Punct punct() const { return static_cast<Punct>(id); }
+};
 
-    Token () = default;
+// Owns one copy of every distinct identifier spelling. Lookup is an
+// open-addressing table of ids keyed by an FNV-1a hash.
+//
+// Names are stored in chunks of doubling size that never move, so name()
+// may be called from other threads while intern() adds new names, for any
+// id that was handed over to them after it was interned.
+class Interner {
+    static constexpr size_t first_chunk = 256;
+    array<unique_ptr<string[]>, 32> m_chunks;
+    uint32_t m_size = 0;
+    vector<uint64_t> m_hashes;
+    vector<uint32_t> m_slots = vector<uint32_t>(1024); // id + 1, 0 when empty
 
-    int from_num(string_view statement) {
-        char* next;
-        auto p = statement.data();
-        val = strtol(p, &next, 10);
-        len = next - p;
-        if (len == 0){
-            return len;
+    static uint64_t hash(string_view name){
+        uint64_t h = 14695981039346656037ull;
+        for (unsigned char c : name){
+            h = (h ^ c) * 1099511628211ull;
         }
-        kind = TokenKind::Num;
-        return len;
+        return h;
     }
 
-    int from_punct(string_view punct_) {
-        kind = TokenKind::Punct;
-        punct = punct_;
-        len = punct_.size();
-        return len;
+    // Chunk k holds first_chunk << k names.
+    static pair<size_t, size_t> locate(uint32_t id){
+        auto n = id / first_chunk + 1;
+        auto k = bit_width(n) - 1;
+        return {k, id - first_chunk * ((size_t{1} << k) - 1)};
+    }
+    string& slot_name(uint32_t id) const{
+        auto [k, i] = locate(id);
+        return m_chunks[k][i];
     }
 
-    static bool is_identifier_char(char c){
-        return ('0'<= c && c <= '9') || ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
+    void grow(){
+        vector<uint32_t> slots(m_slots.size() * 2);
+        auto mask = slots.size() - 1;
+        for (uint32_t id = 0; id < m_size; ++id){
+            auto i = m_hashes[id] & mask;
+            while (slots[i]){
+                i = (i + 1) & mask;
+            }
+            slots[i] = id + 1;
+        }
+        m_slots = move(slots);
+    }
+public:
+    Interner(){
+        for (auto keyword : keywords){
+            intern(keyword);
+        }
+    }
+    uint32_t intern(string_view name){
+        auto h = hash(name);
+        auto mask = m_slots.size() - 1;
+        auto i = h & mask;
+        while (auto slot = m_slots[i]){
+            if (m_hashes[slot - 1] == h && slot_name(slot - 1) == name){
+                return slot - 1;
+            }
+            i = (i + 1) & mask;
+        }
+        uint32_t id = m_size;
+        auto [k, index] = locate(id);
+        if (index == 0){
+            m_chunks[k] = make_unique<string[]>(first_chunk << k);
+        }
+        m_chunks[k][index] = name;
+        ++m_size;
+        m_hashes.push_back(h);
+        m_slots[i] = id + 1;
+        if (m_size * 2 > m_slots.size()){
+            grow();
+        }
+        return id;
+    }
+    // Id of an already interned spelling. Safe to call from several threads
+    // as long as nothing is being interned.
+    uint32_t find(string_view name) const{
+        auto h = hash(name);
+        auto mask = m_slots.size() - 1;
+        for (auto i = h & mask; auto slot = m_slots[i]; i = (i + 1) & mask){
+            if (m_hashes[slot - 1] == h && slot_name(slot - 1) == name){
+                return slot - 1;
+            }
+        }
+        throw logic_error("identifier was not interned: " + string(name));
     }
+    bool is_keyword(uint32_t id) const { return id < static_cast<uint32_t>(Keyword::Count); }
+    const string& name(uint32_t id) const { return slot_name(id); }
+};
+
+// Source text of a translation unit with a line index that is built only
+// when a diagnostic needs a line and column.
+class Source {
+    string_view m_text;
+    mutable vector<size_t> m_line_starts;
+    mutable once_flag m_line_starts_built;
+public:
+    explicit Source(string_view text): m_text(text) {}
+
+    string_view text() const { return m_text; }
+    size_t size() const { return m_text.size(); }
+    char operator[](size_t pos) const { return m_text[pos]; }
+    string_view substr(size_t pos, size_t len = string_view::npos) const { return m_text.substr(pos, len); }
 
-    int from_ident(string_view statement){
-        int pos = 0;
-        while(pos < statement.size() && is_identifier_char(statement[pos])){
-            pos += 1;
+    // Returns the 0-based line and column of a source offset.
+    pair<size_t, size_t> line_col(SourceLoc loc) const{
+        call_once(m_line_starts_built, [this]{
+            m_line_starts.push_back(0);
+            for (size_t i = 0; i < m_text.size(); ++i){
+                if (m_text[i] == '\n'){
+                    m_line_starts.push_back(i + 1);
+                }
+            }
+        });
+        auto line = upper_bound(m_line_starts.begin(), m_line_starts.end(), loc) - m_line_starts.begin() - 1;
+        return {line, loc - m_line_starts[line]};
+    }
+
+    [[noreturn]] void error_at(SourceLoc loc, string_view fmt, bool next=false) const{
+        auto [line, col] = line_col(loc);
+        verror_at(m_text.substr(loc - col), line, col, fmt, next);
+    }
+};
+
+// Produces one token per call to next(). After the last token it keeps
+// returning an Eof token located at the end of the source. A lexer built
+// over a const Interner only looks identifiers up, so several of them can
+// run over text that has already been lexed once.
+class Lexer {
+    const Source& m_source;
+    const Interner& m_names;
+    Interner* m_new_names = nullptr;
+    size_t m_pos = 0;
+
+    [[noreturn]] void error_at(SourceLoc loc, string_view fmt) const { m_source.error_at(loc, fmt); }
+
+    size_t read_num(size_t pos, Token& token) const{
+        auto end = pos;
+        while (end < m_source.size() && (char_class[static_cast<uint8_t>(m_source[end])] & CC_Digit)){
+            ++end;
+        }
+        if (!parse_decimal(m_source.substr(pos, end - pos))){
+            error_at(pos, "integer literal is too large");
+        }
+        token.kind = TokenKind::Num;
+        return end;
+    }
+
+    size_t read_ident(size_t pos, Token& token){
+        auto end = skip_ident(m_source.text(), pos + 1);
+        auto name = m_source.substr(pos, end - pos);
+        if (auto keyword = find_keyword(name)){
+            token.kind = TokenKind::Keyword;
+            token.id = static_cast<uint32_t>(*keyword);
+        }
+        else {
+            token.kind = TokenKind::Ident;
+            token.id = m_new_names ? m_new_names->intern(name) : m_names.find(name);
+        }
+        return end;
+    }
+
+    // The literal ends at the first '"' not preceded by a backslash.
+    size_t read_string(size_t pos, Token& token) const{
+        auto p = pos + 1;
+        while ((p = find_either(m_source.text(), p, '"', '\n')) < m_source.size() && m_source[p] == '"'){
+            if (m_source[p - 1] != '\\'){
+                token.kind = TokenKind::String;
+                return p + 1;
+            }
+            ++p;
+        }
+        error_at(pos, "\" did not closed.\n");
+    }
+
+    size_t read_punct(size_t pos, Token& token) const{
+        auto& state = punct_states[static_cast<uint8_t>(m_source[pos])];
+        token.kind = TokenKind::Punct;
+        if (state.with_eq != Punct::None && pos + 1 < m_source.size() && m_source[pos + 1] == '='){
+            token.id = static_cast<uint32_t>(state.with_eq);
+            return pos + 2;
+        }
+        if (state.single == Punct::None){
+            error_at(pos, "Unknown operator\n");
         }
-        if(pos == 0){
-            return 0;
+        token.id = static_cast<uint32_t>(state.single);
+        return pos + 1;
+    }
+
+    Token read_token(size_t& pos){
+        Token token;
+        token.loc = pos;
+        size_t end = pos;
+        switch (char_class[static_cast<uint8_t>(m_source[pos])]){
+        case CC_IdentStart:
+            end = read_ident(pos, token);
+            break;
+        case CC_Digit:
+            end = read_num(pos, token);
+            break;
+        case CC_Quote:
+            end = read_string(pos, token);
+            break;
+        case CC_Punct:
+            end = read_punct(pos, token);
+            break;
+        default:
+            error_at(pos, "Unknown operator\n");
+        }
+        token.len = end - pos;
+        pos = end;
+        return token;
+    }
+
+public:
+    Lexer(const Source& source, Interner& names): m_source(source), m_names(names), m_new_names(&names) {}
+    Lexer(const Source& source, const Interner& names, size_t pos): m_source(source), m_names(names), m_pos(pos) {}
+
+    Token next(){
+        auto text = m_source.text();
+        while((m_pos = skip_space(text, m_pos)) < text.size()){
+            if (text[m_pos] == '/' && m_pos + 1 < text.size() && text[m_pos + 1] == '/'){
+                m_pos = find_either(text, m_pos + 2, '\n', '\n');
+            }
+            else if (text[m_pos] == '/' && m_pos + 1 < text.size() && text[m_pos + 1] == '*'){
+                m_pos = skip_block_comment(text, m_pos + 2);
+            }
+            else {
+                return read_token(m_pos);
+            }
+        }
+        Token eof;
+        eof.kind = TokenKind::Eof;
+        eof.loc = text.size();
+        return eof;
+    }
+};
+
+// Token source for the parser. Tokens are lexed on demand into a small
+// ring buffer; the parser addresses them by absolute position and may look
+// a few tokens ahead of or behind the furthest one it has requested. Older
+// tokens are retired, so memory does not grow with the length of the input.
+//
+// A cursor shares the source and identifiers of another stream and starts
+// lexing at a token that stream has already passed, keeping its token
+// positions. Cursors never intern, so they may run on other threads.
+//
+// A threaded stream runs its lexer on a thread of its own, which hands the
+// tokens over through a queue. Cursors must not be made from such a stream.
+class TokenStream {
+    static constexpr size_t window = 16;
+    shared_ptr<const Source> m_source;
+    shared_ptr<Interner> m_names;
+    Lexer m_lexer;
+    array<Token, window> m_ring;
+    size_t m_end = 0; // number of tokens lexed so far
+    unique_ptr<SpscQueue<Token, 4096>> m_queue;
+    thread m_lexer_thread;
+    Token m_eof; // the Eof token once the lexer thread has sent it
+    exception_ptr m_lexer_error; // set by the lexer thread before it sends Eof
+
+    Token next(){
+        if (!m_queue){
+            return m_lexer.next();
+        }
+        if (m_eof.kind != TokenKind::Eof){
+            auto token = m_queue->pop();
+            if (token.kind == TokenKind::Eof){
+                m_eof = token;
+                if (m_lexer_error){
+                    rethrow_exception(m_lexer_error);
+                }
+            }
+            return token;
+        }
+        return m_eof;
+    }
+
+public:
+    explicit TokenStream(string_view text, bool threaded = false):
+        m_source(make_shared<Source>(text)),
+        m_names(make_shared<Interner>()),
+        m_lexer(*m_source, *m_names)
+    {
+        if (threaded){
+            m_queue = make_unique<SpscQueue<Token, 4096>>();
+            m_lexer_thread = thread([this]{
+                Token token;
+                do {
+                    try {
+                        token = m_lexer.next();
+                    }
+                    catch (...){
+                        // the parser rethrows it when it reaches the end
+                        m_lexer_error = current_exception();
+                        token = Token{};
+                        token.kind = TokenKind::Eof;
+                    }
+                    m_queue->push(token);
+                } while (token.kind != TokenKind::Eof);
+            });
+        }
+    }
+    TokenStream(const TokenStream& parent, size_t pos, SourceLoc loc):
+        m_source(parent.m_source),
+        m_names(parent.m_names),
+        m_lexer(*m_source, as_const(*m_names), loc),
+        m_end(pos) {}
+    TokenStream(const TokenStream&) = delete;
+    ~TokenStream(){
+        if (m_lexer_thread.joinable()){
+            // let the lexer run to the end so that it does not block on a full queue
+            while (m_eof.kind != TokenKind::Eof){
+                next();
+            }
+            m_lexer_thread.join();
+        }
+    }
+
+    const Token& at(size_t pos){
+        while (pos >= m_end){
+            m_ring[m_end % window] = next();
+            ++m_end;
+        }
+        if (pos + window < m_end){
+            error_at(m_ring[(m_end - 1) % window], "internal error: token " + std::to_string(pos) + " was already retired");
+        }
+        return m_ring[pos % window];
+    }
+
+    const Source& source() const { return *m_source; }
+    // Number of tokens read from the lexer so far.
+    size_t lexed() const { return m_end; }
+    const Interner& names() const { return *m_names; }
+    string_view text(const Token& token) const { return m_source->substr(token.loc, token.len); }
+    const string& ident(const Token& token) const { return m_names->name(token.id); }
+    // The value of a number token, which the lexer checked to fit.
+    int64_t num(const Token& token) const { return *parse_decimal(text(token)); }
+    const string& name(uint32_t id) const { return m_names->name(id); }
+
+    [[noreturn]] void error_at(SourceLoc loc, string_view fmt, bool next=false) const{
+        m_source->error_at(loc, fmt, next);
+    }
+    [[noreturn]] void error_at(const Token& token, string_view fmt, bool next=false) const{
+        m_source->error_at(token.loc, fmt, next);
+    }
+    void assert_at(bool check, const Token& token, string_view fmt, bool next=false) const{
+        if (!check){
+            error_at(token, fmt, next);
         }
-        ident = statement.substr(0, pos);
-        kind = keywords.contains(ident) ? TokenKind::Keyword : TokenKind::Ident;
-        return len = pos;
     }
 
     static string as_octal(char c){
         // convert to octal number
-        return "\\" + to_string(c / 0100) + to_string((c%0100) / 010) + to_string((c%010));
+        return "\\" + std::to_string(c / 0100) + std::to_string((c%0100) / 010) + std::to_string((c%010));
     }
 
     static bool is_number(char c){
@@ -87,7 +623,7 @@ struct Token {
 
     static string read_escaped_char(char c){
         switch (c){
-            case 'a': 
+            case 'a':
                 return as_octal('\a');
             case 'b':
                 return as_octal('\b');
@@ -107,20 +643,14 @@ struct Token {
         return string{c};
     }
 
-    int from_string(string_view statement){
-        kind = TokenKind::String;
-        if (statement[0] != '"'){
-            return 0;
-        }
-        int pos = 1;
+    // Contents of a string literal, escaped for the assembler.
+    string string_literal(const Token& token) const{
+        auto statement = text(token);
         string res;
-        for (;pos < statement.size();++pos){
+        for (size_t pos = 1; pos + 1 < statement.size(); ++pos){
             auto curr_char = statement[pos];
             auto prev_char = statement[pos-1];
-            if (curr_char == '\n'){
-                verror_at(m_curr_line, m_line_pos, "\" did not closed.\n");
-            }
-            else if (curr_char == '\\'){
+            if (curr_char == '\\'){
                 continue;
             }
             else if(prev_char == '\\'){
@@ -131,96 +661,11 @@ struct Token {
                     res += read_escaped_char(curr_char);
                 }
             }
-            else if (curr_char == '"'){
-                text = make_shared<string>(move(res));
-                return len = pos+1;
-            }
             else {
                 res.push_back(curr_char);
             }
         }
-        verror_at(m_curr_line, m_line_pos, "\" did not closed.\n"); abort();
+        return res;
     }
 
-    Token(string_view statement, string_view curr_line, int& pos, int line_no, int line_pos)
-        : statement(statement), m_curr_line(curr_line), loc(pos), m_line_no(line_no), m_line_pos(line_pos)
-    {
-        auto curr = statement.substr(pos);
-        if (curr.size() == 0){
-            verror_at(m_curr_line, m_line_pos, "Fail to tokenize at the end of statement\n");
-        }
-        for (auto op : {"<=", ">=", "==", "!=", "+", "-", "*", "/", "(", ")", "<", ">", "=", ";", "{", "}", "&",",", "[", "]"}){
-            if (curr.starts_with(op)){
-                pos += from_punct(op);
-                return;
-            }
-        }
-        if (auto len = from_string(curr)){
-            pos += len;
-            return;
-        }
-        if (auto len = from_num(curr)){
-            pos += len;
-            return;
-        }
-        if (auto len = from_ident(curr)){
-            pos += len;
-            return;
-        }
-        verror_at(m_curr_line, m_line_pos, "Unknown operator\n");
-    }
 };
-
-using Tokens = vector<Token>;
-
-inline Tokens tokenize(string_view text){
-    Tokens tokens;
-    int p = 0;
-    int curr_line_no = 1;
-    int curr_pos = -1;
-    while(p < text.size()){
-        ++curr_pos;
-        if (text[p] == '\n'){
-            curr_pos = -1;
-            ++curr_line_no;
-        }
-        if (text.substr(p).starts_with("//")){
-            while(text.at(p) != '\n' || p == text.size()){
-                ++p;
-            }
-            ++p;
-        }
-        else if (text.substr(p).starts_with("/*")){
-            p += 2;
-            while(!text.substr(p).starts_with("*/") || p == text.size()){
-                ++p;
-            }
-            p += 2;
-        }
-        else if(isspace(text[p])){
-            p++;
-            continue;
-        }
-        else {
-            tokens.emplace_back(text, text.substr(p - curr_pos), p, curr_line_no, curr_pos);
-        }
-    }
-    return tokens;
-}
-
-
-inline void verror_at(optional<Token> token, string_view fmt, bool next=false){
-    if(token){
-        verror_at(token->m_curr_line, token->m_line_pos, fmt, next);
-    }
-    else{
-        verror_at("", 0, fmt, false);
-    }
-}
-
-inline void assert_at(bool check, const Token& token, string_view fmt, bool next=false){
-    if (!check){
-        verror_at(token, fmt, next);
-    }
-}
-
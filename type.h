@@ -6,9 +6,11 @@ using Type = variant<box<struct TypeInt>, box<struct TypeChar>, box<struct TypeP
     box<struct TypeArray>, box<struct TypeFunc>>;
 using PtrType = shared_ptr<Type>;
 
+// short, int or long by its size in bytes.
 struct TypeInt{
+    int m_size = 4;
     auto operator<=>(const TypeInt&) const = default;
-    int size_of() const { return 8; }
+    int size_of() const { return m_size; }
 };
 
 struct TypeChar{
@@ -63,6 +65,21 @@ inline Type deref(Type type){
 inline int size_of(Type type){
     return visit([](auto&& t){ return t->size_of(); }, type);
 }
+// Scalars are aligned to their size and arrays like their elements.
+inline int align_of(const Type& type){
+    if (auto p = from_box<TypeArray>(type)){
+        return align_of(*p->base);
+    }
+    return size_of(type);
+}
+// Globals follow the x86-64 ABI, which aligns arrays of 16 bytes or more
+// to 16 so that code compiled by gcc may access them as extern.
+inline int align_of_global(const Type& type){
+    if (from_box<TypeArray>(type) && size_of(type) >= 16){
+        return max(align_of(type), 16);
+    }
+    return align_of(type);
+}
 inline int size_of_base(Type type){
     if (auto p = from_box<TypePtr>(type)){
         return size_of(*p->base);
@@ -116,3 +133,30 @@ inline bool is_pointer_like(const Type& t){
 inline bool is_number(const Type& t){
     return from_box<TypeInt>(t) || from_box<TypeChar>(t);
 };
+
+inline bool is_long(const Type& t){
+    auto p = from_box<TypeInt>(t);
+    return p && p->m_size == 8;
+}
+
+// A spelling of the type that is the same for equal types.
+inline string signature(const Type& t){
+    if (auto p = from_box<TypeInt>(t)){
+        return p->m_size == 2 ? "s" : p->m_size == 4 ? "i" : "l";
+    }
+    if (from_box<TypeChar>(t)){
+        return "c";
+    }
+    if (auto p = from_box<TypePtr>(t)){
+        return "*" + signature(*p->base);
+    }
+    if (auto p = from_box<TypeArray>(t)){
+        return "[" + to_string(p->m_size) + "]" + signature(*p->base);
+    }
+    auto f = from_box<TypeFunc>(t);
+    string result = "(";
+    for (auto& param : f->m_params){
+        result += signature(*param) + ",";
+    }
+    return result + ")" + signature(*f->m_ret);
+}
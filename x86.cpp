@@ -0,0 +1,869 @@
+#include "x86.h"
+
+// Instruction selection by tree pattern matching. A value used once, by a
+// later instruction of its own block, is folded into its user, so each
+// block becomes a list of expression trees; every other value lives in a
+// stack slot below the local variables. A tree is labeled bottom-up with
+// the cheapest rule producing each nonterminal at every node, counting
+// instructions, and then reduced top-down emitting the chosen rules into
+// the caller-saved registers.
+namespace {
+
+// The forms a value can be produced in.
+enum Nt : uint8_t {
+    NtReg,      // in a register
+    NtImm,      // a 32-bit immediate
+    NtMem,      // a memory operand holding the 8-byte value
+    NtAddr,     // a memory operand whose address is the value
+    NtFlags,    // flags to test with a condition
+    NtCount,
+};
+
+enum class Rule : uint8_t {
+    None,
+    Slot,           // Mem: the stack slot of a value that is not folded
+    Imm,            // Imm: a constant
+    LocalAddr,      // Addr: disp(%rbp)
+    GlobalAddr,     // Addr: sym(%rip)
+    AddrDisp,       // Addr: Add(Addr, Imm), Sub(Addr, Imm)
+    AddrIndex,      // Addr: Add(Reg, Reg) or Add(Reg, Mul(Reg, 1, 2, 4 or 8))
+    Load,           // Mem: Load(Addr)
+    LoadNarrow,     // Reg: movsx of a Load(Addr) of fewer than 8 bytes
+    Extend,         // Reg: movsx of the low bytes of Reg or Mem
+    Binary,         // Reg: add, sub or imul of Reg and Imm, Mem or Reg
+    IncDec,         // Reg: Add or Sub of Reg and 1
+    Compare,        // Flags: cmp of Reg or Mem and Imm, Reg or Mem
+    Test,           // Flags: test of Reg compared with 0
+    // chain rules
+    RegFromImm,     // mov $imm, or xor for 0
+    RegFromMem,     // mov
+    RegFromAddr,    // lea
+    RegFromFlags,   // setcc and movzx
+    AddrFromReg,    // (%reg)
+    FlagsFromReg,   // test, for != 0
+    FlagsFromMem,   // cmp $0, for != 0
+};
+
+constexpr int infinite = 1 << 20;
+
+struct Label {
+    int cost[NtCount] = {infinite, infinite, infinite, infinite, infinite};
+    Rule rule[NtCount] = {};
+    bool swapped[NtCount] = {};     // the rule takes the operands in reverse
+    Nt src[NtCount] = {};           // the form of the second operand of Binary or Compare
+    Nt dst = NtReg;                 // the form of the first operand of Compare
+    Cond cond = Cond::Ne;           // of the flags
+    bool done = false;
+
+    bool set(Nt nt, int c, Rule r){
+        if (c >= cost[nt]){
+            return false;
+        }
+        cost[nt] = c;
+        rule[nt] = r;
+        return true;
+    }
+};
+
+// Registers free for evaluating a tree, all caller-saved.
+class Pool {
+    uint16_t m_free;
+public:
+    static constexpr uint16_t all = 1 << 0 | 1 << 1 | 1 << 2 | 1 << 6 | 1 << 7 | 1 << 8 | 1 << 9 | 1 << 10 | 1 << 11;
+    explicit Pool(uint16_t free): m_free(free){}
+
+    Pool without(MReg r) const { return Pool(m_free & ~(1 << static_cast<int>(r))); }
+    // Also without the registers an operand refers to.
+    Pool without(const MOperand& op) const {
+        auto pool = *this;
+        if (op.kind == MOperand::Kind::Reg || (op.kind == MOperand::Kind::Mem && op.reg != MReg::None)){
+            pool = pool.without(op.reg);
+        }
+        if (op.kind == MOperand::Kind::Mem && op.index != MReg::None){
+            pool = pool.without(op.index);
+        }
+        return pool;
+    }
+    MReg take() const {
+        if (!m_free){
+            throw logic_error("out of registers in instruction selection");
+        }
+        return static_cast<MReg>(countr_zero(m_free));
+    }
+};
+
+// Registers an expression tree needs is bounded by the pool.
+constexpr int max_need = 7;
+// Labeling and reduction recurse once per level of a tree, so a long chain
+// like a + b + c + ... is cut into trees of bounded depth.
+constexpr int max_depth = 64;
+
+Cond mirror(Cond cond){
+    switch (cond){
+    case Cond::L: return Cond::G;
+    case Cond::Le: return Cond::Ge;
+    case Cond::G: return Cond::L;
+    case Cond::Ge: return Cond::Le;
+    default: return cond;
+    }
+}
+
+Cond invert(Cond cond){
+    switch (cond){
+    case Cond::E: return Cond::Ne;
+    case Cond::Ne: return Cond::E;
+    case Cond::L: return Cond::Ge;
+    case Cond::Le: return Cond::G;
+    case Cond::G: return Cond::Le;
+    case Cond::Ge: return Cond::L;
+    }
+    return cond;
+}
+
+bool fits32(int64_t v){
+    return v == static_cast<int32_t>(v);
+}
+
+// The immediate of a store of size bytes.
+int64_t truncate(int64_t v, int size){
+    switch (size){
+    case 1: return static_cast<int8_t>(v);
+    case 2: return static_cast<int16_t>(v);
+    case 4: return static_cast<int32_t>(v);
+    }
+    return v;
+}
+
+}
+
+class X86Select {
+    const IrFunc& m_ir;
+    MFunc m_func;
+    vector<const Inst*> m_def;
+    vector<bool> m_folded;
+    vector<uint32_t> m_uses;
+    vector<Label> m_labels;
+    Label m_slot;
+    uint16_t m_params = 0;      // argument registers whose parameter is not yet stored
+
+    Pool pool() const {
+        return Pool(Pool::all & ~m_params);
+    }
+
+    MOperand slot(Reg r) const{
+        return mem(MReg::Rbp, -(m_ir.stack_size + 8 * static_cast<int64_t>(r)));
+    }
+    void emit(MOp op, MOperand dst = {}, MOperand src = {}){
+        m_func.code.push_back({op, Cond::E, dst, src});
+    }
+    void emit_cond(MOp op, Cond cond, MOperand dst){
+        m_func.code.push_back({op, cond, dst, {}});
+    }
+
+    // Decides which values are folded into their user: those used once,
+    // later in the same block, computed without side effects, and with no
+    // store or call between any load in their tree and the user. Calls take
+    // only leaves, and a tree is kept within the registers of a Pool and
+    // within max_depth levels.
+    void fold(){
+        auto& uses = m_uses;
+        uses.assign(m_ir.reg_count, 0);
+        m_def.assign(m_ir.reg_count, nullptr);
+        for (auto& block : m_ir.blocks){
+            for (auto& inst : block.insts){
+                for_each_use(m_ir, inst, [&](Reg r){ ++uses[r]; });
+                if (inst.dst){
+                    m_def[inst.dst] = &inst;
+                }
+            }
+        }
+        m_folded.assign(m_ir.reg_count, false);
+        vector<int> need(m_ir.reg_count, 1);
+        vector<int> depth(m_ir.reg_count, 1);
+        // the position of the first load folded into the tree of a value
+        vector<size_t> first_load(m_ir.reg_count, SIZE_MAX);
+        for (auto& block : m_ir.blocks){
+            unordered_map<Reg, size_t> position;
+            size_t last_effect = 0;     // one past the last store or call
+            for (size_t i = 0; i < block.insts.size(); ++i){
+                auto& inst = block.insts[i];
+                vector<Reg> operands;
+                for_each_use(m_ir, inst, [&](Reg r){
+                    auto it = position.find(r);
+                    if (uses[r] != 1 || it == position.end()){
+                        return;
+                    }
+                    auto op = m_def[r]->op;
+                    bool leaf = op == Op::Imm || op == Op::LocalAddr || op == Op::GlobalAddr;
+                    bool pure = leaf || (((is_binary(op) && op != Op::Div) || op == Op::Extend || op == Op::Load) && first_load[r] >= last_effect);
+                    if ((inst.op == Op::Call ? leaf : pure) && depth[r] < max_depth){
+                        m_folded[r] = true;
+                        operands.push_back(r);
+                    }
+                });
+                if (inst.dst){
+                    position[inst.dst] = i;
+                }
+                if (inst.op == Op::Store || inst.op == Op::Call){
+                    last_effect = i + 1;
+                }
+                // the first operand is evaluated first, the others while it is held
+                auto total = [&]{
+                    int result = 0;
+                    int held = inst.op == Op::Div ? 2 : 0;
+                    for_each_use(m_ir, inst, [&](Reg r){
+                        result = max(result, (m_folded[r] ? need[r] : 1) + held);
+                        held = max(held, 1);
+                    });
+                    return max(result, 1);
+                };
+                while (total() > max_need && !operands.empty()){
+                    auto heavy = max_element(operands.begin(), operands.end(), [&](Reg a, Reg b){ return need[a] < need[b]; });
+                    m_folded[*heavy] = false;
+                    operands.erase(heavy);
+                }
+                if (inst.dst){
+                    need[inst.dst] = total();
+                    for (auto r : operands){
+                        depth[inst.dst] = max(depth[inst.dst], depth[r] + 1);
+                    }
+                    first_load[inst.dst] = inst.op == Op::Load ? i : SIZE_MAX;
+                    for (auto r : operands){
+                        first_load[inst.dst] = min(first_load[inst.dst], first_load[r]);
+                    }
+                }
+            }
+        }
+    }
+
+    // The label of a value as an operand: of its tree when it is folded,
+    // of its slot otherwise.
+    const Label& labeled(Reg r){
+        if (!m_folded[r]){
+            return m_slot;
+        }
+        auto& l = m_labels[r];
+        if (!l.done){
+            label_node(*m_def[r], l);
+            close(l);
+            l.done = true;
+        }
+        return l;
+    }
+
+    // Applies the chain rules until no cost improves.
+    static void close(Label& l){
+        bool changed = true;
+        while (changed){
+            changed = false;
+            changed |= l.set(NtReg, l.cost[NtImm] + 1, Rule::RegFromImm);
+            changed |= l.set(NtReg, l.cost[NtMem] + 1, Rule::RegFromMem);
+            changed |= l.set(NtReg, l.cost[NtAddr] + 1, Rule::RegFromAddr);
+            changed |= l.set(NtReg, l.cost[NtFlags] + 2, Rule::RegFromFlags);
+            changed |= l.set(NtAddr, l.cost[NtReg], Rule::AddrFromReg);
+            if (l.set(NtFlags, l.cost[NtMem] + 1, Rule::FlagsFromMem)){
+                l.cond = Cond::Ne;
+                changed = true;
+            }
+            if (l.set(NtFlags, l.cost[NtReg] + 1, Rule::FlagsFromReg)){
+                l.cond = Cond::Ne;
+                changed = true;
+            }
+        }
+    }
+
+    bool is_imm(Reg r, int64_t* value = nullptr) const {
+        if (!m_folded[r] || m_def[r]->op != Op::Imm || !fits32(m_def[r]->imm)){
+            return false;
+        }
+        if (value){
+            *value = m_def[r]->imm;
+        }
+        return true;
+    }
+
+    // The index and scale of r as the index of an address: a multiplication
+    // by 2, 4 or 8 is done by the address.
+    pair<Reg, int64_t> scaled(Reg r) const {
+        if (!m_folded[r] || m_def[r]->op != Op::Mul){
+            return {r, 1};
+        }
+        for (auto [index, factor] : {pair{m_def[r]->a, m_def[r]->b}, pair{m_def[r]->b, m_def[r]->a}}){
+            int64_t scale;
+            if (is_imm(factor, &scale) && (scale == 2 || scale == 4 || scale == 8)){
+                return {index, scale};
+            }
+        }
+        return {r, 1};
+    }
+
+    // The cheapest second operand of an instruction whose first is dst.
+    pair<int, Nt> source(Reg r, Nt dst){
+        auto& l = labeled(r);
+        pair<int, Nt> best{l.cost[NtReg], NtReg};
+        for (auto nt : {NtImm, NtMem}){
+            if (l.cost[nt] < best.first && !(nt == NtMem && dst == NtMem)){
+                best = {l.cost[nt], nt};
+            }
+        }
+        return best;
+    }
+
+    void label_node(const Inst& inst, Label& l){
+        switch (inst.op){
+        case Op::Imm:
+            if (fits32(inst.imm)){
+                l.set(NtImm, 0, Rule::Imm);
+            }
+            else {
+                l.set(NtReg, 1, Rule::RegFromImm);
+            }
+            break;
+        case Op::LocalAddr:
+            l.set(NtAddr, 0, Rule::LocalAddr);
+            break;
+        case Op::GlobalAddr:
+            l.set(NtAddr, 0, Rule::GlobalAddr);
+            break;
+        case Op::Load: {
+            auto address = labeled(inst.a).cost[NtAddr];
+            if (inst.type != IrType::I64){
+                l.set(NtReg, address + 1, Rule::LoadNarrow);
+            }
+            else {
+                l.set(NtMem, address, Rule::Load);
+            }
+            break;
+        }
+        case Op::Add:
+        case Op::Sub:
+        case Op::Mul:
+            label_arithmetic(inst, l);
+            break;
+        case Op::Extend: {
+            auto& operand = labeled(inst.a);
+            if (l.set(NtReg, operand.cost[NtReg] + 1, Rule::Extend)){
+                l.src[NtReg] = NtReg;
+            }
+            if (l.set(NtReg, operand.cost[NtMem] + 1, Rule::Extend)){
+                l.src[NtReg] = NtMem;
+            }
+            break;
+        }
+        case Op::Eq:
+        case Op::Ne:
+        case Op::Lt:
+        case Op::Le: {
+            auto cond = inst.op == Op::Eq ? Cond::E : inst.op == Op::Ne ? Cond::Ne : inst.op == Op::Lt ? Cond::L : Cond::Le;
+            for (bool swapped : {false, true}){
+                auto a = swapped ? inst.b : inst.a;
+                auto b = swapped ? inst.a : inst.b;
+                auto c = swapped ? mirror(cond) : cond;
+                int64_t value;
+                if (is_imm(b, &value) && value == 0 && l.set(NtFlags, labeled(a).cost[NtReg] + 1, Rule::Test)){
+                    l.swapped[NtFlags] = swapped;
+                    l.cond = c;
+                }
+                for (auto dst : {NtReg, NtMem}){
+                    auto [cost, src] = source(b, dst);
+                    if (l.set(NtFlags, labeled(a).cost[dst] + cost + 1, Rule::Compare)){
+                        l.swapped[NtFlags] = swapped;
+                        l.cond = c;
+                        l.dst = dst;
+                        l.src[NtFlags] = src;
+                    }
+                }
+            }
+            break;
+        }
+        default:
+            throw logic_error("unexpected instruction in an expression tree");
+        }
+    }
+
+    void label_arithmetic(const Inst& inst, Label& l){
+        bool commutative = inst.op != Op::Sub;
+        for (bool swapped : {false, true}){
+            if (swapped && !commutative){
+                break;
+            }
+            auto a = swapped ? inst.b : inst.a;
+            auto b = swapped ? inst.a : inst.b;
+            auto [cost, src] = source(b, NtReg);
+            if (l.set(NtReg, labeled(a).cost[NtReg] + cost + 1, Rule::Binary)){
+                l.swapped[NtReg] = swapped;
+                l.src[NtReg] = src;
+            }
+            int64_t value;
+            if (inst.op != Op::Mul && is_imm(b, &value) && (value == 1 || value == -1)
+                    && l.set(NtReg, labeled(a).cost[NtReg] + 1, Rule::IncDec)){
+                l.swapped[NtReg] = swapped;
+            }
+            if (inst.op == Op::Mul){
+                continue;
+            }
+            // the displacement of a local address is its own
+            auto& base = labeled(a);
+            auto disp = base.rule[NtAddr] == Rule::LocalAddr ? -m_def[a]->imm : 0;
+            if (is_imm(b, &value) && base.rule[NtAddr] != Rule::AddrDisp && base.rule[NtAddr] != Rule::AddrIndex
+                    && fits32(disp + (inst.op == Op::Sub ? -value : value))
+                    && l.set(NtAddr, base.cost[NtAddr], Rule::AddrDisp)){
+                l.swapped[NtAddr] = swapped;
+            }
+            if (inst.op == Op::Add){
+                auto [index, scale] = scaled(b);
+                if (!is_imm(b) && l.set(NtAddr, labeled(a).cost[NtReg] + labeled(index).cost[NtReg], Rule::AddrIndex)){
+                    l.swapped[NtAddr] = swapped;
+                }
+            }
+        }
+    }
+
+    // Operands of the instruction at the root of r, in the order of its
+    // label.
+    pair<Reg, Reg> operands(Reg r, Nt nt){
+        auto& inst = *m_def[r];
+        return labeled(r).swapped[nt] ? pair{inst.b, inst.a} : pair{inst.a, inst.b};
+    }
+
+    // Emits the code for r in the form nt and returns the operand it is in.
+    // A register result goes to target.
+    MOperand reduce(Reg r, Nt nt, MReg target, Pool pool){
+        auto& l = labeled(r);
+        auto& inst = *m_def[r];
+        switch (l.rule[nt]){
+        case Rule::None:
+            break;
+        case Rule::Slot:
+            return slot(r);
+        case Rule::Imm:
+            return imm(inst.imm);
+        case Rule::LocalAddr:
+            return mem(MReg::Rbp, -inst.imm);
+        case Rule::GlobalAddr:
+            return rip(inst.imm);
+        case Rule::AddrDisp: {
+            auto [a, b] = operands(r, nt);
+            auto address = reduce(a, NtAddr, target, pool);
+            address.value += inst.op == Op::Sub ? -m_def[b]->imm : m_def[b]->imm;
+            return address;
+        }
+        case Rule::AddrIndex: {
+            auto [a, b] = operands(r, nt);
+            auto base = reduce(a, NtReg, target, pool.without(target));
+            auto [index, scale] = scaled(b);
+            auto rest = pool.without(base);
+            auto i = rest.take();
+            reduce(index, NtReg, i, rest.without(i));
+            auto address = mem(base.reg, 0);
+            address.index = i;
+            address.scale = static_cast<uint8_t>(scale);
+            return address;
+        }
+        case Rule::Load: {
+            auto address = reduce(inst.a, NtAddr, target, pool);
+            address.size = 8;
+            return address;
+        }
+        case Rule::LoadNarrow: {
+            auto address = reduce(inst.a, NtAddr, target, pool);
+            address.size = static_cast<uint8_t>(size_of(inst.type));
+            emit(MOp::Movsx, reg(target), address);
+            return reg(target);
+        }
+        case Rule::Extend: {
+            auto size = static_cast<uint8_t>(size_of(inst.type));
+            auto src = l.src[nt] == NtMem ? reduce(inst.a, NtMem, target, pool) : reg(reduce(inst.a, NtReg, target, pool).reg, size);
+            src.size = size;
+            emit(MOp::Movsx, reg(target), src);
+            return reg(target);
+        }
+        case Rule::Binary: {
+            auto [a, b] = operands(r, nt);
+            reduce(a, NtReg, target, pool.without(target));
+            auto rest = pool.without(target);
+            auto src = reduce(b, l.src[nt], rest.take(), rest.without(rest.take()));
+            emit(inst.op == Op::Add ? MOp::Add : inst.op == Op::Sub ? MOp::Sub : MOp::Imul, reg(target), src);
+            return reg(target);
+        }
+        case Rule::IncDec: {
+            auto [a, b] = operands(r, nt);
+            reduce(a, NtReg, target, pool.without(target));
+            auto up = (m_def[b]->imm == 1) == (inst.op == Op::Add);
+            emit(up ? MOp::Inc : MOp::Dec, reg(target));
+            return reg(target);
+        }
+        case Rule::Compare: {
+            auto [a, b] = operands(r, nt);
+            MOperand dst;
+            if (l.dst == NtReg){
+                dst = reduce(a, NtReg, target, pool.without(target));
+            }
+            else {
+                dst = reduce(a, NtMem, target, pool);
+            }
+            auto rest = pool.without(dst).without(target);
+            auto src = reduce(b, l.src[nt], rest.take(), rest.without(rest.take()));
+            emit(MOp::Cmp, dst, src);
+            return {};
+        }
+        case Rule::Test: {
+            auto [a, b] = operands(r, nt);
+            reduce(a, NtReg, target, pool.without(target));
+            emit(MOp::Test, reg(target), reg(target));
+            return {};
+        }
+        case Rule::RegFromImm:
+            if (inst.imm == 0){
+                // writing the 32-bit register clears the upper half
+                emit(MOp::Xor, reg(target, 4), reg(target, 4));
+            }
+            else {
+                emit(MOp::Mov, reg(target), imm(inst.imm));
+            }
+            return reg(target);
+        case Rule::RegFromMem:
+            emit(MOp::Mov, reg(target), reduce(r, NtMem, target, pool));
+            return reg(target);
+        case Rule::RegFromAddr:
+            emit(MOp::Lea, reg(target), reduce(r, NtAddr, target, pool));
+            return reg(target);
+        case Rule::RegFromFlags:
+            reduce(r, NtFlags, target, pool);
+            emit_cond(MOp::Set, l.cond, reg(target, 1));
+            emit(MOp::Movzx, reg(target), reg(target, 1));
+            return reg(target);
+        case Rule::AddrFromReg:
+            reduce(r, NtReg, target, pool);
+            return mem(target, 0);
+        case Rule::FlagsFromReg:
+            reduce(r, NtReg, target, pool);
+            emit(MOp::Test, reg(target), reg(target));
+            return {};
+        case Rule::FlagsFromMem:
+            emit(MOp::Cmp, reduce(r, NtMem, target, pool), imm(0));
+            return {};
+        }
+        throw logic_error("no rule selected");
+    }
+
+    // Evaluates r into the register target.
+    void value(Reg r, MReg target, Pool pool){
+        reduce(r, NtReg, target, pool.without(target));
+    }
+
+    // Evaluates the tree of a value used elsewhere and stores it to its slot.
+    void root(Reg r){
+        m_folded[r] = true;
+        value(r, MReg::Rax, pool());
+        m_folded[r] = false;
+        emit(MOp::Mov, slot(r), reg(MReg::Rax));
+    }
+
+    // Sets the flags for a branch on r and returns the condition to jump on.
+    Cond flags(Reg r){
+        auto& l = labeled(r);
+        reduce(r, NtFlags, MReg::Rax, pool().without(MReg::Rax));
+        return l.cond;
+    }
+
+    void select(const Inst& inst, BlockId next){
+        if (inst.dst && m_folded[inst.dst]){
+            return;
+        }
+        // such as the value of an assignment used as a statement
+        bool pure = inst.op == Op::Imm || inst.op == Op::LocalAddr || inst.op == Op::GlobalAddr
+            || inst.op == Op::Load || inst.op == Op::Extend || (is_binary(inst.op) && inst.op != Op::Div);
+        if (pure && m_uses[inst.dst] == 0){
+            return;
+        }
+        switch (inst.op){
+        case Op::Imm:
+            if (fits32(inst.imm)){
+                emit(MOp::Mov, slot(inst.dst), imm(inst.imm));
+            }
+            else {
+                root(inst.dst);
+            }
+            break;
+        case Op::Param:
+            emit(MOp::Mov, slot(inst.dst), reg(arg_regs[inst.imm]));
+            m_params &= ~(1 << static_cast<int>(arg_regs[inst.imm]));
+            break;
+        case Op::Store: {
+            auto size = static_cast<uint8_t>(size_of(inst.type));
+            auto address = reduce(inst.a, NtAddr, MReg::Rax, pool().without(MReg::Rax));
+            // the bytes stored are the same without an extension from as many
+            auto stored = inst.b;
+            while (m_folded[stored] && m_def[stored]->op == Op::Extend && size_of(m_def[stored]->type) >= size){
+                stored = m_def[stored]->a;
+            }
+            int64_t constant;
+            if (is_imm(stored, &constant)){
+                address.size = size;
+                emit(MOp::Mov, address, imm(truncate(constant, size)));
+                break;
+            }
+            auto free = pool().without(address).without(MReg::Rax);
+            auto source = free.take();
+            value(stored, source, free);
+            address.size = size;
+            emit(MOp::Mov, address, reg(source, size));
+            break;
+        }
+        case Op::Div: {
+            value(inst.a, MReg::Rax, pool().without(MReg::Rdx));
+            auto& l = labeled(inst.b);
+            auto free = pool().without(MReg::Rax).without(MReg::Rdx);
+            auto nt = l.cost[NtMem] < l.cost[NtReg] ? NtMem : NtReg;
+            auto divisor = reduce(inst.b, nt, free.take(), free.without(free.take()));
+            // a 32-bit division is several times faster
+            if (inst.type == IrType::I32){
+                divisor.size = 4;
+                emit(MOp::Cdq);
+                emit(MOp::Idiv, divisor);
+                emit(MOp::Movsx, reg(MReg::Rax), reg(MReg::Rax, 4));
+            }
+            else {
+                emit(MOp::Cqo);
+                emit(MOp::Idiv, divisor);
+            }
+            emit(MOp::Mov, slot(inst.dst), reg(MReg::Rax));
+            break;
+        }
+        case Op::Call: {
+            auto free = pool();
+            for (Reg i = 0; i < inst.b; ++i){
+                value(m_ir.args[inst.a + i], arg_regs[i], free);
+                free = free.without(arg_regs[i]);
+            }
+            // no vector registers are passed to variadic functions
+            emit(MOp::Xor, reg(MReg::Rax, 4), reg(MReg::Rax, 4));
+            emit(MOp::Call, sym(inst.imm));
+            emit(MOp::Mov, slot(inst.dst), reg(MReg::Rax));
+            break;
+        }
+        case Op::Jmp:
+            if (inst.t != next){
+                emit(MOp::Jmp, label(inst.t));
+            }
+            break;
+        case Op::Br: {
+            auto cond = flags(inst.a);
+            if (inst.t == next){
+                emit_cond(MOp::Jcc, invert(cond), label(inst.f));
+            }
+            else {
+                emit_cond(MOp::Jcc, cond, label(inst.t));
+                if (inst.f != next){
+                    emit(MOp::Jmp, label(inst.f));
+                }
+            }
+            break;
+        }
+        case Op::Ret:
+            if (inst.a){
+                value(inst.a, MReg::Rax, pool());
+            }
+            if (next != m_func.return_label){
+                emit(MOp::Jmp, label(m_func.return_label));
+            }
+            break;
+        default:
+            root(inst.dst);
+            break;
+        }
+    }
+
+public:
+    X86Select(const IrFunc& ir): m_ir(ir), m_labels(ir.reg_count){
+        m_slot.set(NtMem, 0, Rule::Slot);
+        close(m_slot);
+    }
+
+    MFunc select(){
+        m_func.name = m_ir.name;
+        m_func.symbols = m_ir.symbols;
+        m_func.return_label = m_ir.blocks.size();
+        fold();
+        for (auto& block : m_ir.blocks){
+            for (auto& inst : block.insts){
+                if (inst.op == Op::Param){
+                    m_params |= 1 << static_cast<int>(arg_regs[inst.imm]);
+                }
+            }
+        }
+        auto frame = round_up(m_ir.stack_size + 8 * (m_ir.reg_count - 1), 16);
+        emit(MOp::Push, reg(MReg::Rbp));
+        emit(MOp::Mov, reg(MReg::Rbp), reg(MReg::Rsp));
+        emit(MOp::Sub, reg(MReg::Rsp), imm(frame));
+        for (BlockId id = 0; id < m_ir.blocks.size(); ++id){
+            emit(MOp::Label, label(id));
+            for (auto& inst : m_ir.blocks[id].insts){
+                select(inst, id + 1);
+            }
+        }
+        emit(MOp::Label, label(m_func.return_label));
+        emit(MOp::Mov, reg(MReg::Rsp), reg(MReg::Rbp));
+        emit(MOp::Pop, reg(MReg::Rbp));
+        emit(MOp::Ret);
+        return move(m_func);
+    }
+};
+
+MFunc select_x86(const IrFunc& func){
+    return X86Select(func).select();
+}
+
+static const char* reg_names_8[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+static const char* reg_names_2[] = {
+    "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+    "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w",
+};
+static const char* reg_names_4[] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+};
+static const char* reg_names_1[] = {
+    "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+};
+
+static char suffix(uint8_t size){
+    return size == 1 ? 'b' : size == 2 ? 'w' : size == 4 ? 'l' : 'q';
+}
+
+static string_view cond_name(Cond cond){
+    switch (cond){
+    case Cond::E: return "e";
+    case Cond::Ne: return "ne";
+    case Cond::L: return "l";
+    case Cond::Le: return "le";
+    case Cond::G: return "g";
+    case Cond::Ge: return "ge";
+    }
+    return "?";
+}
+
+// Prints in AT&T syntax: the source operand comes first.
+class X86Printer {
+    const MFunc& m_func;
+    ostream& m_out;
+
+    void operand(const MOperand& op){
+        switch (op.kind){
+        case MOperand::Kind::None:
+            break;
+        case MOperand::Kind::Reg:
+            m_out << '%' << (op.size == 1 ? reg_names_1 : op.size == 2 ? reg_names_2 : op.size == 4 ? reg_names_4 : reg_names_8)[static_cast<int>(op.reg)];
+            break;
+        case MOperand::Kind::Imm:
+            m_out << '$' << op.value;
+            break;
+        case MOperand::Kind::Mem:
+            if (op.reg == MReg::None){
+                m_out << m_func.symbols[op.sym];
+                if (op.value){
+                    m_out << showpos << op.value << noshowpos;
+                }
+                m_out << "(%rip)";
+            }
+            else {
+                if (op.value){
+                    m_out << op.value;
+                }
+                m_out << "(%" << reg_names_8[static_cast<int>(op.reg)];
+                if (op.index != MReg::None){
+                    m_out << ",%" << reg_names_8[static_cast<int>(op.index)] << ',' << static_cast<int>(op.scale);
+                }
+                m_out << ')';
+            }
+            break;
+        case MOperand::Kind::Sym:
+            m_out << m_func.symbols[op.sym];
+            break;
+        case MOperand::Kind::Label:
+            if (op.value == m_func.return_label){
+                m_out << ".L.return." << m_func.name;
+            }
+            else {
+                m_out << ".L." << m_func.name << '.' << op.value;
+            }
+            break;
+        }
+    }
+
+    void inst(string_view mnemonic, const MInst& in, string_view suffixes = ""){
+        m_out << "  " << mnemonic << suffixes;
+        if (in.src.kind != MOperand::Kind::None){
+            m_out << ' ';
+            operand(in.src);
+            m_out << ", ";
+            operand(in.dst);
+        }
+        else if (in.dst.kind != MOperand::Kind::None){
+            m_out << ' ';
+            operand(in.dst);
+        }
+        m_out << '\n';
+    }
+
+    void sized(string_view mnemonic, const MInst& in){
+        char s[] = {suffix(in.dst.size)};
+        inst(mnemonic, in, {s, 1});
+    }
+
+public:
+    X86Printer(const MFunc& func, ostream& out): m_func(func), m_out(out){}
+
+    void print(){
+        m_out << "  .global " << m_func.name << '\n';
+        m_out << "  .text" << '\n';
+        m_out << m_func.name << ":\n";
+        for (auto& in : m_func.code){
+            switch (in.op){
+            case MOp::Mov: sized("mov", in); break;
+            case MOp::Movsx: {
+                char s[] = {suffix(in.src.size), suffix(in.dst.size)};
+                inst("movs", in, {s, 2});
+                break;
+            }
+            case MOp::Movzx: {
+                char s[] = {suffix(in.src.size), suffix(in.dst.size)};
+                inst("movz", in, {s, 2});
+                break;
+            }
+            case MOp::Lea: sized("lea", in); break;
+            case MOp::Add: sized("add", in); break;
+            case MOp::Sub: sized("sub", in); break;
+            case MOp::Xor: sized("xor", in); break;
+            case MOp::Inc: sized("inc", in); break;
+            case MOp::Dec: sized("dec", in); break;
+            case MOp::Imul: sized("imul", in); break;
+            case MOp::Cqo: inst("cqo", in); break;
+            case MOp::Cdq: inst("cltd", in); break;
+            case MOp::Idiv: sized("idiv", in); break;
+            case MOp::Cmp: sized("cmp", in); break;
+            case MOp::Test: sized("test", in); break;
+            case MOp::Set: inst("set", in, cond_name(in.cond)); break;
+            case MOp::Push: sized("push", in); break;
+            case MOp::Pop: sized("pop", in); break;
+            case MOp::Call: inst("call", in); break;
+            case MOp::Jmp: inst("jmp", in); break;
+            case MOp::Jcc: inst("j", in, cond_name(in.cond)); break;
+            case MOp::Ret: inst("ret", in); break;
+            case MOp::Label:
+                operand(in.dst);
+                m_out << ":\n";
+                break;
+            }
+        }
+    }
+};
+
+void print(const MFunc& func, ostream& out){
+    X86Printer(func, out).print();
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "common.h"
+#include "ir.h"
+
+// x86-64 machine code of one function, as a list of instructions over
+// physical registers. It is printed as AT&T assembly.
+
+// In hardware encoding order.
+enum class MReg : uint8_t {
+    Rax, Rcx, Rdx, Rbx, Rsp, Rbp, Rsi, Rdi,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+    None,
+};
+
+inline constexpr MReg arg_regs[] = {MReg::Rdi, MReg::Rsi, MReg::Rdx, MReg::Rcx, MReg::R8, MReg::R9};
+
+// Condition codes of set and conditional jumps.
+enum class Cond : uint8_t { E, Ne, L, Le, G, Ge };
+
+enum class MOp : uint8_t {
+    Mov,      // dst = src, or a store when dst is memory
+    Movsx,    // dst = sign extended src
+    Movzx,    // dst = zero extended src
+    Lea,      // dst = address of src
+    Add,
+    Sub,
+    Xor,
+    Inc,      // dst += 1
+    Dec,      // dst -= 1
+    Imul,     // dst *= src, an immediate src included
+    Cqo,      // rdx:rax = sign extended rax
+    Cdq,      // edx:eax = sign extended eax
+    Idiv,     // rax = rdx:rax / dst, rdx = remainder
+    Cmp,      // flags = dst - src
+    Test,     // flags = dst & src
+    Set,      // dst (a byte register) = cond ? 1 : 0
+    Push,
+    Pop,
+    Call,     // dst is a symbol
+    Jmp,      // dst is a label
+    Jcc,      // if cond goto label dst
+    Ret,
+    Label,    // dst is the label defined here
+};
+
+struct MOperand {
+    enum class Kind : uint8_t { None, Reg, Imm, Mem, Sym, Label };
+    Kind kind = Kind::None;
+    uint8_t size = 8;       // bytes accessed through the operand
+    MReg reg = MReg::None;  // the register, or the base of Mem (None for rip-relative)
+    int64_t value = 0;      // immediate, displacement, or label id
+    uint32_t sym = 0;       // symbol of Sym and rip-relative Mem
+    MReg index = MReg::None; // of Mem, added scale times to the base
+    uint8_t scale = 1;
+};
+
+inline MOperand reg(MReg r, uint8_t size = 8) { return {MOperand::Kind::Reg, size, r}; }
+inline MOperand imm(int64_t value) { return {MOperand::Kind::Imm, 8, MReg::None, value}; }
+inline MOperand mem(MReg base, int64_t disp, uint8_t size = 8) { return {MOperand::Kind::Mem, size, base, disp}; }
+inline MOperand rip(uint32_t sym, uint8_t size = 8) { return {MOperand::Kind::Mem, size, MReg::None, 0, sym}; }
+inline MOperand sym(uint32_t sym) { return {MOperand::Kind::Sym, 8, MReg::None, 0, sym}; }
+inline MOperand label(int64_t id) { return {MOperand::Kind::Label, 8, MReg::None, id}; }
+
+struct MInst {
+    MOp op;
+    Cond cond = Cond::E;
+    MOperand dst;
+    MOperand src;
+};
+
+struct MFunc {
+    string name;
+    vector<MInst> code;
+    vector<string> symbols;
+    int64_t return_label;   // label of the epilogue
+};
+
+// A reference from machine code to a symbol, to be filled in by the
+// linker with the symbol + addend - the address of the field.
+struct MReloc {
+    uint32_t offset;        // of the 32-bit field in the code
+    uint32_t sym;           // index into MFunc::symbols
+    int64_t addend;
+    bool call;              // through the PLT, for calls
+};
+
+// Machine code of a function with its jumps resolved.
+struct MCode {
+    vector<uint8_t> bytes;
+    vector<MReloc> relocs;
+};
+
+// Instruction selection by tree pattern matching over the IR of each
+// block. A value used once, later in its block, is folded into its user;
+// every other value gets a stack slot below the local variables.
+MFunc select_x86(const IrFunc& func);
+
+void print(const MFunc& func, ostream& out);
+
+// Encodes the instructions. Jumps take the short form where the target is
+// in reach.
+MCode encode(const MFunc& func);
@@ -0,0 +1,299 @@
+#include "x86.h"
+
+static uint8_t cond_code(Cond cond){
+    switch (cond){
+    case Cond::E: return 0x4;
+    case Cond::Ne: return 0x5;
+    case Cond::L: return 0xc;
+    case Cond::Le: return 0xe;
+    case Cond::G: return 0xf;
+    case Cond::Ge: return 0xd;
+    }
+    return 0;
+}
+
+static bool fits8(int64_t v){
+    return v == static_cast<int8_t>(v);
+}
+
+static bool fits32(int64_t v){
+    return v == static_cast<int32_t>(v);
+}
+
+static int number(MReg r){
+    return static_cast<int>(r);
+}
+
+// Encodes into x86-64 machine code. Jumps whose label is not yet known get
+// their displacement patched once the whole function is laid out; a jump
+// starts in the short form and is widened when its target turns out to be
+// out of reach, until no jump changes.
+class X86Encoder {
+    const MFunc& m_func;
+    MCode m_code;
+    vector<bool> m_long;                // per instruction, for jumps
+    map<int64_t, uint32_t> m_labels;    // label id to offset
+    struct Jump {
+        size_t inst;
+        uint32_t field;                 // offset of the displacement
+        uint32_t end;                   // offset of the next instruction
+        int64_t label;
+    };
+    vector<Jump> m_jumps;
+
+    void byte(uint8_t b){
+        m_code.bytes.push_back(b);
+    }
+    void bytes(uint64_t value, int count){
+        for (int i = 0; i < count; ++i){
+            byte(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    // Prefixes, opcode and ModRM of an instruction whose r/m operand is rm,
+    // with reg the register or opcode extension of the ModRM reg field.
+    // imm_size is the size of an immediate that follows, which a
+    // rip-relative displacement is relative to the end of.
+    // byte_reg and byte_rm tell whether the registers are accessed as bytes.
+    void modrm(initializer_list<uint8_t> opcode, int reg, const MOperand& rm, bool w, bool byte_reg, bool byte_rm, int imm_size = 0){
+        auto base = rm.kind == MOperand::Kind::Reg || (rm.kind == MOperand::Kind::Mem && rm.reg != MReg::None) ? number(rm.reg) : 0;
+        auto index = rm.kind == MOperand::Kind::Mem && rm.index != MReg::None ? number(rm.index) : -1;
+        int rex = (w ? 8 : 0) | (reg >= 8 ? 4 : 0) | (index >= 8 ? 2 : 0) | (base >= 8 ? 1 : 0);
+        // spl, bpl, sil and dil are only reachable with a REX prefix
+        auto low_byte = [](int r){ return r >= 4 && r < 8; };
+        if ((byte_rm && rm.kind == MOperand::Kind::Reg && low_byte(base)) || (byte_reg && low_byte(reg))){
+            rex |= 0x40;
+        }
+        if (rex){
+            byte(0x40 | rex);
+        }
+        for (auto b : opcode){
+            byte(b);
+        }
+        if (rm.kind == MOperand::Kind::Reg){
+            byte(0xc0 | (reg & 7) << 3 | (base & 7));
+            return;
+        }
+        if (rm.reg == MReg::None){
+            byte(0x05 | (reg & 7) << 3);
+            m_code.relocs.push_back({static_cast<uint32_t>(m_code.bytes.size()), rm.sym, rm.value - 4 - imm_size, false});
+            bytes(0, 4);
+            return;
+        }
+        auto disp = rm.value;
+        int mod = disp == 0 && (base & 7) != 5 ? 0 : fits8(disp) ? 1 : 2;
+        // a SIB byte follows for an index, and for a base of rsp or r12,
+        // whose ModRM encoding means that one follows
+        if (index >= 0){
+            auto scale = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+            byte(mod << 6 | (reg & 7) << 3 | 4);
+            byte(scale << 6 | (index & 7) << 3 | (base & 7));
+        }
+        else {
+            byte(mod << 6 | (reg & 7) << 3 | (base & 7));
+            if ((base & 7) == 4){
+                byte(0x24);
+            }
+        }
+        bytes(disp, mod == 1 ? 1 : mod == 2 ? 4 : 0);
+    }
+
+    // add, sub, cmp and the other arithmetic instructions of the 00-3f
+    // block, of which ext is the index.
+    void arithmetic(int ext, const MInst& in){
+        auto& d = in.dst;
+        auto& s = in.src;
+        auto size = d.size;
+        if (size == 2){
+            byte(0x66);
+        }
+        uint8_t wide = size == 1 ? 0 : 1;
+        if (s.kind == MOperand::Kind::Imm){
+            if (size != 1 && fits8(s.value)){
+                modrm({0x83}, ext, d, size == 8, false, false, 1);
+                bytes(s.value, 1);
+            }
+            else {
+                auto imm_size = size == 1 ? 1 : size == 2 ? 2 : 4;
+                modrm({static_cast<uint8_t>(size == 1 ? 0x80 : 0x81)}, ext, d, size == 8, false, size == 1, imm_size);
+                bytes(s.value, imm_size);
+            }
+        }
+        else if (s.kind == MOperand::Kind::Reg){
+            modrm({static_cast<uint8_t>(ext * 8 + wide)}, number(s.reg), d, size == 8, size == 1, size == 1);
+        }
+        else {
+            modrm({static_cast<uint8_t>(ext * 8 + 2 + wide)}, number(d.reg), s, size == 8, size == 1, false);
+        }
+    }
+
+    void test(const MInst& in){
+        auto& d = in.dst;
+        auto& s = in.src;
+        auto size = d.size;
+        if (size == 2){
+            byte(0x66);
+        }
+        if (s.kind == MOperand::Kind::Imm){
+            auto imm_size = size == 1 ? 1 : size == 2 ? 2 : 4;
+            modrm({static_cast<uint8_t>(size == 1 ? 0xf6 : 0xf7)}, 0, d, size == 8, false, size == 1, imm_size);
+            bytes(s.value, imm_size);
+        }
+        else {
+            modrm({static_cast<uint8_t>(size == 1 ? 0x84 : 0x85)}, number(s.reg), d, size == 8, size == 1, size == 1);
+        }
+    }
+
+    void mov(const MInst& in){
+        auto& d = in.dst;
+        auto& s = in.src;
+        auto size = d.size;
+        if (s.kind == MOperand::Kind::Imm && d.kind == MOperand::Kind::Reg && size == 8 && !fits32(s.value)){
+            auto r = number(d.reg);
+            byte(0x48 | (r >= 8 ? 1 : 0));
+            byte(0xb8 + (r & 7));
+            bytes(s.value, 8);
+            return;
+        }
+        if (size == 2){
+            byte(0x66);
+        }
+        if (s.kind == MOperand::Kind::Imm){
+            auto imm_size = size == 1 ? 1 : size == 2 ? 2 : 4;
+            modrm({static_cast<uint8_t>(size == 1 ? 0xc6 : 0xc7)}, 0, d, size == 8, false, size == 1, imm_size);
+            bytes(s.value, imm_size);
+        }
+        else if (s.kind == MOperand::Kind::Reg){
+            modrm({static_cast<uint8_t>(size == 1 ? 0x88 : 0x89)}, number(s.reg), d, size == 8, size == 1, size == 1);
+        }
+        else {
+            modrm({static_cast<uint8_t>(size == 1 ? 0x8a : 0x8b)}, number(d.reg), s, size == 8, size == 1, false);
+        }
+    }
+
+    void extend(const MInst& in, bool sign){
+        auto& d = in.dst;
+        auto& s = in.src;
+        if (d.size == 2){
+            byte(0x66);
+        }
+        if (s.size == 4){
+            // movslq; a zero extended 32-bit value is a plain 32-bit mov
+            modrm({static_cast<uint8_t>(sign ? 0x63 : 0x8b)}, number(d.reg), s, sign, false, false);
+            return;
+        }
+        uint8_t op = (sign ? 0xbe : 0xb6) + (s.size == 2 ? 1 : 0);
+        modrm({0x0f, op}, number(d.reg), s, d.size == 8, false, s.size == 1);
+    }
+
+    void jump(size_t index, const MInst& in){
+        bool is_long = m_long[index];
+        if (in.op == MOp::Jmp){
+            byte(is_long ? 0xe9 : 0xeb);
+        }
+        else if (is_long){
+            byte(0x0f);
+            byte(0x80 | cond_code(in.cond));
+        }
+        else {
+            byte(0x70 | cond_code(in.cond));
+        }
+        auto field = static_cast<uint32_t>(m_code.bytes.size());
+        bytes(0, is_long ? 4 : 1);
+        m_jumps.push_back({index, field, static_cast<uint32_t>(m_code.bytes.size()), in.dst.value});
+    }
+
+    void inst(size_t index, const MInst& in){
+        auto& d = in.dst;
+        switch (in.op){
+        case MOp::Mov: mov(in); break;
+        case MOp::Movsx: extend(in, true); break;
+        case MOp::Movzx: extend(in, false); break;
+        case MOp::Lea: modrm({0x8d}, number(d.reg), in.src, true, false, false); break;
+        case MOp::Add: arithmetic(0, in); break;
+        case MOp::Sub: arithmetic(5, in); break;
+        case MOp::Xor: arithmetic(6, in); break;
+        case MOp::Cmp: arithmetic(7, in); break;
+        case MOp::Inc:
+        case MOp::Dec:
+            if (d.size == 2){
+                byte(0x66);
+            }
+            modrm({static_cast<uint8_t>(d.size == 1 ? 0xfe : 0xff)}, in.op == MOp::Inc ? 0 : 1, d, d.size == 8, false, d.size == 1);
+            break;
+        case MOp::Test: test(in); break;
+        case MOp::Imul:
+            if (in.src.kind == MOperand::Kind::Imm){
+                auto short_form = fits8(in.src.value);
+                modrm({static_cast<uint8_t>(short_form ? 0x6b : 0x69)}, number(d.reg), d, d.size == 8, false, false, short_form ? 1 : 4);
+                bytes(in.src.value, short_form ? 1 : 4);
+            }
+            else {
+                modrm({0x0f, 0xaf}, number(d.reg), in.src, d.size == 8, false, false);
+            }
+            break;
+        case MOp::Cqo: byte(0x48); byte(0x99); break;
+        case MOp::Cdq: byte(0x99); break;
+        case MOp::Idiv: modrm({static_cast<uint8_t>(d.size == 1 ? 0xf6 : 0xf7)}, 7, d, d.size == 8, false, d.size == 1); break;
+        case MOp::Set: modrm({0x0f, static_cast<uint8_t>(0x90 | cond_code(in.cond))}, 0, d, false, false, true); break;
+        case MOp::Push:
+        case MOp::Pop:
+            if (number(d.reg) >= 8){
+                byte(0x41);
+            }
+            byte((in.op == MOp::Push ? 0x50 : 0x58) + (number(d.reg) & 7));
+            break;
+        case MOp::Call:
+            byte(0xe8);
+            m_code.relocs.push_back({static_cast<uint32_t>(m_code.bytes.size()), d.sym, -4, true});
+            bytes(0, 4);
+            break;
+        case MOp::Jmp:
+        case MOp::Jcc:
+            jump(index, in);
+            break;
+        case MOp::Ret: byte(0xc3); break;
+        case MOp::Label: m_labels[d.value] = m_code.bytes.size(); break;
+        }
+    }
+
+    // Lays out the function once; returns whether every short jump reaches.
+    bool pass(){
+        m_code = {};
+        m_labels.clear();
+        m_jumps.clear();
+        for (size_t i = 0; i < m_func.code.size(); ++i){
+            inst(i, m_func.code[i]);
+        }
+        bool fits = true;
+        for (auto& jump : m_jumps){
+            auto disp = static_cast<int64_t>(m_labels.at(jump.label)) - jump.end;
+            if (m_long[jump.inst]){
+                for (int i = 0; i < 4; ++i){
+                    m_code.bytes[jump.field + i] = static_cast<uint8_t>(disp >> (8 * i));
+                }
+            }
+            else if (fits8(disp)){
+                m_code.bytes[jump.field] = static_cast<uint8_t>(disp);
+            }
+            else {
+                m_long[jump.inst] = true;
+                fits = false;
+            }
+        }
+        return fits;
+    }
+
+public:
+    explicit X86Encoder(const MFunc& func): m_func(func), m_long(func.code.size()){}
+
+    MCode encode(){
+        while (!pass()){
+        }
+        return move(m_code);
+    }
+};
+
+MCode encode(const MFunc& func){
+    return X86Encoder(func).encode();
+}